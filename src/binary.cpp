@@ -0,0 +1,247 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Binary ingest protocol
+ *
+ */
+
+#include "binary.hpp"
+
+#include <cstring>
+#include <string_view>
+
+#define BINARY_BUFFER_SIZE	65536
+#define BINARY_MAX_FRAME	(16 * 1024 * 1024)
+#define BINARY_MAX_SERIES	(1024 * 1024)	// per connection
+#define BINARY_POINT_SIZE	20
+
+static uint16_t Read16(const char *ptr)
+{
+	const uint8_t *p = (const uint8_t*)ptr;
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t Read32(const char *ptr)
+{
+	const uint8_t *p = (const uint8_t*)ptr;
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t Read64(const char *ptr)
+{
+	return (uint64_t)Read32(ptr) | ((uint64_t)Read32(ptr + 4) << 32);
+}
+
+static bool Fail(std::string &error, const char *message)
+{
+	error.assign(message);
+	return false;
+}
+
+static void Write32(char *ptr, uint32_t value)
+{
+	for (int32_t i = 0; i < 4; i++)
+		ptr[i] = (char)(value >> (i * 8));
+}
+
+BinaryDecoder::BinaryDecoder(void)
+	: m_Capacity(BINARY_BUFFER_SIZE), m_Start(0), m_End(0)
+{
+}
+
+BinaryDecoder::~BinaryDecoder(void)
+{
+}
+
+char* BinaryDecoder::GetWriteBuffer(std::size_t &space)
+{
+	// allocated on first use, idle connections don't hold a buffer
+	if (!m_Buffer)
+		m_Buffer.reset(new char[m_Capacity]);
+
+	std::size_t pending = m_End - m_Start;
+	if (m_Start > 0 && (pending == 0 || m_Capacity - m_End < m_Capacity / 4))
+	{
+		// move the partial frame to the front
+		memmove(m_Buffer.get(), m_Buffer.get() + m_Start, pending);
+		m_End = pending;
+		m_Start = 0;
+	}
+
+	if (pending >= BINARY_HEADER_SIZE)
+	{
+		// make room for the whole frame; Decode has checked its length
+		std::size_t needed = BINARY_HEADER_SIZE + Read32(m_Buffer.get() + m_Start);
+		if (needed > m_Capacity && needed <= BINARY_HEADER_SIZE + BINARY_MAX_FRAME)
+		{
+			std::unique_ptr<char[]> buffer(new char[needed]);
+			memcpy(buffer.get(), m_Buffer.get() + m_Start, pending);
+			m_Buffer.swap(buffer);
+			m_Capacity = needed;
+			m_End = pending;
+			m_Start = 0;
+		}
+	}
+	else if (pending == 0 && m_Capacity > BINARY_BUFFER_SIZE)
+	{
+		// back to the normal size after a large frame
+		m_Buffer.reset(new char[BINARY_BUFFER_SIZE]);
+		m_Capacity = BINARY_BUFFER_SIZE;
+	}
+
+	space = m_Capacity - m_End;
+	return m_Buffer.get() + m_End;
+}
+
+void BinaryDecoder::Commit(std::size_t length)
+{
+	m_End += length;
+}
+
+bool BinaryDecoder::Decode(MetricBatch &batch, std::size_t &points,
+	std::string &reply)
+{
+	std::string error;
+	while (m_End - m_Start >= BINARY_HEADER_SIZE)
+	{
+		const char *header = m_Buffer.get() + m_Start;
+		uint32_t length = Read32(header);
+		if (length > BINARY_MAX_FRAME)
+			error.assign("Frame too large");
+		else if (m_End - m_Start < BINARY_HEADER_SIZE + length)
+			return true;	// wait for the rest of the frame
+
+		if (error.empty())
+		{
+			const char *payload = header + BINARY_HEADER_SIZE;
+			std::size_t accepted = 0;
+
+			switch ((BinaryFrame)header[4])
+			{
+			case BinaryFrame::SERIES:
+				DecodeSeries(payload, length, batch, error);
+				break;
+
+			case BinaryFrame::POINTS:
+				DecodePoints(payload, length, batch, accepted, error);
+				break;
+
+			default:
+				error.assign("Unknown frame type");
+				break;
+			}
+
+			points += accepted;
+			if (error.empty() && (header[5] & BINARY_FLAG_ACK))
+			{
+				char count[4];
+				Write32(count, (uint32_t)accepted);
+				AppendFrame(reply, BinaryFrame::ACK, count, sizeof(count));
+			}
+		}
+
+		if (!error.empty())
+		{
+			AppendFrame(reply, BinaryFrame::REJECT, error.data(), error.length());
+			return false;
+		}
+
+		m_Start += BINARY_HEADER_SIZE + length;
+	}
+
+	return true;
+}
+
+void BinaryDecoder::AppendFrame(std::string &out, BinaryFrame type,
+	const char *payload, std::size_t length)
+{
+	char header[BINARY_HEADER_SIZE] = { 0 };
+	Write32(header, (uint32_t)length);
+	header[4] = (char)type;
+
+	out.append(header, sizeof(header));
+	out.append(payload, length);
+}
+
+bool BinaryDecoder::DecodeSeries(const char *data, std::size_t length,
+	MetricBatch &batch, std::string &error)
+{
+	const char *end = data + length;
+	while (data < end)
+	{
+		if (end - data < 6)
+			return Fail(error, "Truncated series definition");
+
+		uint32_t id = Read32(data);
+		uint16_t nameLength = Read16(data + 4);
+		data += 6;
+		if (end - data < nameLength + 2)
+			return Fail(error, "Truncated series definition");
+
+		std::string_view name(data, nameLength);
+		data += nameLength;
+
+		uint16_t tagsLength = Read16(data);
+		data += 2;
+		if (end - data < tagsLength)
+			return Fail(error, "Truncated series definition");
+
+		std::string_view tags(data, tagsLength);
+		data += tagsLength;
+
+		if (id >= BINARY_MAX_SERIES)
+			return Fail(error, "Series id out of range");
+
+		// the name and tags are validated and interned once, here; a
+		// series past the limits stays defined, and its points are dropped
+		Series series;
+		series.defined = true;
+		series.dropped = false;
+		bool overLimit = false;
+		if (!batch.GetMetric(name, series.metric, error, &overLimit) ||
+			!batch.GetSeries(series.metric, tags, series.series, error,
+				&overLimit))
+		{
+			if (!overLimit)
+				return false;
+			series.dropped = true;
+			error.clear();
+		}
+
+		if (id >= m_Series.size())
+			m_Series.resize(id + 1, Series{ false, false, 0, 0 });
+		m_Series[id] = series;
+	}
+
+	return true;
+}
+
+bool BinaryDecoder::DecodePoints(const char *data, std::size_t length,
+	MetricBatch &batch, std::size_t &points, std::string &error)
+{
+	if (length % BINARY_POINT_SIZE != 0)
+		return Fail(error, "Truncated data point");
+
+	Point point;
+	for (const char *end = data + length; data < end; data += BINARY_POINT_SIZE)
+	{
+		uint32_t id = Read32(data);
+		if (id >= m_Series.size() || !m_Series[id].defined)
+			return Fail(error, "Undefined series id");
+
+		++points;
+		if (m_Series[id].dropped)
+			continue;
+
+		uint64_t bits = Read64(data + 12);
+		memcpy(&point.value, &bits, sizeof(point.value));
+		point.timestamp = Read64(data + 4);
+		point.metric = m_Series[id].metric;
+		point.series = m_Series[id].series;
+
+		batch.Add(point);
+	}
+
+	return true;
+}
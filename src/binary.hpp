@@ -0,0 +1,90 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Binary ingest protocol
+ *
+ * A length-prefixed framing for agents that want to skip text parsing.
+ * Every integer is little-endian and every frame starts with an 8 byte
+ * header:
+ *
+ *	u32 length		payload bytes after the header
+ *	u8  type
+ *	u8  flags		BINARY_FLAG_ACK asks for an ACK frame in reply
+ *	u16 reserved	zero
+ *
+ * A SERIES frame defines any number of series for the connection, each
+ * as { u32 id, u16 length, metric name, u16 length, tags }; the tags use
+ * the telnet form ("host=web01 dc=lga") and are checked once, here. A
+ * POINTS frame then carries any number of fixed-width data points, each
+ * as { u32 series id, u64 timestamp, f64 value }. Ids are chosen by the
+ * client and a later definition replaces an earlier one.
+ *
+ * The server replies to a flagged frame with an ACK frame holding the
+ * number of points it accepted (u32), and to a malformed frame with a
+ * REJECT frame holding a message, after which the connection is closed.
+ * A client has to keep reading its replies: one that can't be sent in
+ * full closes the connection too, rather than cut a frame short.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "datastore.hpp"
+
+#define BINARY_HEADER_SIZE	8
+#define BINARY_FLAG_ACK		0x01
+
+enum class BinaryFrame : uint8_t
+{
+	SERIES = 1,
+	POINTS = 2,
+	ACK = 3,
+	REJECT = 4
+};
+
+class BinaryDecoder
+{
+private:
+	std::unique_ptr<char[]> m_Buffer;
+	std::size_t m_Capacity;
+	std::size_t m_Start;	// first byte of the next frame
+	std::size_t m_End;		// first free byte
+
+	// by client id, the interned metric and tags a point refers to
+	struct Series
+	{
+		bool defined;
+		bool dropped;	// refused by the series limits
+		uint32_t metric;
+		uint32_t series;
+	};
+	std::vector<Series> m_Series;
+
+public:
+	BinaryDecoder(void);
+	~BinaryDecoder(void);
+
+	// free space to receive into; grows to fit the frame being read
+	char* GetWriteBuffer(std::size_t &space);
+	void Commit(std::size_t length);
+
+	// decodes every complete frame, adding the points to the batch and
+	// any replies to the end of reply; false on a protocol error, with
+	// a REJECT frame added to the reply
+	bool Decode(MetricBatch &batch, std::size_t &points, std::string &reply);
+
+	static void AppendFrame(std::string &out, BinaryFrame type,
+		const char *payload, std::size_t length);
+
+private:
+	bool DecodeSeries(const char *data, std::size_t length, MetricBatch &batch,
+		std::string &error);
+	bool DecodePoints(const char *data, std::size_t length, MetricBatch &batch,
+		std::size_t &points, std::string &error);
+};
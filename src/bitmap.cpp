@@ -0,0 +1,277 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Compressed bitmap
+ *
+ */
+
+#include "bitmap.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#define ARRAY_MAX		4096	// beyond this, a bitset is smaller
+#define BITSET_WORDS	1024
+
+static uint32_t PopCount(uint64_t word)
+{
+	word = word - ((word >> 1) & 0x5555555555555555ULL);
+	word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+	word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (uint32_t)((word * 0x0101010101010101ULL) >> 56);
+}
+
+Bitmap::Bitmap(void)
+{
+}
+
+Bitmap::~Bitmap(void)
+{
+}
+
+void Bitmap::Add(uint32_t value)
+{
+	uint16_t key = (uint16_t)(value >> 16);
+	uint16_t low = (uint16_t)(value & 0xffff);
+
+	std::vector<Container>::iterator container = std::lower_bound(
+		m_Containers.begin(), m_Containers.end(), key,
+		[](const Container &c, uint16_t k) { return c.key < k; });
+	if (container == m_Containers.end() || container->key != key)
+	{
+		Container c;
+		c.key = key;
+		c.cardinality = 0;
+		container = m_Containers.insert(container, c);
+	}
+
+	if (container->IsBitset())
+	{
+		uint64_t mask = 1ULL << (low % 64);
+		if ((container->bits[low / 64] & mask) == 0)
+		{
+			container->bits[low / 64] |= mask;
+			container->cardinality++;
+		}
+	}
+	else
+	{
+		std::vector<uint16_t>::iterator pos = std::lower_bound(
+			container->array.begin(), container->array.end(), low);
+		if (pos == container->array.end() || *pos != low)
+		{
+			container->array.insert(pos, low);
+			container->cardinality++;
+
+			if (container->cardinality > ARRAY_MAX)
+				ToBitset(*container);
+		}
+	}
+}
+
+bool Bitmap::Contains(uint32_t value) const
+{
+	uint16_t key = (uint16_t)(value >> 16);
+	uint16_t low = (uint16_t)(value & 0xffff);
+
+	std::vector<Container>::const_iterator container = std::lower_bound(
+		m_Containers.begin(), m_Containers.end(), key,
+		[](const Container &c, uint16_t k) { return c.key < k; });
+	if (container == m_Containers.end() || container->key != key)
+		return false;
+
+	if (container->IsBitset())
+		return (container->bits[low / 64] & (1ULL << (low % 64))) != 0;
+
+	return std::binary_search(container->array.begin(), container->array.end(), low);
+}
+
+uint64_t Bitmap::Cardinality(void) const
+{
+	uint64_t count = 0;
+	for (std::vector<Container>::const_iterator container = m_Containers.begin();
+		container != m_Containers.end(); ++container)
+		count += container->cardinality;
+
+	return count;
+}
+
+void Bitmap::Or(const Bitmap &other)
+{
+	std::vector<Container> result;
+	result.reserve(m_Containers.size() + other.m_Containers.size());
+
+	std::vector<Container>::iterator a = m_Containers.begin();
+	std::vector<Container>::const_iterator b = other.m_Containers.begin();
+	while (a != m_Containers.end() || b != other.m_Containers.end())
+	{
+		if (b == other.m_Containers.end() ||
+			(a != m_Containers.end() && a->key < b->key))
+			result.push_back(std::move(*a++));
+		else if (a == m_Containers.end() || b->key < a->key)
+			result.push_back(*b++);
+		else
+		{
+			OrContainer(*a, *b++);
+			result.push_back(std::move(*a++));
+		}
+	}
+
+	m_Containers.swap(result);
+}
+
+void Bitmap::And(const Bitmap &other)
+{
+	std::vector<Container> result;
+
+	std::vector<Container>::iterator a = m_Containers.begin();
+	std::vector<Container>::const_iterator b = other.m_Containers.begin();
+	while (a != m_Containers.end() && b != other.m_Containers.end())
+	{
+		if (a->key < b->key)
+			++a;
+		else if (b->key < a->key)
+			++b;
+		else
+		{
+			AndContainer(*a, *b++);
+			if (a->cardinality > 0)
+				result.push_back(std::move(*a));
+			++a;
+		}
+	}
+
+	m_Containers.swap(result);
+}
+
+void Bitmap::ToVector(std::vector<uint32_t> &output) const
+{
+	output.reserve(output.size() + Cardinality());
+
+	for (std::vector<Container>::const_iterator container = m_Containers.begin();
+		container != m_Containers.end(); ++container)
+	{
+		uint32_t high = (uint32_t)container->key << 16;
+		if (container->IsBitset())
+		{
+			for (uint32_t word = 0; word < BITSET_WORDS; word++)
+			{
+				uint64_t bits = container->bits[word];
+				for (uint32_t bit = 0; bits != 0; bit++, bits >>= 1)
+				{
+					if (bits & 1)
+						output.push_back(high | (word * 64 + bit));
+				}
+			}
+		}
+		else
+		{
+			for (std::vector<uint16_t>::const_iterator low = container->array.begin();
+				low != container->array.end(); ++low)
+				output.push_back(high | *low);
+		}
+	}
+}
+
+void Bitmap::ToBitset(Container &container)
+{
+	container.bits.assign(BITSET_WORDS, 0);
+	for (std::vector<uint16_t>::const_iterator low = container.array.begin();
+		low != container.array.end(); ++low)
+		container.bits[*low / 64] |= 1ULL << (*low % 64);
+
+	std::vector<uint16_t>().swap(container.array);
+}
+
+void Bitmap::ToArray(Container &container)
+{
+	container.array.clear();
+	container.array.reserve(container.cardinality);
+	for (uint32_t word = 0; word < BITSET_WORDS; word++)
+	{
+		uint64_t bits = container.bits[word];
+		for (uint32_t bit = 0; bits != 0; bit++, bits >>= 1)
+		{
+			if (bits & 1)
+				container.array.push_back((uint16_t)(word * 64 + bit));
+		}
+	}
+
+	std::vector<uint64_t>().swap(container.bits);
+}
+
+void Bitmap::OrContainer(Container &target, const Container &source)
+{
+	if (!target.IsBitset() && !source.IsBitset())
+	{
+		std::vector<uint16_t> merged;
+		merged.reserve(target.array.size() + source.array.size());
+		std::set_union(target.array.begin(), target.array.end(),
+			source.array.begin(), source.array.end(), std::back_inserter(merged));
+
+		target.array.swap(merged);
+		target.cardinality = (uint32_t)target.array.size();
+		if (target.cardinality > ARRAY_MAX)
+			ToBitset(target);
+		return;
+	}
+
+	if (!target.IsBitset())
+		ToBitset(target);
+
+	if (source.IsBitset())
+	{
+		for (uint32_t word = 0; word < BITSET_WORDS; word++)
+			target.bits[word] |= source.bits[word];
+	}
+	else
+	{
+		for (std::vector<uint16_t>::const_iterator low = source.array.begin();
+			low != source.array.end(); ++low)
+			target.bits[*low / 64] |= 1ULL << (*low % 64);
+	}
+
+	target.cardinality = 0;
+	for (uint32_t word = 0; word < BITSET_WORDS; word++)
+		target.cardinality += PopCount(target.bits[word]);
+}
+
+void Bitmap::AndContainer(Container &target, const Container &source)
+{
+	if (target.IsBitset() && source.IsBitset())
+	{
+		target.cardinality = 0;
+		for (uint32_t word = 0; word < BITSET_WORDS; word++)
+		{
+			target.bits[word] &= source.bits[word];
+			target.cardinality += PopCount(target.bits[word]);
+		}
+
+		if (target.cardinality <= ARRAY_MAX)
+			ToArray(target);
+		return;
+	}
+
+	const Container &bitset = target.IsBitset() ? target : source;
+	const Container &array = target.IsBitset() ? source : target;
+
+	std::vector<uint16_t> result;
+	if (bitset.IsBitset())
+	{
+		for (std::vector<uint16_t>::const_iterator low = array.array.begin();
+			low != array.array.end(); ++low)
+		{
+			if (bitset.bits[*low / 64] & (1ULL << (*low % 64)))
+				result.push_back(*low);
+		}
+	}
+	else
+	{
+		std::set_intersection(target.array.begin(), target.array.end(),
+			source.array.begin(), source.array.end(), std::back_inserter(result));
+	}
+
+	target.array.swap(result);
+	std::vector<uint64_t>().swap(target.bits);
+	target.cardinality = (uint32_t)target.array.size();
+}
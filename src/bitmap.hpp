@@ -0,0 +1,54 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Compressed bitmap
+ *
+ * A Roaring style bitmap of 32 bit values. Values are split into 64K
+ * chunks by their high 16 bits; sparse chunks hold a sorted array of the
+ * low 16 bits, dense chunks hold a plain 8KB bitset.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class Bitmap
+{
+private:
+	struct Container
+	{
+		uint16_t key;
+		uint32_t cardinality;
+		std::vector<uint16_t> array;	// used while sparse
+		std::vector<uint64_t> bits;		// used once dense
+
+		bool IsBitset(void) const { return !bits.empty(); }
+	};
+
+	std::vector<Container> m_Containers;	// sorted by key
+
+public:
+	Bitmap(void);
+	~Bitmap(void);
+
+	void Add(uint32_t value);
+	bool Contains(uint32_t value) const;
+
+	bool IsEmpty(void) const { return m_Containers.empty(); }
+	uint64_t Cardinality(void) const;
+
+	// in place union and intersection
+	void Or(const Bitmap &other);
+	void And(const Bitmap &other);
+
+	// appends the values in ascending order
+	void ToVector(std::vector<uint32_t> &output) const;
+
+private:
+	static void ToBitset(Container &container);
+	static void ToArray(Container &container);
+	static void OrContainer(Container &target, const Container &source);
+	static void AndContainer(Container &target, const Container &source);
+};
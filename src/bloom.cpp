@@ -0,0 +1,137 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Bloom filter
+ *
+ */
+
+#include "bloom.hpp"
+
+#include <cctype>
+#include <cstring>
+
+// tag matching is case insensitive, so the hash is too
+static uint64_t HashItem(const char *item, std::size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;	// FNV-1a
+	for (std::size_t i = 0; i < length; i++)
+	{
+		hash ^= (uint64_t)tolower((unsigned char)item[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	// finalize, so both halves are well mixed for double hashing
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+BloomFilter::BloomFilter(std::size_t bits)
+{
+	m_Words = (bits + 63) / 64;
+	if (m_Words == 0)
+		m_Words = 1;
+
+	m_Bits.reset(new std::atomic<uint64_t>[m_Words]);
+	Clear();
+}
+
+BloomFilter::~BloomFilter(void)
+{
+}
+
+void BloomFilter::Clear(void)
+{
+	for (std::size_t i = 0; i < m_Words; i++)
+		m_Bits[i].store(0, std::memory_order_relaxed);
+}
+
+void BloomFilter::Add(const char *item, std::size_t length)
+{
+	uint64_t hash = HashItem(item, length);
+	uint64_t h1 = hash & 0xffffffff;
+	uint64_t h2 = (hash >> 32) | 1;
+	uint64_t bits = m_Words * 64;
+
+	for (uint32_t i = 0; i < BLOOM_HASHES; i++)
+	{
+		uint64_t bit = (h1 + i * h2) % bits;
+		uint64_t mask = 1ULL << (bit % 64);
+
+		// skip the read-modify-write when the bit is already set
+		if ((m_Bits[bit / 64].load(std::memory_order_relaxed) & mask) == 0)
+			m_Bits[bit / 64].fetch_or(mask, std::memory_order_relaxed);
+	}
+}
+
+bool BloomFilter::MayContain(const char *item, std::size_t length) const
+{
+	uint64_t hash = HashItem(item, length);
+	uint64_t h1 = hash & 0xffffffff;
+	uint64_t h2 = (hash >> 32) | 1;
+	uint64_t bits = m_Words * 64;
+
+	for (uint32_t i = 0; i < BLOOM_HASHES; i++)
+	{
+		uint64_t bit = (h1 + i * h2) % bits;
+		if ((m_Bits[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64))) == 0)
+			return false;
+	}
+
+	return true;
+}
+
+void BloomFilter::AddTags(const char *tags, std::size_t length)
+{
+	std::size_t pos = 0;
+	while (pos < length)
+	{
+		while (pos < length && tags[pos] == ' ')
+			++pos;
+
+		std::size_t end = pos;
+		while (end < length && tags[end] != ' ')
+			++end;
+
+		const char *eq = static_cast<const char*>(memchr(tags + pos, '=', end - pos));
+		if (eq)
+		{
+			Add(tags + pos, eq - (tags + pos));	// the key
+			Add(tags + pos, end - pos);			// the key=value pair
+		}
+
+		pos = end;
+	}
+}
+
+void BloomFilter::Save(void *output) const
+{
+	uint64_t *words = static_cast<uint64_t*>(output);
+	for (std::size_t i = 0; i < m_Words; i++)
+		words[i] = m_Bits[i].load(std::memory_order_relaxed);
+}
+
+bool BloomFilter::Load(const void *input, std::size_t length)
+{
+	if (length == 0 || length % sizeof(uint64_t) != 0)
+		return false;
+
+	if (length / sizeof(uint64_t) != m_Words)
+	{
+		m_Words = length / sizeof(uint64_t);
+		m_Bits.reset(new std::atomic<uint64_t>[m_Words]);
+	}
+
+	// the input may not be aligned (e.g. a database blob)
+	for (std::size_t i = 0; i < m_Words; i++)
+	{
+		uint64_t word;
+		memcpy(&word, static_cast<const uint8_t*>(input) + i * sizeof(uint64_t),
+			sizeof(word));
+		m_Bits[i].store(word, std::memory_order_relaxed);
+	}
+
+	return true;
+}
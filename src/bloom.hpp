@@ -0,0 +1,48 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Bloom filter
+ *
+ * Records the tag keys and key=value pairs present in a shard, so that
+ * queries can skip shards that cannot contain a matching series. Bits are
+ * atomic, so the writer can add to a filter while queries test it.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define BLOOM_DEFAULT_BITS	65536
+#define BLOOM_HASHES		5
+
+class BloomFilter
+{
+private:
+	std::size_t m_Words;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_Bits;
+
+public:
+	BloomFilter(std::size_t bits = BLOOM_DEFAULT_BITS);
+	~BloomFilter(void);
+
+	void Clear(void);
+
+	void Add(const char *item, std::size_t length);
+	bool MayContain(const char *item, std::size_t length) const;
+
+	// adds each key, and each key=value pair, of a space separated tag string
+	void AddTags(const char *tags, std::size_t length);
+
+	// serialized form, for storing next to the data
+	std::size_t GetSize(void) const { return m_Words * sizeof(uint64_t); }
+	void Save(void *output) const;
+	bool Load(const void *input, std::size_t length);
+
+private:
+	BloomFilter(const BloomFilter&);
+	void operator = (const BloomFilter&);
+};
@@ -0,0 +1,198 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Compression codecs
+ *
+ */
+
+#include "codec.hpp"
+
+#include <cstring>
+#include <vector>
+
+#define LZ_MIN_MATCH		4
+#define LZ_LAST_LITERALS	5	// the block always ends in literals
+#define LZ_MATCH_LIMIT		12	// no match may start this close to the end
+#define LZ_MAX_OFFSET		65535
+#define LZ_HASH_BITS		12
+
+static uint32_t Read32(const uint8_t *ptr)
+{
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+static bool WriteLength(uint8_t *&op, uint8_t *end, std::size_t length)
+{
+	while (length >= 255)
+	{
+		if (op >= end)
+			return false;
+		*op++ = 255;
+		length -= 255;
+	}
+
+	if (op >= end)
+		return false;
+	*op++ = (uint8_t)length;
+	return true;
+}
+
+static bool WriteSequence(uint8_t *&op, uint8_t *end, const uint8_t *literals,
+	std::size_t literalLength, std::size_t offset, std::size_t matchLength)
+{
+	if (op >= end)
+		return false;
+
+	uint8_t *token = op++;
+	*token = (uint8_t)((literalLength >= 15 ? 15 : literalLength) << 4);
+	if (literalLength >= 15 && !WriteLength(op, end, literalLength - 15))
+		return false;
+
+	if ((std::size_t)(end - op) < literalLength)
+		return false;
+	memcpy(op, literals, literalLength);
+	op += literalLength;
+
+	if (matchLength == 0)
+		return true;	// the final literals have no match
+
+	if (end - op < 2)
+		return false;
+	*op++ = (uint8_t)(offset & 0xff);
+	*op++ = (uint8_t)(offset >> 8);
+
+	matchLength -= LZ_MIN_MATCH;
+	*token |= (uint8_t)(matchLength >= 15 ? 15 : matchLength);
+	if (matchLength >= 15 && !WriteLength(op, end, matchLength - 15))
+		return false;
+
+	return true;
+}
+
+std::size_t LzCompress(const uint8_t *input, std::size_t length,
+	uint8_t *output, std::size_t capacity)
+{
+	uint8_t *op = output;
+	uint8_t *end = output + capacity;
+
+	std::size_t anchor = 0;
+	if (length > LZ_MATCH_LIMIT)
+	{
+		// positions are stored plus one, so zero means empty
+		std::vector<uint32_t> table(1 << LZ_HASH_BITS, 0);
+
+		std::size_t ip = 0;
+		std::size_t limit = length - LZ_MATCH_LIMIT;
+		std::size_t matchEnd = length - LZ_LAST_LITERALS;
+		while (ip < limit)
+		{
+			uint32_t sequence = Read32(input + ip);
+			uint32_t hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+			std::size_t ref = table[hash];
+			table[hash] = (uint32_t)(ip + 1);
+
+			if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET ||
+				Read32(input + ref - 1) != sequence)
+			{
+				++ip;
+				continue;
+			}
+
+			--ref;
+
+			// extend the match backwards into the pending literals
+			while (ip > anchor && ref > 0 && input[ip - 1] == input[ref - 1])
+			{
+				--ip;
+				--ref;
+			}
+
+			std::size_t matchLength = LZ_MIN_MATCH;
+			while (ip + matchLength < matchEnd &&
+				input[ip + matchLength] == input[ref + matchLength])
+				++matchLength;
+
+			if (!WriteSequence(op, end, input + anchor, ip - anchor,
+				ip - ref, matchLength))
+				return 0;
+
+			ip += matchLength;
+			anchor = ip;
+		}
+	}
+
+	if (!WriteSequence(op, end, input + anchor, length - anchor, 0, 0))
+		return 0;
+
+	return op - output;
+}
+
+bool LzDecompress(const uint8_t *input, std::size_t length,
+	uint8_t *output, std::size_t outputLength)
+{
+	const uint8_t *ip = input;
+	const uint8_t *iend = input + length;
+	uint8_t *op = output;
+	uint8_t *oend = output + outputLength;
+
+	while (ip < iend)
+	{
+		uint8_t token = *ip++;
+
+		std::size_t literalLength = token >> 4;
+		if (literalLength == 15)
+		{
+			uint8_t byte = 255;
+			while (byte == 255)
+			{
+				if (ip >= iend)
+					return false;
+				byte = *ip++;
+				literalLength += byte;
+			}
+		}
+
+		if ((std::size_t)(iend - ip) < literalLength ||
+			(std::size_t)(oend - op) < literalLength)
+			return false;
+		memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		if (ip == iend)
+			break;	// the final literals
+
+		if (iend - ip < 2)
+			return false;
+		std::size_t offset = ip[0] | ((std::size_t)ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (std::size_t)(op - output))
+			return false;
+
+		std::size_t matchLength = token & 0x0f;
+		if (matchLength == 15)
+		{
+			uint8_t byte = 255;
+			while (byte == 255)
+			{
+				if (ip >= iend)
+					return false;
+				byte = *ip++;
+				matchLength += byte;
+			}
+		}
+		matchLength += LZ_MIN_MATCH;
+
+		if ((std::size_t)(oend - op) < matchLength)
+			return false;
+
+		// matches may overlap their own output, so copy forwards
+		const uint8_t *match = op - offset;
+		for (std::size_t i = 0; i < matchLength; i++)
+			*op++ = match[i];
+	}
+
+	return op == oend;
+}
@@ -0,0 +1,20 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Compression codecs
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// LZ4 block format compressor; returns the compressed length, or 0 when
+// the output doesn't fit in capacity bytes
+std::size_t LzCompress(const uint8_t *input, std::size_t length,
+	uint8_t *output, std::size_t capacity);
+
+// decompresses exactly outputLength bytes, false on malformed input
+bool LzDecompress(const uint8_t *input, std::size_t length,
+	uint8_t *output, std::size_t outputLength);
@@ -0,0 +1,273 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Datagram listener
+ *
+ */
+
+#include "datagram.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+
+#if defined(_WIN32) || defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <ws2tcpip.h>
+
+#define CLOSE_SOCKET	closesocket
+#define SOCKET_ERROR_CODE	WSAGetLastError()
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#if defined(__linux__)
+#define USE_RECVMMSG
+#endif
+
+#define CLOSE_SOCKET	close
+#define SOCKET_ERROR_CODE	errno
+#define INVALID_SOCKET	-1
+#endif
+
+#define DATAGRAM_SIZE		65536	// the largest a UDP payload can be
+#define DATAGRAM_BATCH		64		// read with one call
+#define DATAGRAM_ROUNDS		16		// batches read before each flush
+#define POLL_TIMEOUT_MS		50		// how quickly a stopping thread notices
+
+#if defined(USE_RECVMMSG)
+// the headers for one batch, each with room for the drop counter
+struct DatagramBatch
+{
+	struct mmsghdr headers[DATAGRAM_BATCH];
+	struct iovec vectors[DATAGRAM_BATCH];
+	char control[DATAGRAM_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+};
+#endif
+
+DatagramListener::DatagramListener(const std::string &bindAddr,
+	const std::string &port, int32_t bufferSize, DatagramHandler *handler)
+	: m_BindAddr(bindAddr), m_BindPort(port), m_BufferSize(bufferSize),
+	  m_Handler(handler), m_Socket(INVALID_SOCKET), m_Overflows(0)
+{
+	m_Thread = new Thread(this);
+	if (m_Thread == nullptr)
+		throw std::runtime_error("Failed to create datagram thread");
+}
+
+DatagramListener::~DatagramListener(void)
+{
+	delete m_Thread;
+	Close();	// in case the thread never ran
+}
+
+bool DatagramListener::StartThread(void)
+{
+#if defined(_WIN32) || defined(WIN32)
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(2, 0), &wsa) != 0)
+	{
+		spdlog::error("Failed to initialize socket library: {0}", WSAGetLastError());
+		return false;
+	}
+#endif
+
+	if (!Open())
+		return false;
+
+	return m_Thread->Start();
+}
+
+void DatagramListener::StopThread(void)
+{
+	m_Thread->Stop();
+}
+
+void DatagramListener::Start(void)
+{
+	// nothing to do
+}
+
+void DatagramListener::Process(void)
+{
+#if defined(_WIN32) || defined(WIN32)
+	fd_set readfds;
+	FD_ZERO(&readfds);
+	FD_SET(m_Socket, &readfds);
+	struct timeval timeout = { 0, POLL_TIMEOUT_MS * 1000 };
+	int32_t ready = select((int)m_Socket + 1, &readfds, nullptr, nullptr, &timeout);
+#else
+	struct pollfd pfd;
+	pfd.fd = m_Socket;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int32_t ready = poll(&pfd, 1, POLL_TIMEOUT_MS);
+#endif
+	if (ready <= 0)
+		return;
+
+	std::size_t dropped = 0;
+
+#if defined(USE_RECVMMSG)
+	DatagramBatch *batch = reinterpret_cast<DatagramBatch*>(m_Batch.get());
+	for (int32_t round = 0; round < DATAGRAM_ROUNDS; round++)
+	{
+		// the headers are reset every call, the kernel writes to them
+		for (int32_t d = 0; d < DATAGRAM_BATCH; d++)
+		{
+			batch->vectors[d].iov_base = m_Buffer.get() + d * DATAGRAM_SIZE;
+			batch->vectors[d].iov_len = DATAGRAM_SIZE;
+
+			struct msghdr &msg = batch->headers[d].msg_hdr;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &batch->vectors[d];
+			msg.msg_iovlen = 1;
+			msg.msg_control = batch->control[d];
+			msg.msg_controllen = sizeof(batch->control[d]);
+		}
+
+		int32_t count = recvmmsg(m_Socket, batch->headers, DATAGRAM_BATCH,
+			MSG_DONTWAIT, nullptr);
+		if (count <= 0)
+		{
+			if (count == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)
+				spdlog::warn("recvmmsg() failed: {0}", errno);
+			break;
+		}
+
+		for (int32_t d = 0; d < count; d++)
+		{
+			struct msghdr &msg = batch->headers[d].msg_hdr;
+			for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+				cmsg = CMSG_NXTHDR(&msg, cmsg))
+			{
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+				{
+					uint32_t overflows;
+					memcpy(&overflows, CMSG_DATA(cmsg), sizeof(overflows));
+					dropped += overflows - m_Overflows;
+					m_Overflows = overflows;
+				}
+			}
+
+			if (msg.msg_flags & MSG_TRUNC)
+				++dropped;
+			else
+				m_Handler->OnDatagram(static_cast<char*>(batch->vectors[d].iov_base),
+					batch->headers[d].msg_len);
+		}
+
+		if (count < DATAGRAM_BATCH)
+			break;	// drained
+	}
+#else
+	for (int32_t d = 0; d < DATAGRAM_BATCH * DATAGRAM_ROUNDS; d++)
+	{
+		int32_t length = recv(m_Socket, m_Buffer.get(), DATAGRAM_SIZE, 0);
+		if (length < 0)
+		{
+#if defined(_WIN32) || defined(WIN32)
+			if (WSAGetLastError() == WSAEMSGSIZE)
+			{
+				++dropped;
+				continue;
+			}
+#endif
+			break;	// drained
+		}
+
+		m_Handler->OnDatagram(m_Buffer.get(), length);
+	}
+#endif
+
+	m_Handler->OnFlush(dropped);
+}
+
+void DatagramListener::Stop(void)
+{
+	Close();
+}
+
+bool DatagramListener::Open(void)
+{
+	struct addrinfo hints, *ai, *p;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (getaddrinfo(m_BindAddr.c_str(), m_BindPort.c_str(), &hints, &ai) != 0)
+	{
+		spdlog::error("Failed to getaddrinfo: {0}", SOCKET_ERROR_CODE);
+		return false;
+	}
+
+	for (p = ai; p != nullptr; p = p->ai_next)
+	{
+		m_Socket = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (m_Socket == INVALID_SOCKET)
+			continue;
+
+		if (bind(m_Socket, p->ai_addr, (int)p->ai_addrlen) < 0)
+		{
+			CLOSE_SOCKET(m_Socket);
+			m_Socket = INVALID_SOCKET;
+			continue;
+		}
+
+		break;
+	}
+
+	freeaddrinfo(ai);
+
+	if (m_Socket == INVALID_SOCKET)
+	{
+		spdlog::error("Failed to bind datagram socket: {0}", SOCKET_ERROR_CODE);
+		return false;
+	}
+
+	// bursts queue up in the kernel while a batch is being parsed
+	if (m_BufferSize > 0 && setsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF,
+		(const char*)&m_BufferSize, sizeof(m_BufferSize)) != 0)
+		spdlog::warn("Failed to set the datagram receive buffer size: {0}",
+			SOCKET_ERROR_CODE);
+
+#if defined(USE_RECVMMSG)
+	// every datagram carries the kernel's count of dropped datagrams
+	int32_t yes = 1;
+	setsockopt(m_Socket, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes));
+
+	m_Buffer.reset(new char[DATAGRAM_SIZE * DATAGRAM_BATCH]);
+	m_Batch.reset(new uint8_t[sizeof(DatagramBatch)]);
+#else
+	// read until it would block
+#if defined(_WIN32) || defined(WIN32)
+	u_long nonBlocking = 1;
+	ioctlsocket(m_Socket, FIONBIO, &nonBlocking);
+#else
+	fcntl(m_Socket, F_SETFL, fcntl(m_Socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	m_Buffer.reset(new char[DATAGRAM_SIZE]);
+#endif
+
+	return true;
+}
+
+void DatagramListener::Close(void)
+{
+	if (m_Socket != INVALID_SOCKET)
+	{
+		CLOSE_SOCKET(m_Socket);
+		m_Socket = INVALID_SOCKET;
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Datagram listener
+ *
+ * Receives UDP datagrams on a port and hands each one to a handler, on
+ * a thread of its own. On Linux the datagrams are read in batches with
+ * recvmmsg(), and the kernel reports how many it dropped because the
+ * receive buffer was full; other platforms read one at a time.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "reactor.hpp"
+#include "thread.hpp"
+
+class DatagramHandler
+{
+public:
+	virtual ~DatagramHandler(void) {}
+
+	// the datagram may be modified in place
+	virtual void OnDatagram(char *data, std::size_t length) = 0;
+
+	// called after each batch, with the number of datagrams dropped since
+	// the last call because they didn't fit the buffers
+	virtual void OnFlush(std::size_t dropped) = 0;
+};
+
+class DatagramListener : public ThreadProc
+{
+private:
+	std::string m_BindAddr;
+	std::string m_BindPort;
+	int32_t m_BufferSize;
+
+	DatagramHandler *m_Handler;
+
+	socket_t m_Socket;
+	uint32_t m_Overflows;	// the kernel's running count of drops
+
+	std::unique_ptr<char[]> m_Buffer;
+	std::unique_ptr<uint8_t[]> m_Batch;	// the recvmmsg headers
+
+	Thread *m_Thread;
+
+public:
+	// a bufferSize of 0 keeps the system's receive buffer size
+	DatagramListener(const std::string &bindAddr, const std::string &port,
+		int32_t bufferSize, DatagramHandler *handler);
+	~DatagramListener(void);
+
+	bool StartThread(void);
+	void StopThread(void);
+
+protected:
+	void Start(void);
+	void Process(void);
+	void Stop(void);
+
+private:
+	bool Open(void);
+	void Close(void);
+};
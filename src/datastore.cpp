@@ -6,12 +6,23 @@
  */
 
 #include "datastore.hpp"
+#include "tags.hpp"
+#include "utility.hpp"
 
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
+#include <ctime>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <utility>
+
 #if defined(_WIN32) || defined(WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <dirent.h>
 #endif
 
 #if defined(_WIN32) || defined(WIN32)
@@ -20,28 +31,99 @@
 #define PATH_SEP	"/"
 #endif
 
-#define BULK_COUNT	10
+#define BULK_COUNT	256	// points are small, dequeue many at once
+#define METRIC_BATCH_SIZE	256	// producers queue at most this many at once
+
+// series bound to one query, beyond this many the query runs in chunks
+#define MAX_SERIES_BIND	500
+
+#define SEGMENT_EXT		"seg"
+#define SEAL_INTERVAL	60.0f	// seconds between checks for data to seal
+#define SEAL_BATCH		4		// spans sealed per pass, between writes
+#define SEAL_BACKLOG_INTERVAL	1.0f	// seconds between passes while behind
 
 #define SQL_CREATE_TABLE_METRIC	\
 	"CREATE TABLE METRIC (TIMESTAMP INTEGER NOT NULL, " \
 	"VALUE NUMBER NOT NULL, TAGS TEXT NOT NULL);"
 #define SQL_CREATE_INDEX_METRIC_TAGS	\
 	"CREATE INDEX IDX_METRIC_TAGS ON METRIC(TAGS);"
+#define SQL_CREATE_INDEX_METRIC_TIMESTAMP	\
+	"CREATE INDEX IF NOT EXISTS IDX_METRIC_TIMESTAMP ON METRIC(TIMESTAMP);"
 #define SQL_VERIFY_TABLE \
 	"SELECT COUNT(name) FROM sqlite_master WHERE TYPE='table' AND NAME=?001;"
 #define SQL_ENABLE_WAL \
 	"PRAGMA journal_mode=WAL;"
+#define SQL_PAGE_SIZE \
+	"PRAGMA page_size="
 
 #define SQL_INSERT_METRIC \
 	"INSERT INTO METRIC (TIMESTAMP, VALUE, TAGS) VALUES (?001, ?002, ?003);"
 
+#define SQL_CREATE_TABLE_SHARD \
+	"CREATE TABLE IF NOT EXISTS SHARD (ID INTEGER PRIMARY KEY, " \
+	"CLEAN INTEGER NOT NULL, MIN_TIMESTAMP INTEGER NOT NULL, " \
+	"MAX_TIMESTAMP INTEGER NOT NULL, BLOOM BLOB NOT NULL);"
+#define SQL_SELECT_SHARD \
+	"SELECT CLEAN, MIN_TIMESTAMP, MAX_TIMESTAMP, BLOOM FROM SHARD WHERE ID = 1;"
+#define SQL_UPDATE_SHARD \
+	"INSERT OR REPLACE INTO SHARD (ID, CLEAN, MIN_TIMESTAMP, MAX_TIMESTAMP, BLOOM) " \
+	"VALUES (1, ?001, ?002, ?003, ?004);"
+#define SQL_SELECT_BOUNDS \
+	"SELECT (SELECT MIN(TIMESTAMP) FROM METRIC), (SELECT MAX(TIMESTAMP) FROM METRIC);"
+#define SQL_SELECT_SERIES \
+	"SELECT DISTINCT TAGS FROM METRIC;"
+#define SQL_SELECT_SEAL \
+	"SELECT TAGS, TIMESTAMP, VALUE FROM METRIC " \
+	"WHERE TIMESTAMP >= ?001 AND TIMESTAMP < ?002 ORDER BY TAGS, TIMESTAMP;"
+#define SQL_DELETE_SEAL \
+	"DELETE FROM METRIC WHERE TIMESTAMP >= ?001 AND TIMESTAMP < ?002;"
+
+#define SQL_CREATE_TABLE_SEALED \
+	"CREATE TABLE IF NOT EXISTS SEALED (NAME TEXT PRIMARY KEY);"
+#define SQL_INSERT_SEALED \
+	"INSERT OR REPLACE INTO SEALED (NAME) VALUES (?001);"
+#define SQL_SELECT_SEALED \
+	"SELECT COUNT(NAME) FROM SEALED WHERE NAME = ?001;"
+#define SQL_DELETE_SEALED \
+	"DELETE FROM SEALED WHERE NAME = ?001;"
+
+// the metric name of a <metric>.<start time>.<sequence>.seg file
+static bool ParseSegmentName(const std::string &filename, std::string &name)
+{
+	std::string::size_type dot = filename.rfind('.');
+	std::string::size_type seq = (dot == std::string::npos || dot == 0) ?
+		std::string::npos : filename.rfind('.', dot - 1);
+	std::string::size_type start = (seq == std::string::npos || seq == 0) ?
+		std::string::npos : filename.rfind('.', seq - 1);
+	if (start == std::string::npos)
+		return false;
+
+	name = filename.substr(0, start);
+	return true;
+}
+
 Datastore::Datastore(const std::string &dataDir,
-	const std::string &dbExt, const std::string &hostname, Statistics *stats)
-	: m_DataDir(dataDir), m_DbExt(dbExt), m_Hostname(hostname), m_Stats(stats)
+	const std::string &dbExt, Statistics *stats)
+	: m_DataDir(dataDir), m_DbExt(dbExt), m_Stats(stats)
 {
 	m_QueueSize = 0;
 	m_Running = false;
 
+	m_PageSize = 0;
+
+	m_SealAfter = 0;
+	m_SegmentSpan = 0;
+	m_LastSeal = m_SealTimer.Elapsed();
+	m_SealBacklog = false;
+
+	m_PersistInterval = 0;
+	m_LastPersist = m_PersistTimer.Elapsed();
+
+	m_MetricSeriesLimit = 0;
+	m_SeriesLimit = 0;
+	m_RejectSeries = true;
+	m_SeriesCount = 0;
+
 	m_Thread = new Thread(this);
 	if (m_Thread == nullptr)
 		throw std::runtime_error("Failed to create datastore thread");
@@ -62,18 +144,220 @@ void Datastore::StopThread(void)
 	m_Thread->Stop();
 }
 
+void Datastore::ConfigureSegments(uint64_t sealAfter, uint64_t span)
+{
+	m_SealAfter = sealAfter;
+	m_SegmentSpan = span;
+}
+
+void Datastore::ConfigureSelfMetrics(uint32_t persistInterval)
+{
+	m_PersistInterval = persistInterval;
+}
+
+void Datastore::ConfigureSeriesLimits(std::size_t perMetric,
+	std::size_t total, bool reject)
+{
+	m_MetricSeriesLimit = perMetric;
+	m_SeriesLimit = total;
+	m_RejectSeries = reject;
+}
+
+void Datastore::GetSeriesStats(std::vector<SeriesStats> &metrics)
+{
+	std::lock_guard<std::mutex> lock(m_StoreLock);
+	for (datastore_t::iterator store = m_Store.begin(); store != m_Store.end(); ++store)
+	{
+		uint64_t overLimit = store->second->overLimit;
+		if (overLimit == 0)
+			continue;
+
+		SeriesStats stats;
+		stats.metric = store->first;
+		stats.series = store->second->index->GetSeriesCount();
+		stats.overLimit = overLimit;
+		metrics.push_back(stats);
+	}
+}
+
+void Datastore::ConfigureVfs(const std::string &vfs, int pageSize)
+{
+	m_Vfs = vfs;
+	m_PageSize = pageSize;
+}
+
+void Datastore::ConfigureColdStorage(const std::string &coldDir)
+{
+	m_ColdDir = coldDir;
+}
+
+void Datastore::GetHotSegments(uint64_t before,
+	std::vector<std::pair<std::string, segment_ptr> > &segments)
+{
+	std::lock_guard<std::mutex> lock(m_StoreLock);
+	for (datastore_t::const_iterator ds = m_Store.begin(); ds != m_Store.end(); ++ds)
+	{
+		for (std::vector<segment_ptr>::const_iterator segment = ds->second->segments.begin();
+			segment != ds->second->segments.end(); ++segment)
+		{
+			// loaded from or sealed into the data directory itself
+			const std::string &path = (*segment)->GetPath();
+			if ((*segment)->GetEndTime() <= before &&
+				path.compare(0, path.rfind(PATH_SEP), m_DataDir) == 0)
+				segments.push_back(std::make_pair(ds->first, *segment));
+		}
+	}
+}
+
+bool Datastore::ReplaceSegment(const std::string &name, const segment_ptr &segment,
+	const segment_ptr &replacement)
+{
+	std::lock_guard<std::mutex> lock(m_StoreLock);
+
+	datastore_t::iterator store = m_Store.find(name);
+	if (store == m_Store.end())
+		return false;
+
+	std::vector<segment_ptr>::iterator existing = std::find(
+		store->second->segments.begin(), store->second->segments.end(), segment);
+	if (existing == store->second->segments.end())
+		return false;
+
+	// running queries keep the old mapping until they finish
+	*existing = replacement;
+	return true;
+}
+
 void Datastore::QueueMetric(const Metric &m)
 {
-	if (m_MetricQueue.enqueue(m))
+	Point point;
+	if (!MakePoint(m, point))
+	{
+		spdlog::warn("Dropped {0}: the name or series tables are full",
+			m.Name().c_str());
+		return;
+	}
+
+	if (m_MetricQueue.enqueue(point))
 		m_QueueSize.fetch_add(1, std::memory_order_release);
 }
 
-bool Datastore::CacheDatabase(const std::string &name, const std::string &path)
+void Datastore::QueuePoints(moodycamel::ProducerToken &token,
+	std::vector<Point> &points)
 {
-	dbconn *conn = new dbconn;
-	conn->db = nullptr;
-	conn->insert = nullptr;
+	if (points.empty())
+		return;
+
+	if (m_MetricQueue.enqueue_bulk(token, points.data(), points.size()))
+		m_QueueSize.fetch_add(points.size(), std::memory_order_release);
+
+	points.clear();
+}
+
+bool Datastore::MakePoint(const Metric &metric, Point &point)
+{
+	point.timestamp = metric.Timestamp();
+	point.value = metric.Value();
+	return m_Names.Intern(metric.Name(), point.metric) &&
+		m_Series.Intern(metric.Tags(), point.series);
+}
+
+bool Datastore::ResolveMetric(std::string_view name, uint32_t &metric,
+	std::string &error, bool *overLimit)
+{
+	if (m_Names.Find(name, metric))
+		return true;
+
+	// the name becomes a file name, so it is only checked when new
+	if (!Metric::IsValidName(name, error))
+		return false;
+
+	// every stored metric is known from the start, so this one would be
+	// a new series too
+	if (m_RejectSeries && m_SeriesLimit > 0 && m_SeriesCount >= m_SeriesLimit)
+	{
+		if (overLimit)
+			*overLimit = true;
+		m_Stats->AddSeriesOverLimitCount(1);
+		error = "Series limit reached";
+		return false;
+	}
+
+	if (!m_Names.Intern(name, metric))
+	{
+		error = "Too many metric names";
+		return false;
+	}
+
+	return true;
+}
+
+bool Datastore::ResolveSeries(uint32_t metric, std::string_view tags,
+	uint32_t &series, std::string &error, bool *overLimit)
+{
+	// tag sets are shared by all metrics, so a known one may still be a
+	// new series of this metric, and is checked against the limits too;
+	// the writer still checks every series
+	bool exact = m_Series.Find(tags, series);
+	bool known = exact;
+	std::string canonical;
+	if (!exact)
+	{
+		// new, or in a new order: only then is it parsed
+		if (!CanonicalizeTags(tags, canonical, error))
+			return false;
+
+		known = m_Series.Find(canonical, series);
+	}
+
+	if (!AdmitNewSeries(metric, known ? m_Series.Get(series) : canonical, error))
+	{
+		if (overLimit)
+			*overLimit = true;
+		return false;
+	}
+
+	if (exact)
+		return true;
+
+	if (!known && !m_Series.Intern(canonical, series))
+	{
+		error = "Too many series";
+		return false;
+	}
+
+	// past the alias limit the tags are just parsed again next time
+	if (canonical != tags)
+		m_Series.AddAlias(tags, series);
+	return true;
+}
+
+bool Datastore::AdmitNewSeries(uint32_t metric, std::string_view tags,
+	std::string &error)
+{
+	if (!m_RejectSeries || (m_MetricSeriesLimit == 0 && m_SeriesLimit == 0))
+		return true;
+
+	// the counts only grow, so a stale read can only let one more through
+	dbconn *conn = static_cast<dbconn*>(m_Names.GetData(metric));
+	std::size_t count = conn ? conn->index->GetSeriesCount() : 0;
+	if ((m_MetricSeriesLimit == 0 || count < m_MetricSeriesLimit) &&
+		(m_SeriesLimit == 0 || m_SeriesCount < m_SeriesLimit))
+		return true;
+
+	// already a series of this metric, possibly stored before a restart
+	if (conn && conn->index->FindSeries(tags.data(), tags.length()))
+		return true;
+
+	if (conn)
+		++conn->overLimit;
+	m_Stats->AddSeriesOverLimitCount(1);
+	error = "Series limit reached";
+	return false;
+}
 
+bool Datastore::CacheDatabase(const std::string &name, const std::string &path)
+{
 	// check to make sure that this hasn't already been loaded
 	if (m_Store.find(name) != m_Store.end())
 	{
@@ -81,9 +365,19 @@ bool Datastore::CacheDatabase(const std::string &name, const std::string &path)
 		return true;	// okay, I guess
 	}
 
+	dbconn *conn = new dbconn;
+	conn->db = nullptr;
+	conn->insert = nullptr;
+	conn->oldest = std::numeric_limits<uint64_t>::max();
+	conn->newest = 0;
+	conn->bloom = std::make_shared<BloomFilter>();
+	conn->index.reset(new TagIndex());
+	conn->overLimit = 0;
+
 	// try to open the database
 	int result = sqlite3_open_v2(path.c_str(), &conn->db, 
-		SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, nullptr);
+		SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX,
+		m_Vfs.empty() ? nullptr : m_Vfs.c_str());
 	if (result != SQLITE_OK)
 	{
 		spdlog::warn(sqlite3_errstr(result));
@@ -129,6 +423,14 @@ bool Datastore::CacheDatabase(const std::string &name, const std::string &path)
 
 	sqlite3_finalize(stmt);
 
+	// the shard table must exist before statements are prepared
+	if (!LoadShardInfo(conn) || !LoadTagIndex(conn))
+	{
+		sqlite3_close_v2(conn->db);
+		delete conn;
+		return false;
+	}
+
 	// create the prepared statements
 	result = sqlite3_prepare_v2(conn->db, SQL_INSERT_METRIC, -1,
 		&conn->insert, nullptr);
@@ -141,6 +443,7 @@ bool Datastore::CacheDatabase(const std::string &name, const std::string &path)
 	}
 
 	// store the database in the cache
+	std::lock_guard<std::mutex> lock(m_StoreLock);
 	m_Store.insert(std::pair<std::string, dbconn*>(name, conn));
 	return true;
 }
@@ -154,6 +457,11 @@ Datastore::dbconn* Datastore::CreateDatabase(const std::string &name)
 	dbconn *conn = new dbconn;
 	conn->db = nullptr;
 	conn->insert = nullptr;
+	conn->oldest = std::numeric_limits<uint64_t>::max();
+	conn->newest = 0;
+	conn->bloom = std::make_shared<BloomFilter>();
+	conn->index.reset(new TagIndex());
+	conn->overLimit = 0;
 
 	// assemble the path
 	std::string path(m_DataDir);
@@ -163,7 +471,8 @@ Datastore::dbconn* Datastore::CreateDatabase(const std::string &name)
 	path.append(m_DbExt);
 
 	int result = sqlite3_open_v2(path.c_str(), &conn->db,
-		SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_FULLMUTEX, nullptr);
+		SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_FULLMUTEX,
+		m_Vfs.empty() ? nullptr : m_Vfs.c_str());
 	if (result != SQLITE_OK)
 	{
 		spdlog::warn(sqlite3_errstr(result));
@@ -171,8 +480,23 @@ Datastore::dbconn* Datastore::CreateDatabase(const std::string &name)
 		return nullptr;
 	}
 
-	// create the schema
 	char *error = nullptr;
+
+	// the page size can only be set before the first table exists
+	if (m_PageSize > 0)
+	{
+		std::ostringstream pragma;
+		pragma << SQL_PAGE_SIZE << m_PageSize << ";";
+		result = sqlite3_exec(conn->db, pragma.str().c_str(), nullptr,
+			nullptr, &error);
+		if (result != SQLITE_OK)
+		{
+			spdlog::warn(error);
+			sqlite3_free(error);
+		}
+	}
+
+	// create the schema
 	result = sqlite3_exec(conn->db, SQL_CREATE_TABLE_METRIC, nullptr,
 		nullptr, &error);
 	if (result != SQLITE_OK)
@@ -207,6 +531,15 @@ Datastore::dbconn* Datastore::CreateDatabase(const std::string &name)
 		return nullptr;
 	}
 
+	// the shard table must exist before statements are prepared, or
+	// creating it would invalidate them
+	if (!LoadShardInfo(conn))
+	{
+		sqlite3_close_v2(conn->db);
+		delete conn;
+		return nullptr;
+	}
+
 	// create the prepared statements
 	result = sqlite3_prepare_v2(conn->db, SQL_INSERT_METRIC, -1,
 		&conn->insert, nullptr);
@@ -215,214 +548,888 @@ Datastore::dbconn* Datastore::CreateDatabase(const std::string &name)
 		spdlog::warn(sqlite3_errstr(result));
 		sqlite3_close_v2(conn->db);
 		delete conn;
-		return false;
+		return nullptr;
 	}
 
 	return conn;
 }
 
-void Datastore::WriteMetric(dbconn *conn, const Metric &metric)
+bool Datastore::LoadTagIndex(dbconn *conn)
 {
-	sqlite3_bind_int64(conn->insert, 1, metric.Timestamp());
-	sqlite3_bind_double(conn->insert, 2, metric.Value());
-	sqlite3_bind_text(conn->insert, 3, metric.Tags().c_str(), -1, nullptr);
-
-	int result = sqlite3_step(conn->insert);
-	if (result != SQLITE_DONE)
-	{
-		spdlog::warn("Error writing metric {0}: {1}", metric.Name().c_str(),
-			sqlite3_errstr(result));
-	}
-
-	sqlite3_reset(conn->insert);
-}
-
-ResultSet* Datastore::PrepareQuery(const Query &query)
-{
-	// find the metric
-	datastore_t::iterator metric = m_Store.find(query.GetMetric());
-	if (metric == m_Store.end())
-		return nullptr;	// we don't know that metric
-
+	// the distinct tags come straight from IDX_METRIC_TAGS
 	sqlite3_stmt *stmt = nullptr;
-
-	int result = sqlite3_prepare_v2(metric->second->db, 
-		query.GetQuery().c_str(), -1, &stmt, nullptr);
+	int result = sqlite3_prepare_v2(conn->db, SQL_SELECT_SERIES, -1, &stmt, nullptr);
 	if (result != SQLITE_OK)
 	{
 		spdlog::warn(sqlite3_errstr(result));
-		return nullptr;
+		return false;
 	}
 
-	ResultSet *rs = new ResultSet(stmt, query.GetMetric(),
-		query.GetDownsampler());
-	if (rs == nullptr)
-		sqlite3_finalize(stmt);
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		conn->index->AddSeries(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+			sqlite3_column_bytes(stmt, 0));
+	}
 
-	return rs;
+	sqlite3_finalize(stmt);
+	return true;
 }
 
-void Datastore::Start(void)
+bool Datastore::LoadShardInfo(dbconn *conn)
 {
-	spdlog::info("Starting datastore");
-	spdlog::info("Data directory: {0}", m_DataDir.c_str());
+	char *error = nullptr;
+	int result = sqlite3_exec(conn->db, SQL_CREATE_TABLE_SHARD, nullptr,
+		nullptr, &error);
+	if (result == SQLITE_OK)
+	{
+		result = sqlite3_exec(conn->db, SQL_CREATE_TABLE_SEALED, nullptr,
+			nullptr, &error);
+	}
 
-	// scan the data directory for databases to cache
-#if defined(_WIN32) || defined(WIN32)
-	WIN32_FIND_DATAA wfd;
-	HANDLE hfind = INVALID_HANDLE_VALUE;
+	// sealing selects and deletes by time, and the bounds come from the
+	// ends of this index; databases from before it get it here, once
+	if (result == SQLITE_OK)
+	{
+		result = sqlite3_exec(conn->db, SQL_CREATE_INDEX_METRIC_TIMESTAMP,
+			nullptr, nullptr, &error);
+	}
 
-	std::string searchpath(m_DataDir);
-	searchpath.append(PATH_SEP);
-	searchpath.append("*");
+	if (result != SQLITE_OK)
+	{
+		spdlog::warn(error);
+		sqlite3_free(error);
+		return false;
+	}
 
-	hfind = FindFirstFileA(searchpath.c_str(), &wfd);
-	if (hfind == INVALID_HANDLE_VALUE)
+	sqlite3_stmt *stmt = nullptr;
+	result = sqlite3_prepare_v2(conn->db, SQL_SELECT_SHARD, -1, &stmt, nullptr);
+	if (result != SQLITE_OK)
 	{
-		spdlog::error("Failed to search path: {0}", searchpath.c_str());
-		return;
+		spdlog::warn(sqlite3_errstr(result));
+		return false;
 	}
 
-	do
+	// the stored values can only be trusted after a clean shutdown
+	bool loaded = false;
+	if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) != 0)
 	{
-		if (wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		std::shared_ptr<BloomFilter> bloom = std::make_shared<BloomFilter>();
+		if (bloom->Load(sqlite3_column_blob(stmt, 3), sqlite3_column_bytes(stmt, 3)))
 		{
-			// ignore the directory bits
+			conn->oldest = sqlite3_column_int64(stmt, 1);
+			conn->newest = sqlite3_column_int64(stmt, 2);
+			conn->bloom = bloom;
+			loaded = true;
 		}
-		else
-		{
-			std::string filename(wfd.cFileName);
+	}
 
-			// check the extension
-			std::string::size_type extLen = m_DbExt.length();
-			std::string::size_type filenameLen = filename.length();
-			std::string sub = filename.substr(filenameLen - extLen);
-			
-			// clean up the filename
-			filename = filename.substr(0, filenameLen - extLen - 1);
+	sqlite3_finalize(stmt);
 
-			if (sub.compare(m_DbExt) == 0)
-			{
-				std::string dbPath(m_DataDir);
-				dbPath.append(PATH_SEP);
-				dbPath.append(filename);
-				dbPath.append(".");
-				dbPath.append(m_DbExt);
+	if (!loaded && !RebuildShardInfo(conn))
+		return false;
 
-				spdlog::info("Caching {0} database: {1}", 
-					filename.c_str(), dbPath.c_str());
+	// mark it dirty while the database is being written to
+	SaveShardInfo(conn, false);
+	return true;
+}
 
-				if (!CacheDatabase(filename, dbPath))
-					spdlog::warn("Failed to cache database: {0}", dbPath.c_str());
-			}
-		}
-	} while (FindNextFileA(hfind, &wfd));
+bool Datastore::RebuildShardInfo(dbconn *conn)
+{
+	if (!LoadBounds(conn))
+		return false;
 
-	FindClose(hfind);
-#else
-	DIR *dir = opendir(m_DataDir.c_str());
-	if (dir)
+	// the distinct tags come straight from IDX_METRIC_TAGS
+	sqlite3_stmt *stmt = nullptr;
+	int result = sqlite3_prepare_v2(conn->db, SQL_SELECT_SERIES, -1, &stmt, nullptr);
+	if (result != SQLITE_OK)
 	{
-		struct dirent *entry = nullptr;
-		while ((entry = readdir(dir)) != NULL)
-		{
-			if (entry->d_type == DT_REG)
-			{
-				// this is a file, check the name
-				std::string filename(entry->d_name);
+		spdlog::warn(sqlite3_errstr(result));
+		return false;
+	}
 
-				std::string::size_type extLen = m_DbExt.length();
-				std::string::size_type filenameLen = filename.length();
-				std::string sub = filename.substr(filenameLen - extLen);
+	std::shared_ptr<BloomFilter> bloom = std::make_shared<BloomFilter>();
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		bloom->AddTags(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+			sqlite3_column_bytes(stmt, 0));
+	}
 
-				// clean up the filename
-				filename = filename.substr(0, filenameLen - extLen - 1);
+	sqlite3_finalize(stmt);
 
-				if (sub.compare(ext) == 0)
-				{
-					std::string dbPath(m_DataDir);
-					dbPath.append(PATH_SEP);
-					dbPath.append(filename);
-					dbPath.append(".");
-					dbPath.append(m_DbExt);
+	std::lock_guard<std::mutex> lock(m_StoreLock);
+	conn->bloom = bloom;
+	return true;
+}
 
-					spdlog::info("Caching {0} database: {1}", 
-						filename.c_str(), dbPath.c_str());
+bool Datastore::LoadBounds(dbconn *conn)
+{
+	// both ends of IDX_METRIC_TIMESTAMP; as separate subqueries, since a
+	// MIN and MAX together would scan all of it
+	sqlite3_stmt *stmt = nullptr;
+	int result = sqlite3_prepare_v2(conn->db, SQL_SELECT_BOUNDS, -1, &stmt, nullptr);
+	if (result != SQLITE_OK)
+	{
+		spdlog::warn(sqlite3_errstr(result));
+		return false;
+	}
 
-					if (!CacheDatabase(filename, dbPath))
-						spdlog::warn("Failed to cache database: {0}", dbPath.c_str());
-				}
-			}
-		}
+	uint64_t oldest = std::numeric_limits<uint64_t>::max();
+	uint64_t newest = 0;
+	if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+	{
+		oldest = sqlite3_column_int64(stmt, 0);
+		newest = sqlite3_column_int64(stmt, 1);
 	}
-	else
-		return false;
-#endif
 
-	m_Running = true;
-	spdlog::info("Datastore started");
+	sqlite3_finalize(stmt);
+
+	conn->oldest = oldest;
+	conn->newest = newest;
+	return true;
 }
 
-void Datastore::Process(void)
+void Datastore::SaveShardInfo(dbconn *conn, bool clean)
 {
-	if (!m_Running)
+	sqlite3_stmt *stmt = nullptr;
+	int result = sqlite3_prepare_v2(conn->db, SQL_UPDATE_SHARD, -1, &stmt, nullptr);
+	if (result != SQLITE_OK)
 	{
-		m_Thread->Stop();
+		spdlog::warn(sqlite3_errstr(result));
 		return;
 	}
-	
-	m_Stats->SetQueueBacklog(m_QueueSize);
 
-	// try to dequeue some metrics
-	Metric m[BULK_COUNT];
-	std::size_t count = 0;
-	while ((count = m_MetricQueue.try_dequeue_bulk(m, BULK_COUNT)) > 0)
+	std::vector<uint8_t> bloom(conn->bloom->GetSize());
+	conn->bloom->Save(bloom.data());
+
+	sqlite3_bind_int(stmt, 1, clean ? 1 : 0);
+	sqlite3_bind_int64(stmt, 2, conn->oldest);
+	sqlite3_bind_int64(stmt, 3, conn->newest);
+	sqlite3_bind_blob(stmt, 4, bloom.data(), (int)bloom.size(), SQLITE_TRANSIENT);
+
+	result = sqlite3_step(stmt);
+	if (result != SQLITE_DONE)
+		spdlog::warn("Failed to save shard info: {0}", sqlite3_errstr(result));
+
+	sqlite3_finalize(stmt);
+}
+
+bool Datastore::CacheSegment(const std::string &name, const std::string &path)
+{
+	// a move between tiers may have been interrupted, leaving two copies
+	std::string filename = path.substr(path.rfind(PATH_SEP) + 1);
+	datastore_t::iterator loaded = m_Store.find(name);
+	if (loaded != m_Store.end())
 	{
-		for (std::size_t i = 0; i < count; i++)
+		for (std::vector<segment_ptr>::const_iterator segment = loaded->second->segments.begin();
+			segment != loaded->second->segments.end(); ++segment)
 		{
-			// find the database in the cache
-			datastore_t::iterator store = m_Store.find(m[i].Name());
-			if (store != m_Store.end())
-				WriteMetric(store->second, m[i]);
-			else
+			const std::string &other = (*segment)->GetPath();
+			if (other.compare(other.rfind(PATH_SEP) + 1, std::string::npos, filename) == 0)
 			{
-				// create the database
-				dbconn *conn = CreateDatabase(m[i].Name());
-				if (conn)
-				{
-					m_Store.insert(std::pair<std::string, dbconn*>(m[i].Name(), conn));
-					WriteMetric(conn, m[i]);
-				}
+				spdlog::warn("Segment {0} is already loaded from {1}, removing the copy",
+					path.c_str(), other.c_str());
+				remove(path.c_str());
+				return true;
 			}
-
-			m_QueueSize.fetch_sub(1, std::memory_order_consume);
 		}
+	}
 
-		m_Stats->AddWriteCount(count);
+	segment_ptr segment = std::make_shared<Segment>(path);
+	if (!segment->Open())
+		return false;
+
+	// segments belong to a metric database, so make sure it is there
+	dbconn *conn = nullptr;
+	datastore_t::iterator store = m_Store.find(name);
+	if (store != m_Store.end())
+		conn = store->second;
+	else
+	{
+		conn = CreateDatabase(name);
+		if (conn == nullptr)
+			return false;
+
+		std::lock_guard<std::mutex> lock(m_StoreLock);
+		m_Store.insert(std::pair<std::string, dbconn*>(name, conn));
 	}
 
-	// write the internal statistics to the datastore if they are updated
-	Statistics::Stats stats;
-	bool write = m_Stats->GetStats(stats, true);
-	if (write)
+	segment->AddToIndex(*conn->index);
+
+	std::lock_guard<std::mutex> lock(m_StoreLock);
+	conn->segments.push_back(segment);
+	return true;
+}
+
+void Datastore::WritePoints(const Point *points, std::size_t count)
+{
+	for (std::size_t i = 0; i < count; i++)
 	{
-		// get the timestamp
-		uint64_t timestamp = time(nullptr);
-		std::string tags("host=");
-		tags.append(m_Hostname);
+		if (points[i].metric >= m_Writers.size())
+			m_Writers.resize(points[i].metric + 1, nullptr);
 
-		// build the metrics
-		std::string name("tsdb.internal.putspersecond");
-		Metric pps(name, timestamp, stats.putsPerSecond, tags);
-		QueueMetric(pps);
+		dbconn *&conn = m_Writers[points[i].metric];
+		if (conn == nullptr)
+		{
+			// first seen since starting, find the database in the cache
+			const std::string &name = m_Names.Get(points[i].metric);
+			datastore_t::iterator store = m_Store.find(name);
+			if (store != m_Store.end())
+			{
+				conn = store->second;
+				m_Names.SetData(points[i].metric, conn);
+			}
+			else
+			{
+				// a new metric is a new series too, and there is no point
+				// in creating a database that would stay empty
+				if (m_RejectSeries && m_SeriesLimit > 0 &&
+					m_SeriesCount >= m_SeriesLimit)
+				{
+					m_Stats->AddSeriesOverLimitCount(1);
+					continue;
+				}
+
+				// create the database
+				conn = CreateDatabase(name);
+				if (conn == nullptr)
+					continue;
 
-		name.assign("tsdb.internal.writespersecond");
-		Metric wps(name, timestamp, stats.writesPerSecond, tags);
-		QueueMetric(wps);
+				m_Names.SetData(points[i].metric, conn);
 
-		name.assign("tsdb.internal.queuebacklog");
-		Metric qbl(name, timestamp, stats.queueBacklog, tags);
-		QueueMetric(qbl);
+				std::lock_guard<std::mutex> lock(m_StoreLock);
+				m_Store.insert(std::pair<std::string, dbconn*>(name, conn));
+			}
+		}
+
+		if ((m_MetricSeriesLimit > 0 || m_SeriesLimit > 0) &&
+			!AdmitSeries(conn, points[i]))
+			continue;
+
+		WritePoint(conn, points[i]);
+	}
+}
+
+bool Datastore::AdmitSeries(dbconn *conn, const Point &point)
+{
+	const std::string &tags = m_Series.Get(point.series);
+	if (conn->index->HasSeries(tags.c_str(), tags.length()))
+		return true;
+
+	if ((m_MetricSeriesLimit == 0 || conn->index->GetSeriesCount() < m_MetricSeriesLimit) &&
+		(m_SeriesLimit == 0 || m_SeriesCount < m_SeriesLimit))
+		return true;
+
+	++conn->overLimit;
+	m_Stats->AddSeriesOverLimitCount(1);
+	return !m_RejectSeries;
+}
+
+void Datastore::WritePoint(dbconn *conn, const Point &point)
+{
+	// interned strings never move, so SQLite needn't copy them
+	const std::string &tags = m_Series.Get(point.series);
+
+	sqlite3_bind_int64(conn->insert, 1, point.timestamp);
+	sqlite3_bind_double(conn->insert, 2, point.value);
+	sqlite3_bind_text(conn->insert, 3, tags.c_str(), (int)tags.length(),
+		SQLITE_STATIC);
+
+	int result = sqlite3_step(conn->insert);
+	if (result != SQLITE_DONE)
+	{
+		spdlog::warn("Error writing metric {0}: {1}",
+			m_Names.Get(point.metric).c_str(), sqlite3_errstr(result));
+	}
+	else
+	{
+		// late data will be sealed again
+		if (point.timestamp < conn->oldest)
+			conn->oldest = point.timestamp;
+		if (point.timestamp > conn->newest)
+			conn->newest = point.timestamp;
+
+		conn->bloom->AddTags(tags.c_str(), tags.length());
+		bool added = false;
+		conn->index->AddSeries(tags.c_str(), tags.length(), &added);
+		if (added)
+			++m_SeriesCount;
+	}
+
+	sqlite3_reset(conn->insert);
+}
+
+ResultSet* Datastore::PrepareQuery(const Query &query, uint64_t startTime,
+	uint64_t endTime)
+{
+	if (!query.IsValid())
+		return nullptr;	// the query didn't parse
+
+	// the recent self-metrics are answered from memory
+	const SelfMetrics *self = nullptr;
+	if (m_Stats->GetSelfMetrics().Holds(query.GetMetric()))
+		self = &m_Stats->GetSelfMetrics();
+
+	// find the metric
+	dbconn *conn = nullptr;
+	std::shared_ptr<BloomFilter> bloom;
+	std::vector<segment_ptr> segments;
+	{
+		std::lock_guard<std::mutex> lock(m_StoreLock);
+
+		datastore_t::iterator metric = m_Store.find(query.GetMetric());
+		if (metric == m_Store.end())
+		{
+			if (self == nullptr)
+				return nullptr;	// we don't know that metric
+
+			// nothing has been persisted
+			std::vector<std::string> series;
+			return new ResultSet(nullptr, nullptr, segments, series, query, self);
+		}
+
+		conn = metric->second;
+	}
+
+	// the seal lock is taken before the store lock, like the sealing does
+	std::shared_lock<std::shared_timed_mutex> sealing(conn->sealLock);
+	{
+		std::lock_guard<std::mutex> lock(m_StoreLock);
+
+		// the result set keeps its segments mapped, even if they are replaced
+		bloom = conn->bloom;
+		segments.reserve(conn->segments.size());
+		for (std::vector<segment_ptr>::const_iterator segment = conn->segments.begin();
+			segment != conn->segments.end(); ++segment)
+		{
+			if ((*segment)->MayMatch(startTime, endTime, query))
+				segments.push_back(*segment);
+		}
+	}
+
+	// resolve the tag filters to the matching series
+	std::vector<std::string> series;
+	conn->index->Resolve(query, series);
+	if (series.empty())
+		segments.clear();
+
+	// only query the database when it can hold matching data
+	sqlite3_stmt *stmt = nullptr;
+	sqlite3_stmt *tail = nullptr;
+	if (!series.empty() && startTime <= conn->newest &&
+		endTime >= conn->oldest && query.MayMatch(*bloom))
+	{
+		// the series are bound in chunks, and what doesn't fill a whole
+		// chunk goes to a shorter query
+		std::size_t chunk = std::min<std::size_t>(series.size(), MAX_SERIES_BIND);
+		std::size_t rest = series.size() % chunk;
+
+		int result = sqlite3_prepare_v2(conn->db,
+			query.GetSeriesQuery(chunk).c_str(), -1, &stmt, nullptr);
+		if (result == SQLITE_OK && rest > 0)
+		{
+			result = sqlite3_prepare_v2(conn->db,
+				query.GetSeriesQuery(rest).c_str(), -1, &tail, nullptr);
+		}
+
+		if (result != SQLITE_OK)
+		{
+			spdlog::warn(sqlite3_errstr(result));
+			sqlite3_finalize(stmt);
+			return nullptr;
+		}
+	}
+
+	ResultSet *rs = new ResultSet(stmt, tail, segments, series, query, self,
+		std::move(sealing));
+	if (rs == nullptr)
+	{
+		sqlite3_finalize(stmt);
+		sqlite3_finalize(tail);
+	}
+
+	return rs;
+}
+
+void Datastore::PersistSelfMetrics(void)
+{
+	std::vector<SelfMetrics::Entry> entries;
+	m_Stats->GetSelfMetrics().Drain(entries);
+
+	for (std::vector<SelfMetrics::Entry>::iterator entry = entries.begin();
+		entry != entries.end(); ++entry)
+	{
+		Metric metric(*entry->name, entry->timestamp, entry->value, *entry->tags);
+		QueueMetric(metric);
+	}
+}
+
+bool Datastore::SealSegments(void)
+{
+	if (m_SealAfter == 0 || m_SegmentSpan == 0)
+		return false;	// sealing is disabled
+
+	uint64_t now = time(nullptr);
+	if (now < m_SealAfter)
+		return false;
+
+	// only whole spans that are entirely older than the threshold are sealed
+	uint64_t boundary = ((now - m_SealAfter) / m_SegmentSpan) * m_SegmentSpan;
+
+	// only this thread modifies the store, so it can be walked unlocked
+	uint32_t sealed = 0;
+	for (datastore_t::iterator ds = m_Store.begin(); ds != m_Store.end(); ++ds)
+	{
+		dbconn *conn = ds->second;
+		bool changed = false;
+		bool more = false;
+		while (conn->oldest < boundary)
+		{
+			if (sealed == SEAL_BATCH)
+			{
+				more = true;	// the rest on the next pass
+				break;
+			}
+
+			uint64_t start = (conn->oldest / m_SegmentSpan) * m_SegmentSpan;
+			if (!SealSegment(ds->first, conn, start, start + m_SegmentSpan))
+				break;	// try again later
+
+			++sealed;
+			changed = true;
+
+			// tighten the bounds to what is left
+			if (!LoadBounds(conn))
+				break;
+		}
+
+		// and the tag filter, which takes a scan of IDX_METRIC_TAGS, once
+		// for all the spans sealed
+		if (changed)
+			RebuildShardInfo(conn);
+
+		if (more)
+			return true;
+	}
+
+	return false;
+}
+
+bool Datastore::SealSegment(const std::string &name, dbconn *conn,
+	uint64_t startTime, uint64_t endTime)
+{
+	// find a free file name in either tier, late data for a sealed span
+	// gets its own segment; a sealed segment may still have its temporary
+	// name, if it couldn't be renamed
+	std::string path;
+	for (uint32_t seq = 0; ; seq++)
+	{
+		std::ostringstream oss;
+		oss << PATH_SEP << name << "." << startTime << "." << seq
+			<< "." << SEGMENT_EXT;
+
+		path = m_DataDir + oss.str();
+		FILE *fp = fopen(path.c_str(), "rb");
+		if (fp == nullptr)
+			fp = fopen(SegmentWriter::GetTempPath(path).c_str(), "rb");
+		if (fp == nullptr && !m_ColdDir.empty())
+			fp = fopen((m_ColdDir + oss.str()).c_str(), "rb");
+
+		if (fp == nullptr)
+			break;
+
+		fclose(fp);
+	}
+
+	sqlite3_stmt *stmt = nullptr;
+	int result = sqlite3_prepare_v2(conn->db, SQL_SELECT_SEAL, -1, &stmt, nullptr);
+	if (result != SQLITE_OK)
+	{
+		spdlog::warn(sqlite3_errstr(result));
+		return false;
+	}
+
+	sqlite3_bind_int64(stmt, 1, startTime);
+	sqlite3_bind_int64(stmt, 2, endTime);
+
+	SegmentWriter writer(path, startTime, endTime);
+	result = sqlite3_step(stmt);
+	while (result == SQLITE_ROW)
+	{
+		writer.Append(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+			sqlite3_column_bytes(stmt, 0), sqlite3_column_int64(stmt, 1),
+			sqlite3_column_double(stmt, 2));
+
+		result = sqlite3_step(stmt);
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (result != SQLITE_DONE)
+	{
+		spdlog::warn("Failed to read {0} for sealing: {1}", name.c_str(),
+			sqlite3_errstr(result));
+		return false;
+	}
+
+	std::string filename;
+	if (writer.GetRowCount() > 0)
+	{
+		if (!writer.Write())
+			return false;
+
+		filename = path.substr(path.rfind(PATH_SEP) + 1);
+	}
+
+	// queries see the rows either in the database or in a listed segment
+	std::unique_lock<std::shared_timed_mutex> sealing(conn->sealLock);
+
+	// the rows move to the segment in one transaction, so they are never
+	// in both or in neither, whatever fails or crashes
+	if (!CommitSeal(conn, filename, startTime, endTime))
+	{
+		writer.Discard();
+		return false;
+	}
+
+	if (filename.empty())
+		return true;	// there was nothing to seal
+
+	// if this fails, the segment is put in place at the next start
+	if (!writer.Commit())
+		return false;
+
+	ForgetSeal(conn, filename);
+
+	segment_ptr segment = std::make_shared<Segment>(path);
+	if (!segment->Open())
+		return false;
+
+	{
+		std::lock_guard<std::mutex> lock(m_StoreLock);
+		conn->segments.push_back(segment);
+	}
+
+	spdlog::info("Sealed {0} rows of {1} into {2}", writer.GetRowCount(),
+		name.c_str(), path.c_str());
+	return true;
+}
+
+bool Datastore::CommitSeal(dbconn *conn, const std::string &filename,
+	uint64_t startTime, uint64_t endTime)
+{
+	char *error = nullptr;
+	int result = sqlite3_exec(conn->db, "BEGIN;", nullptr, nullptr, &error);
+	if (result != SQLITE_OK)
+	{
+		spdlog::warn(error);
+		sqlite3_free(error);
+		return false;
+	}
+
+	// the segment is recorded as sealed until it has its final name
+	sqlite3_stmt *stmt = nullptr;
+	if (!filename.empty())
+	{
+		result = sqlite3_prepare_v2(conn->db, SQL_INSERT_SEALED, -1, &stmt, nullptr);
+		if (result == SQLITE_OK)
+		{
+			sqlite3_bind_text(stmt, 1, filename.c_str(), (int)filename.length(),
+				SQLITE_STATIC);
+			result = sqlite3_step(stmt);
+			sqlite3_finalize(stmt);
+		}
+	}
+
+	if (filename.empty() || result == SQLITE_DONE)
+	{
+		result = sqlite3_prepare_v2(conn->db, SQL_DELETE_SEAL, -1, &stmt, nullptr);
+		if (result == SQLITE_OK)
+		{
+			sqlite3_bind_int64(stmt, 1, startTime);
+			sqlite3_bind_int64(stmt, 2, endTime);
+			result = sqlite3_step(stmt);
+			sqlite3_finalize(stmt);
+		}
+	}
+
+	if (result == SQLITE_DONE)
+		result = sqlite3_exec(conn->db, "COMMIT;", nullptr, nullptr, nullptr);
+
+	if (result != SQLITE_OK && result != SQLITE_DONE)
+	{
+		spdlog::warn("Failed to remove sealed rows: {0}", sqlite3_errstr(result));
+		sqlite3_exec(conn->db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		return false;
+	}
+
+	return true;
+}
+
+bool Datastore::IsSealed(dbconn *conn, const std::string &filename)
+{
+	sqlite3_stmt *stmt = nullptr;
+	int result = sqlite3_prepare_v2(conn->db, SQL_SELECT_SEALED, -1, &stmt, nullptr);
+	if (result != SQLITE_OK)
+	{
+		spdlog::warn(sqlite3_errstr(result));
+		return false;
+	}
+
+	sqlite3_bind_text(stmt, 1, filename.c_str(), (int)filename.length(),
+		SQLITE_STATIC);
+
+	bool sealed = sqlite3_step(stmt) == SQLITE_ROW &&
+		sqlite3_column_int(stmt, 0) > 0;
+	sqlite3_finalize(stmt);
+	return sealed;
+}
+
+void Datastore::ForgetSeal(dbconn *conn, const std::string &filename)
+{
+	sqlite3_stmt *stmt = nullptr;
+	if (sqlite3_prepare_v2(conn->db, SQL_DELETE_SEALED, -1, &stmt, nullptr) != SQLITE_OK)
+		return;	// a stale entry is harmless
+
+	sqlite3_bind_text(stmt, 1, filename.c_str(), (int)filename.length(),
+		SQLITE_STATIC);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+}
+
+bool Datastore::RecoverSegment(const std::string &dir, const std::string &filename)
+{
+	std::string path(dir);
+	path.append(PATH_SEP);
+	path.append(filename);
+
+	// <metric>.<start time>.<sequence>.seg.tmp
+	std::string sealed(filename.substr(0, filename.rfind('.')));
+	std::string name;
+	datastore_t::iterator store = m_Store.end();
+	if (dir == m_DataDir && ParseSegmentName(sealed, name))
+		store = m_Store.find(name);
+
+	// sealed segments are only written to the data directory, and the
+	// rows are still in the database unless the seal was committed; in
+	// the cold tier it is a copy that was interrupted, and the hot copy
+	// is still there
+	if (store == m_Store.end() || !IsSealed(store->second, sealed))
+	{
+		spdlog::info("Removing incomplete segment {0}", path.c_str());
+		remove(path.c_str());
+		return false;
+	}
+
+	std::string target(dir);
+	target.append(PATH_SEP);
+	target.append(sealed);
+	if (rename(path.c_str(), target.c_str()) != 0)
+	{
+		spdlog::error("Failed to rename sealed segment {0}", path.c_str());
+		return false;
+	}
+
+	SyncDirectory(dir);
+	ForgetSeal(store->second, sealed);
+
+	spdlog::info("Completed sealing {0}", target.c_str());
+	return true;
+}
+
+bool Datastore::ScanDirectory(const std::string &dir)
+{
+	std::vector<std::string> files;
+
+#if defined(_WIN32) || defined(WIN32)
+	WIN32_FIND_DATAA wfd;
+	HANDLE hfind = INVALID_HANDLE_VALUE;
+
+	std::string searchpath(dir);
+	searchpath.append(PATH_SEP);
+	searchpath.append("*");
+
+	hfind = FindFirstFileA(searchpath.c_str(), &wfd);
+	if (hfind == INVALID_HANDLE_VALUE)
+	{
+		spdlog::error("Failed to search path: {0}", searchpath.c_str());
+		return false;
+	}
+
+	do
+	{
+		if (wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			// ignore the directory bits
+		}
+		else
+			files.push_back(wfd.cFileName);
+	} while (FindNextFileA(hfind, &wfd));
+
+	FindClose(hfind);
+#else
+	DIR *d = opendir(dir.c_str());
+	if (d == nullptr)
+	{
+		spdlog::error("Failed to search path: {0}", dir.c_str());
+		return false;
+	}
+
+	struct dirent *entry = nullptr;
+	while ((entry = readdir(d)) != NULL)
+	{
+		if (entry->d_type == DT_REG)
+			files.push_back(entry->d_name);
+	}
+
+	closedir(d);
+#endif
+
+	// load the databases before the segments that belong to them
+	std::string segExt(".");
+	segExt.append(SEGMENT_EXT);
+
+	std::string tmpExt(SegmentWriter::GetTempPath(segExt));
+
+	std::vector<std::string> segments;
+	std::vector<std::string> temporary;
+	for (std::vector<std::string>::const_iterator file = files.begin();
+		file != files.end(); ++file)
+	{
+		if (file->length() > segExt.length() &&
+			file->compare(file->length() - segExt.length(), segExt.length(), segExt) == 0)
+			segments.push_back(*file);
+		else if (file->length() > tmpExt.length() &&
+			file->compare(file->length() - tmpExt.length(), tmpExt.length(), tmpExt) == 0)
+			temporary.push_back(*file);
+		else
+			LoadFile(dir, *file);
+	}
+
+	// segments left behind by a crash, which need their databases
+	for (std::vector<std::string>::const_iterator file = temporary.begin();
+		file != temporary.end(); ++file)
+	{
+		if (RecoverSegment(dir, *file))
+			segments.push_back(file->substr(0, file->rfind('.')));
+	}
+
+	for (std::vector<std::string>::const_iterator file = segments.begin();
+		file != segments.end(); ++file)
+	{
+		LoadFile(dir, *file);
+	}
+
+	return true;
+}
+
+void Datastore::LoadFile(const std::string &dir, const std::string &filename)
+{
+	std::string::size_type dot = filename.rfind('.');
+	if (dot == std::string::npos)
+		return;
+
+	std::string sub = filename.substr(dot + 1);
+
+	std::string path(dir);
+	path.append(PATH_SEP);
+	path.append(filename);
+
+	if (sub.compare(m_DbExt) == 0)
+	{
+		// clean up the filename
+		std::string name = filename.substr(0, dot);
+
+		spdlog::info("Caching {0} database: {1}", name.c_str(), path.c_str());
+
+		if (!CacheDatabase(name, path))
+			spdlog::warn("Failed to cache database: {0}", path.c_str());
+	}
+	else if (sub.compare(SEGMENT_EXT) == 0)
+	{
+		std::string name;
+		if (!ParseSegmentName(filename, name))
+		{
+			spdlog::warn("Unrecognized segment name: {0}", path.c_str());
+			return;
+		}
+
+		spdlog::debug("Mapping {0} segment: {1}", name.c_str(), path.c_str());
+
+		if (!CacheSegment(name, path))
+			spdlog::warn("Failed to map segment: {0}", path.c_str());
+	}
+}
+
+void Datastore::Start(void)
+{
+	spdlog::info("Starting datastore");
+	spdlog::info("Data directory: {0}", m_DataDir.c_str());
+
+	// scan the data directory for databases to cache
+	if (!ScanDirectory(m_DataDir))
+		return;
+
+	// the cold tier only adds segments, a missing directory isn't fatal
+	if (!m_ColdDir.empty())
+	{
+		spdlog::info("Cold data directory: {0}", m_ColdDir.c_str());
+		ScanDirectory(m_ColdDir);
+	}
+
+	// the series already stored count against the limits, and their
+	// metrics are known to producers so they can check them
+	std::size_t seriesCount = 0;
+	for (datastore_t::iterator store = m_Store.begin(); store != m_Store.end(); ++store)
+	{
+		seriesCount += store->second->index->GetSeriesCount();
+
+		uint32_t metric = 0;
+		if (m_Names.Intern(store->first, metric))
+			m_Names.SetData(metric, store->second);
+	}
+	m_SeriesCount = seriesCount;
+	spdlog::info("Tracking {0} series", seriesCount);
+
+	m_Running = true;
+	spdlog::info("Datastore started");
+}
+
+void Datastore::Process(void)
+{
+	if (!m_Running)
+	{
+		m_Thread->Stop();
+		return;
+	}
+	
+	m_Stats->SetQueueBacklog(m_QueueSize);
+
+	// try to dequeue some metrics
+	Point m[BULK_COUNT];
+	std::size_t count = 0;
+	while ((count = m_MetricQueue.try_dequeue_bulk(m, BULK_COUNT)) > 0)
+	{
+		WritePoints(m, count);
+
+		m_QueueSize.fetch_sub(count, std::memory_order_consume);
+		m_Stats->AddWriteCount(count);
+	}
+
+	// the self-metrics are kept in memory, and copied to disk now and then
+	if (m_PersistInterval > 0 &&
+		m_PersistTimer.Elapsed() - m_LastPersist >= m_PersistInterval)
+	{
+		PersistSelfMetrics();
+		m_LastPersist = m_PersistTimer.Elapsed();
+	}
+
+	// move old data into sealed segments, a few spans at a time so the
+	// queue keeps draining while a long history is sealed
+	float curTime = m_SealTimer.Elapsed();
+	if (curTime - m_LastSeal >= (m_SealBacklog ? SEAL_BACKLOG_INTERVAL : SEAL_INTERVAL))
+	{
+		m_SealBacklog = SealSegments();
+		m_LastSeal = curTime;
 	}
 
 	if (count == 0)
@@ -433,39 +1440,96 @@ void Datastore::Stop(void)
 {
 	spdlog::info("Datastore stopping");
 
+	if (m_PersistInterval > 0)
+		PersistSelfMetrics();
+
 	// finish writing all the data to disk
-	Metric m[BULK_COUNT];
+	Point m[BULK_COUNT];
 	std::size_t count = 0;
 	while ((count = m_MetricQueue.try_dequeue_bulk(m, BULK_COUNT)) > 0)
 	{
-		for (std::size_t i = 0; i < count; i++)
-		{
-			// find the database in the cache
-			datastore_t::iterator store = m_Store.find(m[i].Name());
-			if (store != m_Store.end())
-				WriteMetric(store->second, m[i]);
-			else
-			{
-				// create the database
-				dbconn *conn = CreateDatabase(m[i].Name());
-				if (conn)
-				{
-					m_Store.insert(std::pair<std::string, dbconn*>(m[i].Name(), conn));
-					WriteMetric(conn, m[i]);
-				}
-			}
-		}
+		WritePoints(m, count);
 	}
 
 	// close all database handles
+	std::lock_guard<std::mutex> lock(m_StoreLock);
 	for (datastore_t::iterator ds = m_Store.begin();
 		ds != m_Store.end(); ds++)
 	{
+		uint32_t metric = 0;
+		if (m_Names.Find(ds->first, metric))
+			m_Names.SetData(metric, nullptr);
+
+		SaveShardInfo(ds->second, true);
+
 		sqlite3_finalize(ds->second->insert);
 		sqlite3_close_v2(ds->second->db);
 		delete ds->second;
 	}
 	m_Store.clear();
+	m_Writers.clear();
 
 	spdlog::info("Datastore stopped");
 }
+
+MetricBatch::MetricBatch(Datastore *datastore)
+	: m_DataStore(datastore), m_Token(datastore->m_MetricQueue)
+{
+	m_Points.reserve(METRIC_BATCH_SIZE);
+}
+
+MetricBatch::~MetricBatch(void)
+{
+	Flush();
+}
+
+bool MetricBatch::GetMetric(std::string_view name, uint32_t &metric,
+	std::string &error, bool *overLimit)
+{
+	return m_DataStore->ResolveMetric(name, metric, error, overLimit);
+}
+
+bool MetricBatch::GetSeries(uint32_t metric, std::string_view tags,
+	uint32_t &series, std::string &error, bool *overLimit)
+{
+	return m_DataStore->ResolveSeries(metric, tags, series, error, overLimit);
+}
+
+void MetricBatch::Add(const Point &point)
+{
+	m_Points.push_back(point);
+	if (m_Points.size() >= METRIC_BATCH_SIZE)
+		Flush();
+}
+
+bool MetricBatch::Add(std::string_view name, uint64_t timestamp, double value,
+	std::string_view tags, std::string &error)
+{
+	Point point;
+	if (!GetMetric(name, point.metric, error) ||
+		!GetSeries(point.metric, tags, point.series, error))
+		return false;
+
+	point.timestamp = timestamp;
+	point.value = value;
+	Add(point);
+	return true;
+}
+
+bool MetricBatch::AddLine(std::string_view line, std::string &error)
+{
+	std::string_view name, tags;
+	uint64_t timestamp = 0;
+	double value = 0;
+	if (!Metric::ParseLine(line, name, timestamp, value, tags, error))
+		return false;
+
+	return Add(name, timestamp, value, tags, error);
+}
+
+std::size_t MetricBatch::Flush(void)
+{
+	std::size_t count = m_Points.size();
+	m_DataStore->QueuePoints(m_Token, m_Points);
+	return count;
+}
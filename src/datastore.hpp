@@ -9,61 +9,223 @@
 
 #include <atomic>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "bloom.hpp"
+#include "intern.hpp"
 #include "metric.hpp"
+#include "point.hpp"
 #include "query.hpp"
 #include "resultset.hpp"
+#include "segment.hpp"
 #include "stats.hpp"
+#include "tagindex.hpp"
 #include "thread.hpp"
+#include "timer.hpp"
 
 #include "concurrentqueue.h"
 #include "sqlite3.h"
 
 class Datastore : public ThreadProc
 {
+	friend class MetricBatch;
+
 private:
 	struct dbconn
 	{
 		sqlite3 *db;
 		sqlite3_stmt *insert;
+
+		// time bounds and tag filter of the data held in the database, so
+		// queries can skip it without touching SQLite
+		std::atomic<uint64_t> oldest;
+		std::atomic<uint64_t> newest;
+		std::shared_ptr<BloomFilter> bloom;	// replaced under m_StoreLock
+
+		// every series of the metric, in the database or sealed
+		std::unique_ptr<TagIndex> index;
+
+		// sealed, immutable history for this metric
+		std::vector<segment_ptr> segments;
+
+		// held exclusively while a span moves from the database to a
+		// segment, and shared by queries from preparing to executing
+		std::shared_timed_mutex sealLock;
+
+		// points for new series past the series limits
+		std::atomic<uint64_t> overLimit;
+	};
+
+public:
+	struct SeriesStats
+	{
+		std::string metric;
+		std::size_t series;
+		uint64_t overLimit;
 	};
 
 private:
 	std::string m_DataDir;
+	std::string m_ColdDir;
+	std::string m_Vfs;
+	int m_PageSize;
 	std::string m_DbExt;
-	std::string m_Hostname;
 
-	moodycamel::ConcurrentQueue<Metric> m_MetricQueue;
+	moodycamel::ConcurrentQueue<Point> m_MetricQueue;
 	std::atomic_size_t m_QueueSize;
 
+	// the strings the queued points refer to
+	InternTable m_Names;
+	InternTable m_Series;
+
 	Statistics *m_Stats;
 
 	typedef std::map<std::string, dbconn*> datastore_t;
 	datastore_t m_Store;
+	std::mutex m_StoreLock;	// guards m_Store and the segment lists
+
+	// the writer's databases by interned metric name
+	std::vector<dbconn*> m_Writers;
+
+	uint64_t m_SealAfter;
+	uint64_t m_SegmentSpan;
+	Timer m_SealTimer;
+	float m_LastSeal;
+	bool m_SealBacklog;		// the last pass stopped with spans left
+
+	uint32_t m_PersistInterval;
+	Timer m_PersistTimer;
+	float m_LastPersist;
+
+	// distinct series per metric and across all metrics, 0 is unlimited
+	std::size_t m_MetricSeriesLimit;
+	std::size_t m_SeriesLimit;
+	bool m_RejectSeries;
+	std::atomic_size_t m_SeriesCount;	// only the writer changes it
 
 	bool m_Running;
 	Thread *m_Thread;
 
 public:
 	Datastore(const std::string &dataDir, const std::string &dbExt,
-		const std::string &hostname, Statistics *stats);
+		Statistics *stats);
 	~Datastore(void);
 
 	bool StartThread(void);
 	void StopThread(void);
 
+	// data older than sealAfter seconds is sealed into segments of span seconds
+	void ConfigureSegments(uint64_t sealAfter, uint64_t span);
+
+	// the self-metrics kept in memory are also written to disk every
+	// persistInterval seconds, 0 keeps them in memory only
+	void ConfigureSelfMetrics(uint32_t persistInterval);
+
+	// limits the distinct series of each metric and of all metrics
+	// together, 0 for no limit; points that would start a series past a
+	// limit are dropped, or written and only counted if reject is false
+	void ConfigureSeriesLimits(std::size_t perMetric, std::size_t total,
+		bool reject);
+	std::size_t GetSeriesCount(void) const { return m_SeriesCount; }
+
+	// the metrics that have had points past the series limits
+	void GetSeriesStats(std::vector<SeriesStats> &metrics);
+
+	// databases are opened through a named SQLite VFS, and new ones are
+	// created with pageSize byte pages (0 for the SQLite default)
+	void ConfigureVfs(const std::string &vfs, int pageSize);
+
+	// secondary directory that sealed segments are moved to as they age
+	void ConfigureColdStorage(const std::string &coldDir);
+	const std::string& GetDataDir(void) const { return m_DataDir; }
+	const std::string& GetColdDir(void) const { return m_ColdDir; }
+
+	// segments in the data directory that end before a point in time
+	void GetHotSegments(uint64_t before,
+		std::vector<std::pair<std::string, segment_ptr> > &segments);
+	bool ReplaceSegment(const std::string &name, const segment_ptr &segment,
+		const segment_ptr &replacement);
+
+	// the metric must be valid
 	void QueueMetric(const Metric &metric);
-	ResultSet* PrepareQuery(const Query &query);
+	void QueuePoints(moodycamel::ProducerToken &token,
+		std::vector<Point> &points);
+	ResultSet* PrepareQuery(const Query &query, uint64_t startTime,
+		uint64_t endTime);
 
 private:
+	bool ScanDirectory(const std::string &dir);
+	void LoadFile(const std::string &dir, const std::string &filename);
+
 	bool CacheDatabase(const std::string &name, const std::string &path);
 	dbconn* CreateDatabase(const std::string &name);
-
-	void WriteMetric(dbconn *conn, const Metric &metric);
+	bool CacheSegment(const std::string &name, const std::string &path);
+
+	bool LoadTagIndex(dbconn *conn);
+	bool LoadShardInfo(dbconn *conn);
+	bool RebuildShardInfo(dbconn *conn);
+	bool LoadBounds(dbconn *conn);
+	void SaveShardInfo(dbconn *conn, bool clean);
+
+	bool MakePoint(const Metric &metric, Point &point);
+	bool ResolveMetric(std::string_view name, uint32_t &metric,
+		std::string &error, bool *overLimit);
+	bool ResolveSeries(uint32_t metric, std::string_view tags,
+		uint32_t &series, std::string &error, bool *overLimit);
+	bool AdmitNewSeries(uint32_t metric, std::string_view tags,
+		std::string &error);
+	void WritePoints(const Point *points, std::size_t count);
+	bool AdmitSeries(dbconn *conn, const Point &point);
+	void WritePoint(dbconn *conn, const Point &point);
+
+	void PersistSelfMetrics(void);
+
+	// true when there are spans left to seal
+	bool SealSegments(void);
+	bool SealSegment(const std::string &name, dbconn *conn,
+		uint64_t startTime, uint64_t endTime);
+	bool CommitSeal(dbconn *conn, const std::string &filename,
+		uint64_t startTime, uint64_t endTime);
+	bool IsSealed(dbconn *conn, const std::string &filename);
+	void ForgetSeal(dbconn *conn, const std::string &filename);
+	bool RecoverSegment(const std::string &dir, const std::string &filename);
 
 protected:
 	void Start(void);
 	void Process(void);
 	void Stop(void);
 };
+
+// collects the metrics of one producer (a reactor thread or an HTTP
+// request) and queues them in bulk through its own producer token
+class MetricBatch
+{
+private:
+	Datastore *m_DataStore;
+	moodycamel::ProducerToken m_Token;
+	std::vector<Point> m_Points;
+
+public:
+	MetricBatch(Datastore *datastore);
+	~MetricBatch(void);
+
+	// the IDs of a metric name and of a tag set, which may be in any order;
+	// known names and tag sets are found without locking or allocating. A
+	// name new to the server, or a tag set new to its metric, is refused,
+	// with overLimit set, once the metric or the server is at a series limit
+	bool GetMetric(std::string_view name, uint32_t &metric, std::string &error,
+		bool *overLimit = nullptr);
+	bool GetSeries(uint32_t metric, std::string_view tags, uint32_t &series,
+		std::string &error, bool *overLimit = nullptr);
+
+	// queued automatically once the batch is full
+	void Add(const Point &point);
+	bool Add(std::string_view name, uint64_t timestamp, double value,
+		std::string_view tags, std::string &error);
+	bool AddLine(std::string_view line, std::string &error);
+	std::size_t Flush(void);
+};
@@ -0,0 +1,106 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Line framer
+ *
+ */
+
+#include "framer.hpp"
+
+#include <cstring>
+
+LineFramer::LineFramer(std::size_t capacity)
+	: m_Capacity(capacity), m_Start(0), m_Scanned(0), m_End(0),
+	  m_Discarding(false), m_Discarded(0)
+{
+}
+
+LineFramer::~LineFramer(void)
+{
+}
+
+char* LineFramer::GetWriteBuffer(std::size_t &space)
+{
+	// allocated on first use, idle connections don't hold a buffer
+	if (!m_Buffer)
+		m_Buffer.reset(new char[m_Capacity]);
+
+	if (m_Start == m_End)
+	{
+		m_Start = m_Scanned = m_End = 0;
+	}
+	else if (m_Start > 0 && m_Capacity - m_End < m_Capacity / 4)
+	{
+		// move the partial line to the front
+		std::size_t pending = m_End - m_Start;
+		memmove(m_Buffer.get(), m_Buffer.get() + m_Start, pending);
+		m_Scanned -= m_Start;
+		m_End = pending;
+		m_Start = 0;
+	}
+
+	if (m_End == m_Capacity)
+	{
+		// a single line fills the whole buffer, drop it up to its end
+		if (!m_Discarding)
+			++m_Discarded;
+
+		m_Discarding = true;
+		m_Start = m_Scanned = m_End = 0;
+	}
+
+	space = m_Capacity - m_End;
+	return m_Buffer.get() + m_End;
+}
+
+void LineFramer::Commit(std::size_t length)
+{
+	m_End += length;
+}
+
+bool LineFramer::NextLine(char *&line, std::size_t &length)
+{
+	while (m_Scanned < m_End)
+	{
+		char *begin = m_Buffer.get() + m_Start;
+		char *newline = static_cast<char*>(memchr(m_Buffer.get() + m_Scanned,
+			'\n', m_End - m_Scanned));
+		if (newline == nullptr)
+		{
+			m_Scanned = m_End;
+			return false;
+		}
+
+		m_Start = m_Scanned = newline - m_Buffer.get() + 1;
+
+		if (m_Discarding)
+		{
+			// the tail of an overlong line
+			m_Discarding = false;
+			continue;
+		}
+
+		length = newline - begin;
+		if (length > 0 && begin[length - 1] == '\r')
+			--length;
+
+		line = begin;
+		return true;
+	}
+
+	return false;
+}
+
+bool LineFramer::LastLine(char *&line, std::size_t &length)
+{
+	if (m_Start == m_End || m_Discarding)
+		return false;
+
+	line = m_Buffer.get() + m_Start;
+	length = m_End - m_Start;
+	if (line[length - 1] == '\r')
+		--length;
+
+	m_Start = m_Scanned = m_End;
+	return true;
+}
@@ -0,0 +1,49 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Line framer
+ *
+ * A per-connection receive buffer that socket reads land in directly.
+ * Complete lines are framed in place and handed out as pointers into
+ * the buffer; only the trailing partial line is ever moved, back to the
+ * front of the buffer when the free space at the end runs low.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#define LINE_BUFFER_SIZE	65536
+
+class LineFramer
+{
+private:
+	std::unique_ptr<char[]> m_Buffer;
+	std::size_t m_Capacity;
+	std::size_t m_Start;	// first byte not yet framed
+	std::size_t m_Scanned;	// bytes before this hold no newline
+	std::size_t m_End;		// first free byte
+
+	bool m_Discarding;		// dropping a line longer than the buffer
+	std::size_t m_Discarded;
+
+public:
+	LineFramer(std::size_t capacity = LINE_BUFFER_SIZE);
+	~LineFramer(void);
+
+	// free space to receive into, never empty
+	char* GetWriteBuffer(std::size_t &space);
+	void Commit(std::size_t length);
+
+	// the next complete line, without its line ending; the line stays
+	// valid (and may be modified in place) until the next GetWriteBuffer
+	bool NextLine(char *&line, std::size_t &length);
+
+	// once the stream has ended, the last line if it had no line ending
+	bool LastLine(char *&line, std::size_t &length);
+
+	// the number of overlong lines dropped so far
+	std::size_t GetDiscarded(void) const { return m_Discarded; }
+};
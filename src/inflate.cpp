@@ -0,0 +1,675 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Inflater
+ *
+ */
+
+#include "inflate.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#define INFLATE_INPUT_SIZE	65536
+#define INFLATE_WINDOW_SIZE	32768
+#define INFLATE_WINDOW_MASK	(INFLATE_WINDOW_SIZE - 1)
+#define INFLATE_FAST_BITS	9
+#define INFLATE_MAX_BITS	15
+
+#define GZIP_FHCRC			0x02
+#define GZIP_FEXTRA			0x04
+#define GZIP_FNAME			0x08
+#define GZIP_FCOMMENT		0x10
+#define GZIP_RESERVED		0xE0
+
+#define ADLER_MOD			65521
+#define ADLER_MAX_RUN		5552	// the longest run without overflow
+
+static const uint16_t LengthBase[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t LengthExtra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t DistanceBase[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const uint8_t DistanceExtra[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// the order code length code lengths are sent in
+static const uint8_t LengthOrder[19] =
+{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// four tables, so the CRC can be updated a word at a time
+static const uint32_t (*Crc32Tables(void))[256]
+{
+	static const struct Tables
+	{
+		uint32_t entries[4][256];
+
+		Tables(void)
+		{
+			for (uint32_t n = 0; n < 256; n++)
+			{
+				uint32_t c = n;
+				for (int32_t k = 0; k < 8; k++)
+					c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+				entries[0][n] = c;
+			}
+
+			for (uint32_t n = 0; n < 256; n++)
+			{
+				for (int32_t t = 1; t < 4; t++)
+					entries[t][n] = (entries[t - 1][n] >> 8) ^
+						entries[0][entries[t - 1][n] & 0xFF];
+			}
+		}
+	} tables;
+
+	return tables.entries;
+}
+
+Inflater::Inflater(Format format, const Source &source)
+	: m_Format(format), m_Source(source),
+	  m_Input(new uint8_t[INFLATE_INPUT_SIZE]), m_InputPos(0),
+	  m_InputEnd(0), m_InputEnded(false), m_BitBuffer(0), m_BitCount(0),
+	  m_Window(new uint8_t[INFLATE_WINDOW_SIZE]), m_Total(0), m_Check(0),
+	  m_State(State::HEADER), m_FinalBlock(false), m_StoredLength(0),
+	  m_CopyLength(0), m_CopyDistance(0)
+{
+}
+
+Inflater::~Inflater(void)
+{
+}
+
+int32_t Inflater::Read(char *buffer, std::size_t size)
+{
+	if (!m_Error.empty())
+		return -1;
+
+	std::size_t out = 0;
+	std::size_t checked = 0;
+	while (out < size && m_State != State::DONE)
+	{
+		bool ok = true;
+		switch (m_State)
+		{
+		case State::HEADER:
+			ok = ReadHeader();
+			break;
+
+		case State::BLOCK:
+			ok = ReadBlockHeader();
+			break;
+
+		case State::STORED:
+			while (m_StoredLength > 0 && out < size)
+			{
+				// whole bytes left in the bit buffer come first
+				if (m_BitCount >= 8)
+				{
+					Output(buffer, out, (uint8_t)m_BitBuffer);
+					m_BitBuffer >>= 8;
+					m_BitCount -= 8;
+					--m_StoredLength;
+					continue;
+				}
+
+				if (m_InputPos == m_InputEnd && !Refill())
+				{
+					ok = Fail("Unexpected end of compressed body");
+					break;
+				}
+
+				// copy straight from the input, wrapping around the window
+				std::size_t length = std::min({ (std::size_t)m_StoredLength,
+					size - out, m_InputEnd - m_InputPos,
+					INFLATE_WINDOW_SIZE - (std::size_t)(m_Total & INFLATE_WINDOW_MASK) });
+				memcpy(buffer + out, &m_Input[m_InputPos], length);
+				memcpy(&m_Window[m_Total & INFLATE_WINDOW_MASK], &m_Input[m_InputPos], length);
+				out += length;
+				m_InputPos += length;
+				m_Total += length;
+				m_StoredLength -= (uint32_t)length;
+			}
+
+			if (ok && m_StoredLength == 0)
+				m_State = m_FinalBlock ? State::TRAILER : State::BLOCK;
+			break;
+
+		case State::HUFFMAN:
+			while (out < size)
+			{
+				if (m_CopyLength > 0)
+				{
+					// finish the match, it may be longer than the buffer
+					std::size_t length = std::min((std::size_t)m_CopyLength, size - out);
+					for (std::size_t i = 0; i < length; i++)
+						Output(buffer, out, m_Window[(m_Total - m_CopyDistance) & INFLATE_WINDOW_MASK]);
+					m_CopyLength -= (uint32_t)length;
+					continue;
+				}
+
+				uint32_t symbol = 0;
+				if (!(ok = Decode(m_Literals, symbol)))
+					break;
+
+				if (symbol < 256)
+				{
+					Output(buffer, out, (uint8_t)symbol);
+					continue;
+				}
+
+				if (symbol == 256)
+				{
+					m_State = m_FinalBlock ? State::TRAILER : State::BLOCK;
+					break;
+				}
+
+				symbol -= 257;
+				if (symbol >= 29)
+				{
+					ok = Fail("Invalid length code");
+					break;
+				}
+
+				uint32_t extra = 0;
+				if (!(ok = GetBits(LengthExtra[symbol], extra)))
+					break;
+				m_CopyLength = LengthBase[symbol] + extra;
+
+				if (!(ok = Decode(m_Distances, symbol)))
+					break;
+				if (symbol >= 30)
+				{
+					ok = Fail("Invalid distance code");
+					break;
+				}
+
+				if (!(ok = GetBits(DistanceExtra[symbol], extra)))
+					break;
+				m_CopyDistance = DistanceBase[symbol] + extra;
+				if (m_CopyDistance > m_Total)
+				{
+					ok = Fail("Distance too far back");
+					break;
+				}
+			}
+			break;
+
+		case State::TRAILER:
+			UpdateCheck(buffer + checked, out - checked);
+			checked = out;
+			ok = ReadTrailer();
+			break;
+
+		default:
+			break;
+		}
+
+		if (!ok)
+			return (out > 0) ? (int32_t)out : -1;	// failed next time
+	}
+
+	UpdateCheck(buffer + checked, out - checked);
+	return (int32_t)out;
+}
+
+bool Inflater::Fail(const char *error)
+{
+	if (m_Error.empty())
+		m_Error.assign(error);
+
+	return false;
+}
+
+bool Inflater::Refill(void)
+{
+	if (m_InputEnded)
+		return false;
+
+	int32_t length = m_Source((char*)m_Input.get(), INFLATE_INPUT_SIZE);
+	if (length <= 0)
+	{
+		m_InputEnded = true;
+		return false;
+	}
+
+	m_InputPos = 0;
+	m_InputEnd = length;
+	return true;
+}
+
+bool Inflater::NeedBits(uint32_t count)
+{
+	while (m_BitCount < count)
+	{
+		if (m_InputPos == m_InputEnd && !Refill())
+			return false;
+
+		m_BitBuffer |= (uint64_t)m_Input[m_InputPos++] << m_BitCount;
+		m_BitCount += 8;
+	}
+
+	return true;
+}
+
+bool Inflater::GetBits(uint32_t count, uint32_t &value)
+{
+	if (!NeedBits(count))
+		return Fail("Unexpected end of compressed body");
+
+	value = (uint32_t)(m_BitBuffer & ((1ULL << count) - 1));
+	m_BitBuffer >>= count;
+	m_BitCount -= count;
+	return true;
+}
+
+bool Inflater::Decode(const Huffman &huffman, uint32_t &symbol)
+{
+	// most codes are short enough to resolve with one lookup; there may
+	// be fewer bits than that left at the very end of the data
+	NeedBits(INFLATE_FAST_BITS);
+	uint16_t entry = huffman.fast[m_BitBuffer & ((1 << INFLATE_FAST_BITS) - 1)];
+	if (entry != 0 && (uint32_t)(entry & 15) <= m_BitCount)
+	{
+		symbol = entry >> 4;
+		m_BitBuffer >>= (entry & 15);
+		m_BitCount -= (entry & 15);
+		return true;
+	}
+
+	// walk the canonical code a bit at a time
+	int32_t code = 0;
+	int32_t first = 0;
+	int32_t index = 0;
+	for (uint32_t length = 1; length <= INFLATE_MAX_BITS; length++)
+	{
+		if (!NeedBits(length))
+			return Fail("Unexpected end of compressed body");
+
+		code |= (int32_t)(m_BitBuffer >> (length - 1)) & 1;
+		int32_t count = huffman.counts[length];
+		if (code - count < first)
+		{
+			symbol = huffman.symbols[index + (code - first)];
+			m_BitBuffer >>= length;
+			m_BitCount -= length;
+			return true;
+		}
+
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	return Fail("Invalid Huffman code");
+}
+
+bool Inflater::Build(Huffman &huffman, const uint8_t *lengths, uint32_t count)
+{
+	memset(&huffman, 0, sizeof(huffman));
+	for (uint32_t s = 0; s < count; s++)
+		huffman.counts[lengths[s]]++;
+	huffman.counts[0] = 0;
+
+	// an over-subscribed set of lengths can't be a prefix code
+	int32_t left = 1;
+	for (uint32_t length = 1; length <= INFLATE_MAX_BITS; length++)
+	{
+		left <<= 1;
+		left -= huffman.counts[length];
+		if (left < 0)
+			return Fail("Invalid Huffman code lengths");
+	}
+
+	uint16_t offsets[INFLATE_MAX_BITS + 2] = { 0 };
+	uint32_t next[INFLATE_MAX_BITS + 1] = { 0 };
+	uint32_t code = 0;
+	for (uint32_t length = 1; length <= INFLATE_MAX_BITS; length++)
+	{
+		offsets[length + 1] = offsets[length] + huffman.counts[length];
+		code = (code + huffman.counts[length - 1]) << 1;
+		next[length] = code;
+	}
+
+	for (uint32_t s = 0; s < count; s++)
+	{
+		uint32_t length = lengths[s];
+		if (length == 0)
+			continue;
+
+		huffman.symbols[offsets[length]++] = (uint16_t)s;
+
+		// codes are sent most significant bit first, so the lookup is
+		// indexed by the reversed code, repeated for every longer suffix
+		uint32_t assigned = next[length]++;
+		if (length > INFLATE_FAST_BITS)
+			continue;
+
+		uint32_t reversed = 0;
+		for (uint32_t b = 0; b < length; b++)
+			reversed |= ((assigned >> b) & 1) << (length - 1 - b);
+
+		for (uint32_t i = reversed; i < (1 << INFLATE_FAST_BITS); i += (1 << length))
+			huffman.fast[i] = (uint16_t)((s << 4) | length);
+	}
+
+	return true;
+}
+
+bool Inflater::ReadHeader(void)
+{
+	// the end of the data may only fall between members
+	if (!NeedBits(8))
+	{
+		m_State = State::DONE;
+		return true;
+	}
+
+	uint32_t value = 0;
+	if (m_Format == Format::ZLIB)
+	{
+		uint32_t cmf = 0;
+		if (!GetBits(8, cmf) || !GetBits(8, value))
+			return false;
+
+		if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | value) % 31 != 0)
+			return Fail("Invalid zlib header");
+		if (value & 0x20)
+			return Fail("Preset dictionaries are not supported");
+
+		m_Check = 1;	// Adler-32 starts at one
+	}
+	else
+	{
+		uint32_t id1 = 0, id2 = 0, method = 0, flags = 0;
+		if (!GetBits(8, id1) || !GetBits(8, id2) ||
+			!GetBits(8, method) || !GetBits(8, flags))
+			return false;
+
+		if (id1 != 0x1F || id2 != 0x8B || method != 8)
+			return Fail("Invalid gzip header");
+		if (flags & GZIP_RESERVED)
+			return Fail("Unsupported gzip flags");
+
+		// modification time, extra flags and operating system
+		for (int32_t i = 0; i < 6; i++)
+		{
+			if (!GetBits(8, value))
+				return false;
+		}
+
+		if (flags & GZIP_FEXTRA)
+		{
+			uint32_t length = 0;
+			if (!GetBits(16, length))
+				return false;
+			while (length-- > 0)
+			{
+				if (!GetBits(8, value))
+					return false;
+			}
+		}
+
+		// the zero terminated file name and comment
+		for (uint32_t flag : { GZIP_FNAME, GZIP_FCOMMENT })
+		{
+			if ((flags & flag) == 0)
+				continue;
+			do
+			{
+				if (!GetBits(8, value))
+					return false;
+			} while (value != 0);
+		}
+
+		if ((flags & GZIP_FHCRC) && !GetBits(16, value))
+			return false;
+
+		m_Check = 0;
+	}
+
+	m_Total = 0;
+	m_FinalBlock = false;
+	m_State = State::BLOCK;
+	return true;
+}
+
+bool Inflater::ReadBlockHeader(void)
+{
+	uint32_t final = 0, type = 0;
+	if (!GetBits(1, final) || !GetBits(2, type))
+		return false;
+
+	m_FinalBlock = (final != 0);
+	switch (type)
+	{
+	case 0:
+	{
+		// stored blocks start on a byte boundary
+		m_BitBuffer >>= (m_BitCount & 7);
+		m_BitCount -= (m_BitCount & 7);
+
+		uint32_t length = 0, complement = 0;
+		if (!GetBits(16, length) || !GetBits(16, complement))
+			return false;
+		if (length != (~complement & 0xFFFF))
+			return Fail("Invalid stored block length");
+
+		m_StoredLength = length;
+		m_State = State::STORED;
+		return true;
+	}
+
+	case 1:
+	{
+		uint8_t lengths[288 + 30];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		memset(lengths + 288, 5, 30);
+
+		if (!Build(m_Literals, lengths, 288) ||
+			!Build(m_Distances, lengths + 288, 30))
+			return false;
+
+		m_State = State::HUFFMAN;
+		return true;
+	}
+
+	case 2:
+		if (!ReadTables())
+			return false;
+
+		m_State = State::HUFFMAN;
+		return true;
+
+	default:
+		return Fail("Invalid block type");
+	}
+}
+
+bool Inflater::ReadTables(void)
+{
+	uint32_t literals = 0, distances = 0, codes = 0;
+	if (!GetBits(5, literals) || !GetBits(5, distances) || !GetBits(4, codes))
+		return false;
+
+	literals += 257;
+	distances += 1;
+	codes += 4;
+	if (literals > 286 || distances > 30)
+		return Fail("Invalid code counts");
+
+	uint8_t lengths[288 + 30] = { 0 };
+	for (uint32_t i = 0; i < codes; i++)
+	{
+		uint32_t length = 0;
+		if (!GetBits(3, length))
+			return false;
+		lengths[LengthOrder[i]] = (uint8_t)length;
+	}
+
+	Huffman lengthCodes;
+	if (!Build(lengthCodes, lengths, 19))
+		return false;
+
+	// the literal and distance code lengths form one sequence
+	memset(lengths, 0, sizeof(lengths));
+	uint32_t total = literals + distances;
+	for (uint32_t i = 0; i < total;)
+	{
+		uint32_t symbol = 0;
+		if (!Decode(lengthCodes, symbol))
+			return false;
+
+		if (symbol < 16)
+		{
+			lengths[i++] = (uint8_t)symbol;
+			continue;
+		}
+
+		uint8_t length = 0;
+		uint32_t repeat = 0;
+		if (symbol == 16)
+		{
+			if (i == 0)
+				return Fail("Repeated length with no previous length");
+			length = lengths[i - 1];
+			if (!GetBits(2, repeat))
+				return false;
+			repeat += 3;
+		}
+		else if (symbol == 17)
+		{
+			if (!GetBits(3, repeat))
+				return false;
+			repeat += 3;
+		}
+		else
+		{
+			if (!GetBits(7, repeat))
+				return false;
+			repeat += 11;
+		}
+
+		if (i + repeat > total)
+			return Fail("Too many code lengths");
+		while (repeat-- > 0)
+			lengths[i++] = length;
+	}
+
+	if (lengths[256] == 0)
+		return Fail("Missing end of block code");
+
+	// the distances follow the literals directly in the sequence
+	uint8_t distanceLengths[30];
+	memcpy(distanceLengths, lengths + literals, distances);
+
+	return Build(m_Literals, lengths, literals) &&
+		Build(m_Distances, distanceLengths, distances);
+}
+
+bool Inflater::ReadTrailer(void)
+{
+	// the trailer starts on a byte boundary
+	m_BitBuffer >>= (m_BitCount & 7);
+	m_BitCount -= (m_BitCount & 7);
+
+	uint32_t check = 0;
+	if (m_Format == Format::ZLIB)
+	{
+		// Adler-32, most significant byte first
+		for (int32_t i = 0; i < 4; i++)
+		{
+			uint32_t value = 0;
+			if (!GetBits(8, value))
+				return false;
+			check = (check << 8) | value;
+		}
+
+		if (check != m_Check)
+			return Fail("Adler-32 mismatch");
+
+		m_State = State::DONE;
+		return true;
+	}
+
+	// CRC-32 and the length modulo 2^32, least significant byte first
+	uint32_t size = 0;
+	if (!GetBits(32, check) || !GetBits(32, size))
+		return false;
+
+	if (check != m_Check)
+		return Fail("CRC-32 mismatch");
+	if (size != (uint32_t)m_Total)
+		return Fail("Length mismatch");
+
+	// concatenated members inflate as one body
+	m_State = State::HEADER;
+	return true;
+}
+
+void Inflater::Output(char *buffer, std::size_t &out, uint8_t byte)
+{
+	buffer[out++] = (char)byte;
+	m_Window[m_Total++ & INFLATE_WINDOW_MASK] = byte;
+}
+
+void Inflater::UpdateCheck(const char *data, std::size_t length)
+{
+	const uint8_t *ptr = (const uint8_t*)data;
+	if (m_Format == Format::ZLIB)
+	{
+		uint32_t a = m_Check & 0xFFFF;
+		uint32_t b = m_Check >> 16;
+		while (length > 0)
+		{
+			std::size_t run = std::min(length, (std::size_t)ADLER_MAX_RUN);
+			length -= run;
+			while (run-- > 0)
+			{
+				a += *ptr++;
+				b += a;
+			}
+			a %= ADLER_MOD;
+			b %= ADLER_MOD;
+		}
+		m_Check = (b << 16) | a;
+	}
+	else
+	{
+		const uint32_t (*table)[256] = Crc32Tables();
+		uint32_t crc = ~m_Check;
+		for (; length >= 4; length -= 4, ptr += 4)
+		{
+			crc ^= (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) |
+				((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+			crc = table[3][crc & 0xFF] ^ table[2][(crc >> 8) & 0xFF] ^
+				table[1][(crc >> 16) & 0xFF] ^ table[0][crc >> 24];
+		}
+		while (length-- > 0)
+			crc = table[0][(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+		m_Check = ~crc;
+	}
+}
@@ -0,0 +1,104 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Inflater
+ *
+ * A streaming DEFLATE decoder for gzip and zlib wrapped data. Compressed
+ * input is pulled from a source as it is needed, and each Read produces
+ * as much output as fits in the caller's buffer, so a body of any size is
+ * inflated in a fixed amount of memory (the input buffer and the 32KB
+ * history window).
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+class Inflater
+{
+public:
+	enum class Format
+	{
+		GZIP,
+		ZLIB
+	};
+
+	// reads up to size bytes of compressed input, 0 or less at the end
+	typedef std::function<int32_t(char *buffer, std::size_t size)> Source;
+
+private:
+	enum class State
+	{
+		HEADER,
+		BLOCK,
+		STORED,
+		HUFFMAN,
+		TRAILER,
+		DONE
+	};
+
+	struct Huffman
+	{
+		uint16_t counts[16];	// codes of each length
+		uint16_t symbols[288];	// ordered by code
+		uint16_t fast[512];		// the first 9 bits, symbol << 4 | length
+	};
+
+	Format m_Format;
+	Source m_Source;
+	std::string m_Error;
+
+	std::unique_ptr<uint8_t[]> m_Input;
+	std::size_t m_InputPos;
+	std::size_t m_InputEnd;
+	bool m_InputEnded;
+
+	uint64_t m_BitBuffer;
+	uint32_t m_BitCount;
+
+	std::unique_ptr<uint8_t[]> m_Window;
+	uint64_t m_Total;		// output of the current member
+	uint32_t m_Check;		// its CRC-32 or Adler-32
+
+	State m_State;
+	bool m_FinalBlock;
+	uint32_t m_StoredLength;
+	uint32_t m_CopyLength;
+	uint32_t m_CopyDistance;
+
+	Huffman m_Literals;
+	Huffman m_Distances;
+
+public:
+	Inflater(Format format, const Source &source);
+	~Inflater(void);
+
+	// returns the number of bytes inflated, 0 at the end of the data and
+	// -1 once the data is found to be malformed
+	int32_t Read(char *buffer, std::size_t size);
+
+	const std::string& GetError(void) const { return m_Error; }
+
+private:
+	bool Fail(const char *error);
+
+	bool Refill(void);
+	bool NeedBits(uint32_t count);
+	bool GetBits(uint32_t count, uint32_t &value);
+	bool Decode(const Huffman &huffman, uint32_t &symbol);
+	bool Build(Huffman &huffman, const uint8_t *lengths, uint32_t count);
+
+	bool ReadHeader(void);
+	bool ReadBlockHeader(void);
+	bool ReadTables(void);
+	bool ReadTrailer(void);
+
+	void Output(char *buffer, std::size_t &out, uint8_t byte);
+
+	void UpdateCheck(const char *data, std::size_t length);
+};
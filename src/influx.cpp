@@ -0,0 +1,285 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Influx line protocol parser
+ *
+ */
+
+#include "influx.hpp"
+
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#define MAX_VALUE_LENGTH	63
+
+static bool IsSpace(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static bool Fail(std::string &error, const char *message)
+{
+	error.assign(message);
+	return false;
+}
+
+// copies up to the first unescaped stop character, removing backslash
+// escapes of the stop characters; returns the position of the stop
+static std::size_t ReadToken(std::string_view line, std::size_t pos,
+	const char *stops, std::string &token)
+{
+	token.clear();
+
+	std::size_t start = pos;
+	while (pos < line.length())
+	{
+		char ch = line[pos];
+		if (ch == '\\' && pos + 1 < line.length() &&
+			(strchr(stops, line[pos + 1]) || line[pos + 1] == '\\'))
+		{
+			token.append(line.data() + start, pos - start);
+			start = ++pos;	// keep the escaped character
+			++pos;
+			continue;
+		}
+
+		if (strchr(stops, ch))
+			break;
+		++pos;
+	}
+
+	token.append(line.data() + start, pos - start);
+	return pos;
+}
+
+InfluxParser::InfluxParser(MetricBatch &batch, uint64_t divisor)
+	: m_Batch(batch), m_Divisor(divisor), m_FieldCount(0)
+{
+}
+
+InfluxParser::~InfluxParser(void)
+{
+}
+
+bool InfluxParser::GetDivisor(const char *precision, uint64_t &divisor)
+{
+	if (strcmp(precision, "n") == 0 || strcmp(precision, "ns") == 0)
+		divisor = 1000000000;
+	else if (strcmp(precision, "u") == 0 || strcmp(precision, "us") == 0)
+		divisor = 1000000;
+	else if (strcmp(precision, "ms") == 0)
+		divisor = 1000;
+	else if (strcmp(precision, "s") == 0)
+		divisor = 1;
+	else
+		return false;
+
+	return true;
+}
+
+bool InfluxParser::ParseLine(std::string_view line, std::size_t &points,
+	std::string &error)
+{
+	while (!line.empty() && IsSpace(line.back()))
+		line.remove_suffix(1);
+
+	std::size_t pos = 0;
+	while (pos < line.length() && IsSpace(line[pos]))
+		++pos;
+
+	if (pos == line.length() || line[pos] == '#')
+		return true;	// nothing to store
+
+	pos = ReadToken(line, pos, ", ", m_Measurement);
+	if (m_Measurement.empty())
+		return Fail(error, "Missing measurement");
+
+	// the tag set, in the telnet form; it is made canonical once, below
+	m_Tags.clear();
+	while (pos < line.length() && line[pos] == ',')
+	{
+		pos = ReadToken(line, pos + 1, "=, ", m_Key);
+		if (pos == line.length() || line[pos] != '=')
+			return Fail(error, "Invalid tag");
+
+		pos = ReadToken(line, pos + 1, ", ", m_Value);
+		if (m_Key.empty() || m_Value.empty() ||
+			m_Key.find_first_of(" =") != std::string::npos ||
+			m_Value.find(' ') != std::string::npos)
+			return Fail(error, "Invalid tag");
+
+		if (!m_Tags.empty())
+			m_Tags.append(1, ' ');
+		m_Tags.append(m_Key);
+		m_Tags.append(1, '=');
+		m_Tags.append(m_Value);
+	}
+
+	if (pos == line.length() || line[pos] != ' ')
+		return Fail(error, "Missing fields");
+	while (pos < line.length() && line[pos] == ' ')
+		++pos;
+
+	m_FieldCount = 0;
+	for (;;)
+	{
+		if (!ParseField(line, pos, error))
+			return false;
+
+		if (pos < line.length() && line[pos] == ',')
+		{
+			++pos;
+			continue;
+		}
+		break;
+	}
+
+	while (pos < line.length() && line[pos] == ' ')
+		++pos;
+
+	uint64_t timestamp = 0;
+	if (pos < line.length())
+	{
+		const char *end = line.data() + line.length();
+		std::from_chars_result result = std::from_chars(line.data() + pos, end,
+			timestamp);
+		if (result.ec != std::errc() || result.ptr != end)
+			return Fail(error, "Invalid timestamp");
+
+		timestamp /= m_Divisor;
+	}
+	else
+		timestamp = time(nullptr);	// the server's time, as Influx does
+
+	if (m_FieldCount == 0)
+		return true;	// only string fields
+
+	// every field is resolved before any point is added, so a line that
+	// fails adds nothing; a field past the series limits is dropped, the
+	// others are still kept
+	Point point;
+	point.timestamp = timestamp;
+	std::size_t added = 0;
+
+	m_Name.assign(m_Measurement);
+	m_Name.append(1, '.');
+	for (std::size_t f = 0; f < m_FieldCount; f++)
+	{
+		Field &field = m_Fields[f];
+		m_Name.resize(m_Measurement.length() + 1);
+		m_Name.append(field.key);
+
+		// the series is checked against the limits of each field's metric
+		bool overLimit = false;
+		field.dropped = false;
+		if (!m_Batch.GetMetric(m_Name, field.metric, error, &overLimit) ||
+			!m_Batch.GetSeries(field.metric, m_Tags, point.series, error,
+				&overLimit))
+		{
+			if (!overLimit)
+				return false;
+			field.dropped = true;
+		}
+	}
+
+	for (std::size_t f = 0; f < m_FieldCount; f++)
+	{
+		if (m_Fields[f].dropped)
+			continue;
+
+		point.metric = m_Fields[f].metric;
+		point.value = m_Fields[f].value;
+		m_Batch.Add(point);
+		++added;
+	}
+
+	if (added == 0)
+		return false;	// every field was past the limits
+
+	points += added;
+	return true;
+}
+
+bool InfluxParser::ParseField(std::string_view line, std::size_t &pos,
+	std::string &error)
+{
+	if (m_Fields.size() == m_FieldCount)
+		m_Fields.resize(m_FieldCount + 1);
+	Field &field = m_Fields[m_FieldCount];
+
+	pos = ReadToken(line, pos, "=, ", field.key);
+	if (field.key.empty() || pos == line.length() || line[pos] != '=')
+		return Fail(error, "Invalid field");
+	++pos;
+
+	if (pos < line.length() && line[pos] == '"')
+	{
+		// a string, which has no numeric value to keep
+		for (++pos; pos < line.length() && line[pos] != '"'; ++pos)
+		{
+			if (line[pos] == '\\')
+				++pos;
+		}
+
+		if (pos >= line.length())
+			return Fail(error, "Unterminated string field");
+		++pos;
+		return true;
+	}
+
+	std::size_t start = pos;
+	while (pos < line.length() && line[pos] != ',' && line[pos] != ' ')
+		++pos;
+
+	std::string_view value = line.substr(start, pos - start);
+	if (value.empty())
+		return Fail(error, "Invalid field value");
+
+	if (value == "t" || value == "T" || value == "true" ||
+		value == "True" || value == "TRUE")
+		field.value = 1;
+	else if (value == "f" || value == "F" || value == "false" ||
+		value == "False" || value == "FALSE")
+		field.value = 0;
+	else if (value.back() == 'i' || value.back() == 'u')
+	{
+		// integers carry a type suffix
+		const char *end = value.data() + value.length() - 1;
+		std::from_chars_result result;
+		if (value.back() == 'i')
+		{
+			int64_t integer = 0;
+			result = std::from_chars(value.data(), end, integer);
+			field.value = (double)integer;
+		}
+		else
+		{
+			uint64_t integer = 0;
+			result = std::from_chars(value.data(), end, integer);
+			field.value = (double)integer;
+		}
+
+		if (result.ec != std::errc() || result.ptr != end)
+			return Fail(error, "Invalid integer field");
+	}
+	else
+	{
+		// strtod needs a terminated string, values are short
+		char number[MAX_VALUE_LENGTH + 1];
+		if (value.length() > MAX_VALUE_LENGTH)
+			return Fail(error, "Invalid field value");
+
+		memcpy(number, value.data(), value.length());
+		number[value.length()] = 0;
+
+		char *end = nullptr;
+		field.value = strtod(number, &end);
+		if (end == number || *end)
+			return Fail(error, "Invalid field value");
+	}
+
+	++m_FieldCount;
+	return true;
+}
@@ -0,0 +1,66 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Influx line protocol parser
+ *
+ * Each line holds a measurement, a tag set, one or more fields and an
+ * optional timestamp:
+ *
+ *	cpu,host=web01,dc=lga usage_idle=92.5,usage_user=3.1 1465839830100400200
+ *
+ * and becomes one data point per numeric field, named
+ * <measurement>.<field>. The tag set is parsed and made canonical once
+ * per line, and every field's point shares it; string fields are
+ * skipped and booleans are stored as 1 or 0.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "datastore.hpp"
+
+class InfluxParser
+{
+private:
+	struct Field
+	{
+		std::string key;
+		double value;
+
+		uint32_t metric;
+		bool dropped;	// past the series limits
+	};
+
+	MetricBatch &m_Batch;
+	uint64_t m_Divisor;		// timestamp units per second
+
+	// reused from line to line
+	std::string m_Measurement;
+	std::string m_Key;
+	std::string m_Value;
+	std::string m_Tags;
+	std::string m_Name;
+	std::vector<Field> m_Fields;
+	std::size_t m_FieldCount;
+
+public:
+	InfluxParser(MetricBatch &batch, uint64_t divisor);
+	~InfluxParser(void);
+
+	// the divisor for a precision of n/ns, u/us, ms or s
+	static bool GetDivisor(const char *precision, uint64_t &divisor);
+
+	// false if the line is malformed; comments and blank lines are skipped
+	bool ParseLine(std::string_view line, std::size_t &points,
+		std::string &error);
+
+private:
+	bool ParseField(std::string_view line, std::size_t &pos,
+		std::string &error);
+};
@@ -0,0 +1,177 @@
+/*
+ * Simple Time-Series Database
+ *
+ * String interning
+ *
+ */
+
+#include "intern.hpp"
+
+#include <functional>
+
+#define INTERN_INITIAL_SLOTS	1024
+#define INTERN_CHUNK_SIZE		(1 << INTERN_CHUNK_BITS)
+
+InternTable::Slots::Slots(std::size_t capacity)
+	: mask(capacity - 1), slots(new std::atomic<const Entry*>[capacity])
+{
+	for (std::size_t s = 0; s < capacity; s++)
+		slots[s].store(nullptr, std::memory_order_relaxed);
+}
+
+InternTable::InternTable(void)
+	: m_Chunks(new std::atomic<const Entry**>[INTERN_MAX_CHUNKS]), m_Count(0),
+	m_Aliases(0)
+{
+	for (std::size_t c = 0; c < INTERN_MAX_CHUNKS; c++)
+		m_Chunks[c].store(nullptr, std::memory_order_relaxed);
+
+	m_Tables.emplace_back(new Slots(INTERN_INITIAL_SLOTS));
+	m_Slots.store(m_Tables.back().get(), std::memory_order_release);
+}
+
+InternTable::~InternTable(void)
+{
+	for (std::size_t c = 0; c < INTERN_MAX_CHUNKS; c++)
+		delete[] m_Chunks[c].load(std::memory_order_relaxed);
+}
+
+bool InternTable::Find(std::string_view str, uint32_t &id) const
+{
+	const Entry *entry = Probe(m_Slots.load(std::memory_order_acquire), str,
+		std::hash<std::string_view>()(str));
+	if (entry == nullptr)
+		return false;
+
+	id = entry->id;
+	return true;
+}
+
+bool InternTable::Intern(std::string_view str, uint32_t &id)
+{
+	std::size_t hash = std::hash<std::string_view>()(str);
+	const Entry *entry = Probe(m_Slots.load(std::memory_order_acquire), str, hash);
+	if (entry)
+	{
+		id = entry->id;
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	// another thread may have added it in between
+	entry = Probe(m_Slots.load(std::memory_order_relaxed), str, hash);
+	if (entry)
+	{
+		id = entry->id;
+		return true;
+	}
+
+	id = m_Count.load(std::memory_order_relaxed);
+	if (id >= INTERN_MAX_IDS)
+		return false;
+
+	std::size_t chunk = id >> INTERN_CHUNK_BITS;
+
+	const Entry **entries = m_Chunks[chunk].load(std::memory_order_relaxed);
+	if (entries == nullptr)
+	{
+		entries = new const Entry*[INTERN_CHUNK_SIZE];
+		m_Chunks[chunk].store(entries, std::memory_order_release);
+	}
+
+	m_Entries.emplace_back(hash, id, str);
+	entries[id & (INTERN_CHUNK_SIZE - 1)] = &m_Entries.back();
+
+	// IDs reach other threads through the queue or the hash table, both
+	// of which publish the entry first
+	m_Count.store(id + 1, std::memory_order_release);
+	Insert(&m_Entries.back());
+	return true;
+}
+
+bool InternTable::AddAlias(std::string_view alias, uint32_t id)
+{
+	std::size_t hash = std::hash<std::string_view>()(alias);
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (Probe(m_Slots.load(std::memory_order_relaxed), alias, hash))
+		return true;
+
+	if (m_Aliases >= INTERN_MAX_ALIASES)
+		return false;
+
+	m_Entries.emplace_back(hash, id, alias);
+	m_Aliases++;
+	Insert(&m_Entries.back());
+	return true;
+}
+
+const std::string& InternTable::Get(uint32_t id) const
+{
+	const Entry **entries = m_Chunks[id >> INTERN_CHUNK_BITS].load(
+		std::memory_order_acquire);
+	return entries[id & (INTERN_CHUNK_SIZE - 1)]->str;
+}
+
+void InternTable::SetData(uint32_t id, void *data)
+{
+	const Entry **entries = m_Chunks[id >> INTERN_CHUNK_BITS].load(
+		std::memory_order_acquire);
+	entries[id & (INTERN_CHUNK_SIZE - 1)]->data.store(data,
+		std::memory_order_release);
+}
+
+void* InternTable::GetData(uint32_t id) const
+{
+	const Entry **entries = m_Chunks[id >> INTERN_CHUNK_BITS].load(
+		std::memory_order_acquire);
+	return entries[id & (INTERN_CHUNK_SIZE - 1)]->data.load(
+		std::memory_order_acquire);
+}
+
+const InternTable::Entry* InternTable::Probe(const Slots *table,
+	std::string_view str, std::size_t hash) const
+{
+	for (std::size_t s = hash & table->mask; ; s = (s + 1) & table->mask)
+	{
+		const Entry *entry = table->slots[s].load(std::memory_order_acquire);
+		if (entry == nullptr)
+			return nullptr;
+
+		if (entry->hash == hash && entry->str == str)
+			return entry;
+	}
+}
+
+void InternTable::Insert(const Entry *entry)
+{
+	Slots *table = m_Slots.load(std::memory_order_relaxed);
+
+	// kept at most half full; a bigger table is filled before it is
+	// published, and the old one stays readable
+	if (m_Entries.size() * 2 > table->mask + 1)
+	{
+		Slots *grown = new Slots((table->mask + 1) * 2);
+		for (std::deque<Entry>::const_iterator existing = m_Entries.begin();
+			existing != m_Entries.end(); ++existing)
+		{
+			if (&*existing == entry)
+				continue;	// added below, with the table published
+
+			std::size_t s = existing->hash & grown->mask;
+			while (grown->slots[s].load(std::memory_order_relaxed) != nullptr)
+				s = (s + 1) & grown->mask;
+			grown->slots[s].store(&*existing, std::memory_order_relaxed);
+		}
+
+		m_Tables.emplace_back(grown);
+		m_Slots.store(grown, std::memory_order_release);
+		table = grown;
+	}
+
+	std::size_t s = entry->hash & table->mask;
+	while (table->slots[s].load(std::memory_order_relaxed) != nullptr)
+		s = (s + 1) & table->mask;
+	table->slots[s].store(entry, std::memory_order_release);
+}
@@ -0,0 +1,103 @@
+/*
+ * Simple Time-Series Database
+ *
+ * String interning
+ *
+ * Maps strings to dense IDs, starting at 0, and back. A string keeps its
+ * ID, and its storage, for the life of the table, so the reference
+ * returned for an ID stays valid.
+ *
+ * Lookups never lock: the hash table is open addressed with atomic
+ * slots, and when it grows the new table is published whole while the
+ * old one is kept for readers still probing it. Only adding a string
+ * takes the lock. An alias maps another string to an existing ID, such
+ * as a tag set in the order a client sent it to the ID of its canonical
+ * form.
+ *
+ * The table is bounded: past INTERN_MAX_IDS strings nothing new is
+ * added, and aliases stop at INTERN_MAX_ALIASES. Callers turn a refusal
+ * into an error for the line that needed the new ID.
+ *
+ * Each ID can also carry a pointer for the table's user, such as the
+ * state of a metric, which is read without locking too.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define INTERN_CHUNK_BITS	16		// IDs per chunk, as a power of two
+#define INTERN_MAX_CHUNKS	4096	// so at most 2^28 IDs
+#define INTERN_MAX_IDS		(INTERN_MAX_CHUNKS << INTERN_CHUNK_BITS)
+#define INTERN_MAX_ALIASES	(1 << 20)
+
+class InternTable
+{
+private:
+	struct Entry
+	{
+		std::size_t hash;
+		uint32_t id;
+		std::string str;
+		mutable std::atomic<void*> data;
+
+		Entry(std::size_t h, uint32_t i, std::string_view s)
+			: hash(h), id(i), str(s), data(nullptr) {}
+	};
+
+	struct Slots
+	{
+		std::size_t mask;
+		std::unique_ptr<std::atomic<const Entry*>[]> slots;
+
+		Slots(std::size_t capacity);
+	};
+
+	std::atomic<Slots*> m_Slots;
+	std::vector<std::unique_ptr<Slots> > m_Tables;	// every generation
+
+	// the entries by ID, in chunks that never move
+	std::unique_ptr<std::atomic<const Entry**>[]> m_Chunks;
+	std::atomic<uint32_t> m_Count;
+	std::size_t m_Aliases;
+
+	std::deque<Entry> m_Entries;	// strings and aliases, never moved
+	std::mutex m_Lock;				// taken to add an entry
+
+public:
+	InternTable(void);
+	~InternTable(void);
+
+	bool Find(std::string_view str, uint32_t &id) const;
+
+	// finds the ID of the string, adding it if it is new; false when it
+	// is new and the table is full
+	bool Intern(std::string_view str, uint32_t &id);
+
+	// makes alias another name for an ID, unless it is already known;
+	// false when there is no room for more aliases
+	bool AddAlias(std::string_view alias, uint32_t id);
+
+	const std::string& Get(uint32_t id) const;
+
+	// the pointer kept with an ID, null until it is set
+	void SetData(uint32_t id, void *data);
+	void* GetData(uint32_t id) const;
+	std::size_t GetCount(void) const { return m_Count.load(std::memory_order_acquire); }
+
+private:
+	InternTable(const InternTable&);
+	void operator = (const InternTable&);
+
+	const Entry* Probe(const Slots *table, std::string_view str,
+		std::size_t hash) const;
+	void Insert(const Entry *entry);
+};
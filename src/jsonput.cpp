@@ -0,0 +1,479 @@
+/*
+ * Simple Time-Series Database
+ *
+ * JSON put parser
+ *
+ */
+
+#include "jsonput.hpp"
+
+#include <cstdlib>
+#include <utility>
+
+#define MAX_TOKEN_LENGTH	65536
+#define MAX_SECONDS			9999999999ULL	// larger timestamps are in ms
+
+static bool IsWhitespace(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static bool IsNumberChar(char ch)
+{
+	return (ch >= '0' && ch <= '9') || ch == '-' || ch == '+' ||
+		ch == '.' || ch == 'e' || ch == 'E';
+}
+
+static int32_t HexValue(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+
+	return -1;
+}
+
+JsonPutParser::JsonPutParser(MetricBatch &batch)
+	: m_Batch(batch), m_Count(0), m_Expect(Expect::VALUE), m_First(true),
+	  m_Lexeme(Lexeme::NONE), m_IsKey(false), m_Unicode(0),
+	  m_UnicodeDigits(0), m_Surrogate(0), m_PointDepth(0),
+	  m_Field(Field::OTHER), m_Timestamp(0), m_Value(0),
+	  m_HasTimestamp(false), m_HasValue(false)
+{
+}
+
+JsonPutParser::~JsonPutParser(void)
+{
+}
+
+bool JsonPutParser::Parse(const char *data, std::size_t length)
+{
+	const char *ptr = data;
+	const char *end = data + length;
+	while (ptr < end && m_Error.empty())
+	{
+		if (m_Lexeme != Lexeme::NONE)
+			Lex(ptr, end);
+		else if (IsWhitespace(*ptr))
+			++ptr;
+		else
+			Structural(*ptr++);
+	}
+
+	return m_Error.empty();
+}
+
+bool JsonPutParser::Finish(void)
+{
+	if (!m_Error.empty())
+		return false;
+
+	if (m_Lexeme == Lexeme::NUMBER || m_Lexeme == Lexeme::LITERAL)
+		EndToken();
+
+	if (m_Error.empty() && m_Expect != Expect::DONE)
+		return Fail("Unexpected end of body");
+
+	return m_Error.empty();
+}
+
+bool JsonPutParser::Fail(const char *error)
+{
+	if (m_Error.empty())
+		m_Error.assign(error);
+
+	return false;
+}
+
+bool JsonPutParser::Structural(char ch)
+{
+	switch (m_Expect)
+	{
+	case Expect::VALUE:
+		if (ch == '{' || ch == '[')
+			return OnBeginContainer(ch);
+		if (ch == ']' && m_First && !m_Stack.empty() && m_Stack.back() == '[')
+			return OnEndContainer();
+		if (ch == '"')
+		{
+			m_Lexeme = Lexeme::STRING;
+			m_IsKey = false;
+			m_Token.clear();
+			return true;
+		}
+		if (ch == '-' || (ch >= '0' && ch <= '9'))
+		{
+			m_Lexeme = Lexeme::NUMBER;
+			m_Token.assign(1, ch);
+			return true;
+		}
+		if (ch >= 'a' && ch <= 'z')
+		{
+			m_Lexeme = Lexeme::LITERAL;
+			m_Token.assign(1, ch);
+			return true;
+		}
+		return Fail("Expected a value");
+
+	case Expect::KEY:
+		if (ch == '"')
+		{
+			m_Lexeme = Lexeme::STRING;
+			m_IsKey = true;
+			m_Token.clear();
+			return true;
+		}
+		if (ch == '}' && m_First)
+			return OnEndContainer();
+		return Fail("Expected a key");
+
+	case Expect::COLON:
+		if (ch != ':')
+			return Fail("Expected ':'");
+		m_Expect = Expect::VALUE;
+		m_First = false;
+		return true;
+
+	case Expect::NEXT:
+		if (ch == ',')
+		{
+			m_Expect = (m_Stack.back() == '{') ? Expect::KEY : Expect::VALUE;
+			m_First = false;
+			return true;
+		}
+		if ((ch == '}' && m_Stack.back() == '{') ||
+			(ch == ']' && m_Stack.back() == '['))
+			return OnEndContainer();
+		return Fail("Expected ',' or the end of a container");
+
+	case Expect::DONE:
+	default:
+		return Fail("Unexpected data after the body");
+	}
+}
+
+bool JsonPutParser::Lex(const char *&ptr, const char *end)
+{
+	while (ptr < end)
+	{
+		char ch = *ptr;
+		switch (m_Lexeme)
+		{
+		case Lexeme::STRING:
+		{
+			// copy the plain run in one go
+			const char *start = ptr;
+			while (ptr < end && *ptr != '"' && *ptr != '\\' &&
+				(unsigned char)*ptr >= 0x20)
+				++ptr;
+			m_Token.append(start, ptr - start);
+
+			if (m_Token.length() > MAX_TOKEN_LENGTH)
+				return Fail("String too long");
+			if (ptr == end)
+				return true;
+
+			ch = *ptr++;
+			if (ch == '"')
+				return EndToken();
+			if (ch == '\\')
+			{
+				m_Lexeme = Lexeme::ESCAPE;
+				break;
+			}
+			return Fail("Control character in string");
+		}
+
+		case Lexeme::ESCAPE:
+			++ptr;
+			m_Lexeme = Lexeme::STRING;
+			switch (ch)
+			{
+			case '"': case '\\': case '/':
+				m_Token.append(1, ch);
+				break;
+			case 'b': m_Token.append(1, '\b'); break;
+			case 'f': m_Token.append(1, '\f'); break;
+			case 'n': m_Token.append(1, '\n'); break;
+			case 'r': m_Token.append(1, '\r'); break;
+			case 't': m_Token.append(1, '\t'); break;
+			case 'u':
+				m_Lexeme = Lexeme::UNICODE;
+				m_Unicode = 0;
+				m_UnicodeDigits = 0;
+				break;
+			default:
+				return Fail("Invalid escape in string");
+			}
+			break;
+
+		case Lexeme::UNICODE:
+		{
+			++ptr;
+			int32_t digit = HexValue(ch);
+			if (digit < 0)
+				return Fail("Invalid unicode escape in string");
+
+			m_Unicode = (m_Unicode << 4) | digit;
+			if (++m_UnicodeDigits < 4)
+				break;
+
+			m_Lexeme = Lexeme::STRING;
+			if (m_Unicode >= 0xD800 && m_Unicode <= 0xDBFF)
+			{
+				// the high half, the low half comes in the next escape
+				if (m_Surrogate != 0)
+					AppendUtf8(0xFFFD);
+				m_Surrogate = m_Unicode;
+			}
+			else if (m_Unicode >= 0xDC00 && m_Unicode <= 0xDFFF && m_Surrogate != 0)
+			{
+				AppendUtf8(0x10000 + ((m_Surrogate - 0xD800) << 10) +
+					(m_Unicode - 0xDC00));
+				m_Surrogate = 0;
+			}
+			else
+			{
+				if (m_Surrogate != 0)
+					AppendUtf8(0xFFFD);
+				m_Surrogate = 0;
+				AppendUtf8(m_Unicode);
+			}
+			break;
+		}
+
+		case Lexeme::NUMBER:
+		case Lexeme::LITERAL:
+		{
+			const char *start = ptr;
+			if (m_Lexeme == Lexeme::NUMBER)
+			{
+				while (ptr < end && IsNumberChar(*ptr))
+					++ptr;
+			}
+			else
+			{
+				while (ptr < end && *ptr >= 'a' && *ptr <= 'z')
+					++ptr;
+			}
+			m_Token.append(start, ptr - start);
+
+			if (m_Token.length() > MAX_TOKEN_LENGTH)
+				return Fail("Value too long");
+			if (ptr == end)
+				return true;	// may continue in the next piece
+
+			// the terminating character is structural, leave it
+			return EndToken();
+		}
+
+		default:
+			return true;
+		}
+	}
+
+	return true;
+}
+
+bool JsonPutParser::EndToken(void)
+{
+	Lexeme lexeme = m_Lexeme;
+	m_Lexeme = Lexeme::NONE;
+
+	switch (lexeme)
+	{
+	case Lexeme::STRING:
+		if (m_Surrogate != 0)
+		{
+			AppendUtf8(0xFFFD);
+			m_Surrogate = 0;
+		}
+
+		if (m_IsKey)
+		{
+			m_Expect = Expect::COLON;
+			return OnKey();
+		}
+		return OnString() && OnValueEnd();
+
+	case Lexeme::NUMBER:
+		return OnNumber() && OnValueEnd();
+
+	case Lexeme::LITERAL:
+		if (m_Token != "true" && m_Token != "false" && m_Token != "null")
+			return Fail("Invalid literal");
+
+		// no data point field is a boolean or null
+		if (m_Stack.size() == m_PointDepth && m_Field != Field::OTHER &&
+			m_Field != Field::TAGS)
+			return Fail("Invalid data point field");
+		return OnValueEnd();
+
+	default:
+		return true;
+	}
+}
+
+void JsonPutParser::AppendUtf8(uint32_t code)
+{
+	if (code < 0x80)
+		m_Token.append(1, (char)code);
+	else if (code < 0x800)
+	{
+		m_Token.append(1, (char)(0xC0 | (code >> 6)));
+		m_Token.append(1, (char)(0x80 | (code & 0x3F)));
+	}
+	else if (code < 0x10000)
+	{
+		m_Token.append(1, (char)(0xE0 | (code >> 12)));
+		m_Token.append(1, (char)(0x80 | ((code >> 6) & 0x3F)));
+		m_Token.append(1, (char)(0x80 | (code & 0x3F)));
+	}
+	else
+	{
+		m_Token.append(1, (char)(0xF0 | (code >> 18)));
+		m_Token.append(1, (char)(0x80 | ((code >> 12) & 0x3F)));
+		m_Token.append(1, (char)(0x80 | ((code >> 6) & 0x3F)));
+		m_Token.append(1, (char)(0x80 | (code & 0x3F)));
+	}
+}
+
+bool JsonPutParser::OnBeginContainer(char type)
+{
+	m_Stack.push_back(type);
+	m_Expect = (type == '{') ? Expect::KEY : Expect::VALUE;
+	m_First = true;
+
+	std::size_t depth = m_Stack.size();
+	if (depth == 1)
+	{
+		// a single data point, or an array of them
+		m_PointDepth = (type == '[') ? 2 : 1;
+	}
+
+	if (depth == m_PointDepth)
+	{
+		if (type != '{')
+			return Fail("A data point must be an object");
+
+		m_Field = Field::OTHER;
+		m_Name.clear();
+		m_Tags.clear();
+		m_HasTimestamp = false;
+		m_HasValue = false;
+	}
+	else if (depth == m_PointDepth + 1 && m_Field == Field::TAGS && type != '{')
+		return Fail("Tags must be an object");
+
+	return true;
+}
+
+bool JsonPutParser::OnEndContainer(void)
+{
+	if (m_Stack.size() == m_PointDepth)
+	{
+		if (m_Name.empty() || !m_HasTimestamp || !m_HasValue)
+			return Fail("A data point needs a metric, timestamp and value");
+
+		if (!m_Batch.Add(m_Name, m_Timestamp, m_Value, m_Tags, m_Error))
+			return false;
+
+		++m_Count;
+	}
+
+	m_Stack.pop_back();
+	return OnValueEnd();
+}
+
+bool JsonPutParser::OnKey(void)
+{
+	std::size_t depth = m_Stack.size();
+	if (depth == m_PointDepth)
+	{
+		// resolve the field once rather than on every value
+		if (m_Token == "metric")
+			m_Field = Field::METRIC;
+		else if (m_Token == "timestamp")
+			m_Field = Field::TIMESTAMP;
+		else if (m_Token == "value")
+			m_Field = Field::VALUE;
+		else if (m_Token == "tags")
+			m_Field = Field::TAGS;
+		else
+			m_Field = Field::OTHER;
+	}
+	else if (depth == m_PointDepth + 1 && m_Field == Field::TAGS)
+		m_TagKey.swap(m_Token);
+
+	return true;
+}
+
+bool JsonPutParser::OnString(void)
+{
+	std::size_t depth = m_Stack.size();
+	if (depth == 0)
+		return Fail("Expected an array or object");
+
+	if (depth == m_PointDepth)
+	{
+		if (m_Field == Field::METRIC)
+			m_Name.swap(m_Token);
+		else if (m_Field == Field::TIMESTAMP || m_Field == Field::VALUE)
+			return OnNumber();	// numbers may be sent as strings
+	}
+	else if (depth == m_PointDepth + 1 && m_Field == Field::TAGS)
+	{
+		if (!m_Tags.empty())
+			m_Tags.append(1, ' ');
+		m_Tags.append(m_TagKey);
+		m_Tags.append(1, '=');
+		m_Tags.append(m_Token);
+	}
+
+	return true;
+}
+
+bool JsonPutParser::OnNumber(void)
+{
+	std::size_t depth = m_Stack.size();
+	if (depth == 0)
+		return Fail("Expected an array or object");
+
+	if (depth == m_PointDepth)
+	{
+		char *end = nullptr;
+		if (m_Field == Field::TIMESTAMP)
+		{
+			m_Timestamp = strtoull(m_Token.c_str(), &end, 10);
+			if (end == m_Token.c_str() || *end)
+				return Fail("Invalid timestamp");
+
+			if (m_Timestamp > MAX_SECONDS)
+				m_Timestamp /= 1000;
+			m_HasTimestamp = true;
+		}
+		else if (m_Field == Field::VALUE)
+		{
+			m_Value = strtod(m_Token.c_str(), &end);
+			if (end == m_Token.c_str() || *end)
+				return Fail("Invalid value");
+
+			m_HasValue = true;
+		}
+		else if (m_Field == Field::METRIC)
+			return Fail("Invalid metric name");
+	}
+	else if (depth == m_PointDepth + 1 && m_Field == Field::TAGS)
+		return OnString();
+
+	return true;
+}
+
+bool JsonPutParser::OnValueEnd(void)
+{
+	m_Expect = m_Stack.empty() ? Expect::DONE : Expect::NEXT;
+	return true;
+}
@@ -0,0 +1,111 @@
+/*
+ * Simple Time-Series Database
+ *
+ * JSON put parser
+ *
+ * An incremental parser for OpenTSDB's JSON put format: a single data
+ * point object, or an array of them.
+ *
+ *	[{"metric": "sys.cpu.nice", "timestamp": 1346846400, "value": 18,
+ *	  "tags": {"host": "web01", "dc": "lga"}}, ...]
+ *
+ * The body is fed in as it is received, in pieces of any size, and each
+ * data point goes straight into a batch as soon as its object closes.
+ * Only the token being read is buffered, never a document tree.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "datastore.hpp"
+
+class JsonPutParser
+{
+private:
+	enum class Expect
+	{
+		VALUE,		// any value, or ']' straight after '['
+		KEY,		// a key, or '}' straight after '{'
+		COLON,
+		NEXT,		// ',' or the end of the container
+		DONE
+	};
+
+	enum class Lexeme
+	{
+		NONE,
+		STRING,
+		ESCAPE,
+		UNICODE,
+		NUMBER,
+		LITERAL
+	};
+
+	enum class Field
+	{
+		OTHER,
+		METRIC,
+		TIMESTAMP,
+		VALUE,
+		TAGS
+	};
+
+	MetricBatch &m_Batch;
+	std::size_t m_Count;
+	std::string m_Error;
+
+	Expect m_Expect;
+	bool m_First;				// nothing read yet in the open container
+	std::vector<char> m_Stack;	// the open containers, '[' or '{'
+
+	Lexeme m_Lexeme;
+	bool m_IsKey;
+	std::string m_Token;
+	uint32_t m_Unicode;
+	int32_t m_UnicodeDigits;
+	uint32_t m_Surrogate;
+
+	// the data point being read
+	std::size_t m_PointDepth;
+	Field m_Field;				// the data point field being read
+	std::string m_TagKey;
+	std::string m_Name;
+	uint64_t m_Timestamp;
+	double m_Value;
+	std::string m_Tags;
+	bool m_HasTimestamp;
+	bool m_HasValue;
+
+public:
+	JsonPutParser(MetricBatch &batch);
+	~JsonPutParser(void);
+
+	// false once the body is malformed or holds an invalid data point
+	bool Parse(const char *data, std::size_t length);
+
+	// false if the body ended early
+	bool Finish(void);
+
+	std::size_t GetCount(void) const { return m_Count; }
+	const std::string& GetError(void) const { return m_Error; }
+
+private:
+	bool Fail(const char *error);
+	bool Structural(char ch);
+	bool Lex(const char *&ptr, const char *end);
+	bool EndToken(void);
+
+	void AppendUtf8(uint32_t code);
+
+	bool OnBeginContainer(char type);
+	bool OnEndContainer(void);
+	bool OnKey(void);
+	bool OnString(void);
+	bool OnNumber(void);
+	bool OnValueEnd(void);
+};
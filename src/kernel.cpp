@@ -6,6 +6,10 @@
  */
 
 #include "kernel.hpp"
+#include "utility.hpp"
+#include "vfs.hpp"
+
+#include <sstream>
 
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/basic_file_sink.h"
@@ -18,6 +22,9 @@
 #define PATH_SEP	"/"
 #endif
 
+// large pages leave room for whole filesystem blocks to be freed
+#define COMPRESSED_PAGE_SIZE	65536
+
 #if defined(_DEBUG) || defined(DEBUG)
 #define DEFAULT_LOG_LEVEL	"debug"
 #else
@@ -29,6 +36,31 @@ void sqliteErrorCallback(void *arg, int32_t code, const char *msg)
 	spdlog::warn("sqlite error: {0} ({1})", msg, code);
 }
 
+// segments in the data directory are the hot ones, so the cold tier must
+// be a directory of its own; one inside the data directory is rejected too
+static bool CheckColdDir(const std::string &dataDir, const std::string &coldDir)
+{
+	std::string data, cold;
+	if (!GetCanonicalPath(dataDir, data) || !GetCanonicalPath(coldDir, cold))
+	{
+		spdlog::error("Cold data directory {0} doesn't exist, segments stay in {1}",
+			coldDir.c_str(), dataDir.c_str());
+		return false;
+	}
+
+	if (data.back() != PATH_SEP[0])
+		data.append(PATH_SEP);
+	cold.append(PATH_SEP);
+	if (cold.compare(0, data.length(), data) == 0)
+	{
+		spdlog::error("Cold data directory {0} is the data directory {1} or inside it, segments stay there",
+			coldDir.c_str(), dataDir.c_str());
+		return false;
+	}
+
+	return true;
+}
+
 Kernel::Kernel(std::vector<std::string> &args,
 	const std::string &logdir, const std::string &datadir,
 	const std::string &hostname)
@@ -37,6 +69,7 @@ Kernel::Kernel(std::vector<std::string> &args,
 	m_Stats = nullptr;
 	m_Net = nullptr;
 	m_DataStore = nullptr;
+	m_Mover = nullptr;
 
 	try
 	{
@@ -98,18 +131,71 @@ Kernel::Kernel(std::vector<std::string> &args,
 	if (m_Stats == nullptr)
 		throw std::runtime_error("Failed to create statistics monitor");
 
+	m_Stats->ConfigureSelfMetrics(m_Config->Get("stsdb", "hostname", hostname),
+		m_Config->GetInteger("stsdbd", "self_metrics_retention", 86400));
+
 	// create the datastore
 	m_DataStore = new Datastore(m_DataDir, 
-		m_Config->Get("stsdbd", "dbext", "tsdb"),
-		m_Config->Get("stsdb", "hostname", hostname), m_Stats);
+		m_Config->Get("stsdbd", "dbext", "tsdb"), m_Stats);
 	if (m_DataStore == nullptr)
 		throw std::runtime_error("Failed to create datastore");
 
+	m_DataStore->ConfigureSelfMetrics(
+		m_Config->GetInteger("stsdbd", "self_metrics_persist", 60));
+
+	// databases are always opened through the compressing VFS, so pages
+	// compressed earlier stay readable if compression is turned off
+	std::string compression = m_Config->Get("stsdbd", "compression", "none");
+	bool compress = (compression == "lz4");
+	if (!compress && compression != "none")
+		spdlog::warn("Unknown compression {0}, pages are stored uncompressed",
+			compression.c_str());
+
+	if (RegisterCompressedVfs(compress))
+		m_DataStore->ConfigureVfs(STSDB_VFS_NAME, compress ? COMPRESSED_PAGE_SIZE : 0);
+	else if (compress)
+		spdlog::warn("Page compression is unavailable");
+
+	std::string seriesAction = m_Config->Get("stsdbd", "series_limit_action", "reject");
+	if (seriesAction != "reject" && seriesAction != "count")
+		spdlog::warn("Unknown series limit action {0}, rejecting", seriesAction.c_str());
+	m_DataStore->ConfigureSeriesLimits(
+		m_Config->GetInteger("stsdbd", "series_limit_metric", 0),
+		m_Config->GetInteger("stsdbd", "series_limit_total", 0),
+		seriesAction != "count");
+
+	m_DataStore->ConfigureSegments(
+		m_Config->GetInteger("stsdbd", "seal_after", 0),
+		m_Config->GetInteger("stsdbd", "segment_span", 86400));
+
+	// move aged segments to the cold tier, if there is one
+	std::string coldDir = m_Config->Get("stsdbd", "cold_datapath", "");
+	if (!coldDir.empty() && !CheckColdDir(m_DataDir, coldDir))
+		coldDir.clear();
+
+	if (!coldDir.empty())
+	{
+		m_DataStore->ConfigureColdStorage(coldDir);
+
+		m_Mover = new TierMover(m_DataStore,
+			m_Config->GetInteger("stsdbd", "cold_after", 2592000));
+		if (m_Mover == nullptr)
+			throw std::runtime_error("Failed to create tier mover");
+	}
+
 	// create the network processor
 	m_Net = new NetworkProcessor(m_Config->Get("stsdbd", "bind_address", "127.0.0.1"),
-		m_DataStore, m_Stats);
+		m_DataStore, m_Stats,
+		m_Config->GetInteger("stsdbd", "rate_limit_connection", 0),
+		m_Config->GetInteger("stsdbd", "rate_limit_address", 0),
+		m_Config->GetInteger("stsdbd", "rate_limit_burst", 1));
 	if (m_Net == nullptr)
 		throw std::runtime_error("Failed to create network processor");
+
+	std::string backend = m_Config->Get("stsdbd", "network_backend", "epoll");
+	if (backend != "epoll" && backend != "io_uring")
+		spdlog::warn("Unknown network backend {0}, using epoll", backend.c_str());
+	m_Net->ConfigureReactors(backend == "io_uring");
 }
 
 Kernel::~Kernel(void)
@@ -117,6 +203,7 @@ Kernel::~Kernel(void)
 	Stop();
 
 	delete m_Net;
+	delete m_Mover;
 	delete m_DataStore;
 	delete m_Stats;
 
@@ -133,9 +220,26 @@ void Kernel::Start(void)
 	if (!m_DataStore->StartThread())
 		throw std::runtime_error("Failed to start datastore");
 
-	if (!m_Net->StartTelnetInterface(m_Config->Get("stsdbd", "telnet_port", "2181")))
+	if (m_Mover && !m_Mover->StartThread())
+		throw std::runtime_error("Failed to start tier mover");
+
+	if (!m_Net->StartTelnetInterface(m_Config->Get("stsdbd", "telnet_port", "2181"),
+		m_Config->GetInteger("stsdbd", "telnet_backlog", 128),
+		m_Config->GetInteger("stsdbd", "telnet_threads", 1),
+		m_Config->GetInteger("stsdbd", "telnet_parsers", 1)))
 		throw std::runtime_error("Failed to start telnet interface");
-	if (!m_Net->StartHTTPInterface(m_Config->Get("stsdbd", "http_port", "8080")))
+	if (!m_Net->StartBinaryInterface(m_Config->Get("stsdbd", "binary_port", "0"),
+		m_Config->GetInteger("stsdbd", "binary_backlog", 128),
+		m_Config->GetInteger("stsdbd", "binary_threads", 1)))
+		throw std::runtime_error("Failed to start binary interface");
+	if (!m_Net->StartUDPInterface(m_Config->Get("stsdbd", "udp_port", "0"),
+		m_Config->GetInteger("stsdbd", "udp_buffer_size", 4194304)))
+		throw std::runtime_error("Failed to start UDP interface");
+	if (!m_Net->StartHTTPInterface(m_Config->Get("stsdbd", "http_port", "8080"),
+		m_Config->GetInteger("stsdbd", "http_threads", 50),
+		m_Config->GetInteger("stsdbd", "http_queue", 20),
+		m_Config->GetInteger("stsdbd", "http_timeout", 30000),
+		m_Config->GetInteger("stsdbd", "http_keep_alive", 500)))
 		throw std::runtime_error("Failed to start HTTP interface");
 
 	spdlog::info("SimpleTSDB started");
@@ -144,7 +248,11 @@ void Kernel::Start(void)
 void Kernel::Stop(void)
 {
 	m_Net->StopHTTPInterface();
+	m_Net->StopUDPInterface();
+	m_Net->StopBinaryInterface();
 	m_Net->StopTelnetInterface();
+	if (m_Mover)
+		m_Mover->StopThread();
 	m_DataStore->StopThread();
 	m_Stats->StopThread();
 }
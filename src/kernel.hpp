@@ -14,6 +14,7 @@
 #include "metric.hpp"
 #include "network.hpp"
 #include "stats.hpp"
+#include "tiering.hpp"
 
 #include "INIReader.h"
 
@@ -27,6 +28,7 @@ private:
 
 	Statistics *m_Stats;
 	Datastore *m_DataStore;
+	TierMover *m_Mover;
 	NetworkProcessor *m_Net;
 
 public:
@@ -5,9 +5,16 @@
  *
  */
 
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
+#include <utility>
 
 #include "metric.hpp"
+#include "tags.hpp"
+
+#define MAX_VALUE_LENGTH	63
 
 Metric::Metric(void)
 	: m_Timestamp(0), m_Value(0)
@@ -15,52 +22,77 @@ Metric::Metric(void)
 	m_IsOk = false;
 }
 
-Metric::Metric(const std::string &line)
+Metric::Metric(std::string_view line)
 	: m_Timestamp(0), m_Value(0), m_IsOk(false)
 {
-	// parse the line
-	std::string::size_type start = 0;
-	std::string::size_type pos = line.find(' ', start);
-	if (pos != std::string::npos)
-		m_Name = line.substr(start, pos);
-
-	start = pos + 1;
-	pos = line.find(' ', pos + 1);
-	if (pos != std::string::npos)
+	std::string_view name, tags;
+	if (!ParseLine(line, name, m_Timestamp, m_Value, tags, m_Error))
+		return;
+
+	if (!name.empty() && CanonicalizeTags(tags, m_Tags, m_Error))
 	{
-		std::string _timestamp = line.substr(start, pos - start);
-		char *end = nullptr;
-		m_Timestamp = strtoull(_timestamp.c_str(), &end, 10);
-		if (end && *end)
-		{
-			std::ostringstream err;
-			err << "Invalid timestamp format: " << m_Timestamp << ", '" << end << "'";
-			m_Error.assign(err.str());
-			return;
-		}
+		m_Name.assign(name.data(), name.length());
+		m_IsOk = true;
 	}
+}
 
-	start = pos + 1;
-	pos = line.find(' ', start);
-	if (pos != std::string::npos)
+bool Metric::ParseLine(std::string_view line, std::string_view &name,
+	uint64_t &timestamp, double &value, std::string_view &tags,
+	std::string &error)
+{
+	// parse the line in place: <name> <timestamp> <value> <tags>
+	std::string_view::size_type pos = line.find(' ');
+	if (pos == std::string_view::npos)
+		return false;
+
+	name = line.substr(0, pos);
+	line.remove_prefix(pos + 1);
+
+	pos = line.find(' ');
+	if (pos == std::string_view::npos)
+		return false;
+
+	const char *end = line.data() + pos;
+	std::from_chars_result result = std::from_chars(line.data(), end, timestamp);
+	if (result.ec != std::errc() || result.ptr != end)
 	{
-		std::string _value = line.substr(start, pos - start);
-		char *end = nullptr;
-		m_Value = strtod(_value.c_str(), &end);
-		if (end && *end)
-		{
-			std::ostringstream err;
-			err << "Invalid value: " << m_Value << ", '" << end << "'";
-			m_Error.assign(err.str());
-			return;
-		}
+		std::ostringstream err;
+		err << "Invalid timestamp format: " << timestamp << ", '"
+			<< std::string_view(result.ptr, end - result.ptr) << "'";
+		error.assign(err.str());
+		return false;
 	}
 
-	start = pos + 1;
-	m_Tags = line.substr(start);
+	line.remove_prefix(pos + 1);
 
-	if (m_Name.length() > 0 && m_Tags.length() > 0)
-		m_IsOk = true;
+	pos = line.find(' ');
+	if (pos == std::string_view::npos)
+		return false;
+
+	// strtod needs a terminated string, values are short
+	char number[MAX_VALUE_LENGTH + 1];
+	if (pos > MAX_VALUE_LENGTH)
+	{
+		error.assign("Invalid value: too long");
+		return false;
+	}
+
+	memcpy(number, line.data(), pos);
+	number[pos] = 0;
+
+	char *valueEnd = nullptr;
+	value = strtod(number, &valueEnd);
+	if (valueEnd == number || (valueEnd && *valueEnd))
+	{
+		std::ostringstream err;
+		err << "Invalid value: " << value << ", '" << valueEnd << "'";
+		error.assign(err.str());
+		return false;
+	}
+
+	line.remove_prefix(pos + 1);
+	tags = line;
+	return true;
 }
 
 Metric::Metric(const std::string &name,
@@ -68,11 +100,10 @@ Metric::Metric(const std::string &name,
 	const std::string &tags)
 	: m_Timestamp(timestamp), m_Value(value), m_IsOk(false)
 {
-	if (name.length() == 0 || tags.length() == 0)
+	if (name.length() == 0 || !CanonicalizeTags(tags, m_Tags, m_Error))
 		return;	// bad metric
 
 	m_Name.assign(name);
-	m_Tags.assign(tags);
 
 	m_IsOk = true;
 }
@@ -88,6 +119,13 @@ Metric::Metric(const Metric &that)
 	m_Error.assign(that.m_Error);
 }
 
+Metric::Metric(Metric &&that) noexcept
+	: m_Name(std::move(that.m_Name)), m_Timestamp(that.m_Timestamp),
+	  m_Value(that.m_Value), m_Tags(std::move(that.m_Tags)),
+	  m_IsOk(that.m_IsOk), m_Error(std::move(that.m_Error))
+{
+}
+
 Metric::~Metric(void)
 {
 }
@@ -103,6 +141,38 @@ void Metric::operator= (const Metric &that)
 	m_Error.assign(that.m_Error);
 }
 
+void Metric::operator= (Metric &&that) noexcept
+{
+	m_Name = std::move(that.m_Name);
+	m_Timestamp = that.m_Timestamp;
+	m_Value = that.m_Value;
+	m_Tags = std::move(that.m_Tags);
+
+	m_IsOk = that.m_IsOk;
+	m_Error = std::move(that.m_Error);
+}
+
+bool Metric::IsValidName(std::string_view name, std::string &error)
+{
+	if (name.empty())
+	{
+		error.assign("A metric name is required");
+		return false;
+	}
+
+	for (std::string_view::const_iterator c = name.begin(); c != name.end(); ++c)
+	{
+		unsigned char ch = static_cast<unsigned char>(*c);
+		if (ch <= ' ' || ch == 0x7f || ch == '/' || ch == '\\')
+		{
+			error.assign("Invalid character in metric name");
+			return false;
+		}
+	}
+
+	return true;
+}
+
 bool Metric::IsValid(std::string &error)
 {
 	if (!m_IsOk)
@@ -9,6 +9,7 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 class Metric
 {
@@ -16,24 +17,35 @@ private:
 	std::string m_Name;
 	uint64_t m_Timestamp;
 	double m_Value;
-	std::string m_Tags;
+	std::string m_Tags;	// canonical form, see tags.hpp
 
 	bool m_IsOk;
 	std::string m_Error;
 
 public:
 	Metric(void);
-	Metric(const std::string &line);
+	Metric(std::string_view line);
 	Metric(const std::string &name,
 		uint64_t &timestamp, double &value,
 		const std::string &tags);
 	Metric(const Metric &that);
+	Metric(Metric &&that) noexcept;
 	~Metric(void);
 
 	void operator = (const Metric &that);
+	void operator = (Metric &&that) noexcept;
 
 	bool IsValid(std::string &error);
 
+	// splits a put line without copying it; the tags are left as sent
+	static bool ParseLine(std::string_view line, std::string_view &name,
+		uint64_t &timestamp, double &value, std::string_view &tags,
+		std::string &error);
+
+	// names become file names, so they can't be empty, or have
+	// whitespace, control characters or path separators
+	static bool IsValidName(std::string_view name, std::string &error);
+
 	const std::string& Name(void) const { return m_Name; }
 	const uint64_t& Timestamp(void) const { return m_Timestamp; }
 	const double& Value(void) const { return m_Value; }
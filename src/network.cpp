@@ -5,88 +5,725 @@
  *
  */
 
+#include "binary.hpp"
+#include "datagram.hpp"
 #include "downsampler.hpp"
+#include "framer.hpp"
+#include "influx.hpp"
+#include "inflate.hpp"
+#include "jsonput.hpp"
 #include "metric.hpp"
 #include "network.hpp"
+#include "parser.hpp"
 #include "query.hpp"
-#include "thread.hpp"
+#include "ratelimit.hpp"
+#include "reactor.hpp"
+#include "remotewrite.hpp"
+#include "snappy.hpp"
 #include "utility.hpp"
 
 #include "civetweb.h"
 #include "json/json.hpp"
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <string_view>
+#include <vector>
 
-#if defined(_WIN32) || defined(WIN32)
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-
-#define CLOSE_SOCKET	closesocket
-typedef SOCKET socket_t;
-#else
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <netdb.h>
-
-#define CLOSE_SOCKET	close
-#define int32_t socket_t;
-#endif
+#define HTTP_BUFFER_SIZE	65536	// per request, however large the body
+
+#define STREAM_ACK_INTERVAL_MS	100	// how often streams are acknowledged
+#define STREAM_MAX_LINE			65536	// a longer text line closes the stream
+#define STREAM_CLOSE_TOO_BIG	1009	// the close status for it
+
+// remote_write bodies are read whole, snappy blocks can't be streamed
+#define REMOTE_WRITE_MAX_BODY		(32 * 1024 * 1024)
+#define REMOTE_WRITE_MAX_REQUEST	(128 * 1024 * 1024)	// uncompressed
 
-bool isValidChar(char c)
+// drops unprintable characters and quotes from a line, in place
+static std::string_view CleanLine(char *line, std::size_t length)
 {
-	unsigned char ch = (unsigned char)c;
-	if ((isalnum(ch) || (ispunct(ch) && ch != '\'') || ch == ' ') && (ch != '\n' || ch != '\r'))
-		return false;
+	std::size_t out = 0;
+	for (std::size_t c = 0; c < length; c++)
+	{
+		// cast the buffer value to unsigned char to prevent assertions
+		unsigned char ch = (unsigned char)line[c];
+		if (isalnum(ch) || (ispunct(ch) && ch != '\'') || ch == ' ')
+			line[out++] = line[c];
+	}
 
-	return true;
+	return std::string_view(line, out);
 }
 
-class TelnetProcessor : public ThreadProc
+// a request body, inflated as it is read when it was sent compressed
+class RequestBody
+{
+private:
+	struct mg_connection *m_Conn;
+	std::unique_ptr<Inflater> m_Inflater;
+
+public:
+	RequestBody(struct mg_connection *conn)
+		: m_Conn(conn) {}
+
+	// false if the Content-Encoding isn't supported
+	bool SetEncoding(const char *encoding)
+	{
+		if (encoding == nullptr || *encoding == 0 ||
+			mg_strcasecmp(encoding, "identity") == 0)
+			return true;
+
+		Inflater::Format format;
+		if (mg_strcasecmp(encoding, "gzip") == 0 ||
+			mg_strcasecmp(encoding, "x-gzip") == 0)
+			format = Inflater::Format::GZIP;
+		else if (mg_strcasecmp(encoding, "deflate") == 0)
+			format = Inflater::Format::ZLIB;
+		else
+			return false;
+
+		struct mg_connection *conn = m_Conn;
+		m_Inflater.reset(new Inflater(format,
+			[conn](char *buffer, std::size_t size) -> int32_t
+			{
+				return mg_read(conn, buffer, size);
+			}));
+		return true;
+	}
+
+	// as mg_read, but -1 also once a compressed body is malformed
+	int32_t Read(char *buffer, std::size_t size)
+	{
+		if (m_Inflater)
+			return m_Inflater->Read(buffer, size);
+
+		return mg_read(m_Conn, buffer, size);
+	}
+
+	std::string GetError(void) const
+	{
+		if (m_Inflater && !m_Inflater->GetError().empty())
+			return m_Inflater->GetError();
+
+		return "Failed to read the request body";
+	}
+};
+
+class TelnetProcessor : public ReactorHandler, public ParserHandler
 {
 private:
+	// owned by one reactor thread, or by one parser worker
+	struct TelnetContext
+	{
+		MetricBatch batch;
+		std::size_t puts;
+
+		TelnetContext(Datastore *datastore)
+			: batch(datastore), puts(0) {}
+	};
+
+	struct TelnetConnection
+	{
+		socket_t sock;
+		LineFramer framer;
+
+		// with a parser pool, the worker parsing this connection
+		uint32_t worker;
+
+		// held while replying, the socket isn't closed until it is released
+		std::mutex lock;
+		bool open;
+
+		// with rate limits
+		RateLimiter::client_t client;
+		TokenBucket bucket;
+
+		TelnetConnection(socket_t socket)
+			: sock(socket), worker(0), open(true) {}
+	};
+
 	std::string m_BindAddr;
 	std::string m_BindPort;
 
 	Datastore *m_DataStore;
 	Statistics *m_Stats;
 
-	bool m_Running;
+	Reactor *m_Reactor;
+	ParserPool *m_Parsers;	// null when the reactor threads parse
+	RateLimiter *m_Limiter;	// null without rate limits
 
-	socket_t m_Listener;
-	fd_set m_Master;
-	int32_t m_Socket_max;
-	int32_t m_Backlog;
+public:
+	TelnetProcessor(const std::string &bindAddr, const std::string &port,
+		int32_t backlog, uint32_t threads, uint32_t parsers, bool uring,
+		Datastore *datastore, Statistics *stats, RateLimiter *limiter)
+		: m_BindAddr(bindAddr), m_BindPort(port), m_DataStore(datastore),
+		  m_Stats(stats), m_Parsers(nullptr), m_Limiter(limiter)
+	{
+		m_Reactor = new Reactor(bindAddr, port, backlog, threads, this, uring);
+		if (m_Reactor == nullptr)
+			throw std::runtime_error("Failed to create telnet reactor");
 
-	typedef std::map<socket_t, std::string> clientbuffers_t;
-	clientbuffers_t m_ClientBuffers;
+		if (parsers > 0)
+		{
+			m_Parsers = new ParserPool(parsers, this);
+			if (m_Parsers == nullptr)
+				throw std::runtime_error("Failed to create telnet parsers");
+		}
+	}
 
-	Thread *m_Thread;
+	~TelnetProcessor(void)
+	{
+		delete m_Reactor;
+		delete m_Parsers;
+	}
+
+	bool StartThread(void)
+	{
+		spdlog::info("Starting telnet interface on {0}:{1}",
+			m_BindAddr.c_str(), m_BindPort.c_str());
+
+		// the parsers must be waiting before anything is received
+		if (m_Parsers && !m_Parsers->Start())
+			return false;
+
+		if (!m_Reactor->Start())
+			return false;
+
+		spdlog::info("Telnet interface running");
+		return true;
+	}
+
+	void StopThread(void)
+	{
+		spdlog::info("Telnet interface stopping");
+
+		m_Reactor->Stop();
+		if (m_Parsers)
+			m_Parsers->Stop();	// after the reactor, to parse what it queued
+
+		spdlog::info("Telnet interface stopped");
+	}
+
+	void* OnConnect(socket_t sock, const std::string &remote)
+	{
+		TelnetConnection *conn = new TelnetConnection(sock);
+		if (m_Parsers)
+			conn->worker = m_Parsers->Assign();
+
+		if (m_Limiter)
+		{
+			conn->client = m_Limiter->GetClient(remote);
+			m_Limiter->InitBucket(conn->bucket);
+		}
+
+		return conn;
+	}
+
+	uint32_t GetReceiveDelay(void *state)
+	{
+		// the reactor stops reading the connection until it is under its
+		// rate, or until the parsers have caught up
+		uint32_t delay = 0;
+		if (m_Limiter)
+		{
+			TelnetConnection *conn = static_cast<TelnetConnection*>(state);
+			delay = m_Limiter->GetDelay(*conn->client, &conn->bucket);
+			if (delay > 0)
+				m_Limiter->AddThrottled(*conn->client);
+		}
+
+		if (delay == 0 && m_Parsers && m_Parsers->IsFull())
+			delay = PARSER_FULL_DELAY_MS;
+
+		return delay;
+	}
+
+	char* GetReceiveBuffer(void *state, std::size_t &space)
+	{
+		// with a parser pool the reactor reads into its own buffer, and a
+		// pool buffer is only taken for data that has arrived
+		if (m_Parsers)
+			return nullptr;
+
+		TelnetConnection *conn = static_cast<TelnetConnection*>(state);
+		return conn->framer.GetWriteBuffer(space);
+	}
+
+	void* OnThreadStart(void)
+	{
+		if (m_Parsers)
+			return nullptr;
+
+		return new TelnetContext(m_DataStore);
+	}
+
+	void OnThreadStop(void *context)
+	{
+		if (context == nullptr)
+			return;
+
+		OnFlush(context);
+		delete static_cast<TelnetContext*>(context);
+	}
+
+	void OnFlush(void *context)
+	{
+		if (context == nullptr)
+			return;	// nothing is parsed on the reactor threads
+
+		TelnetContext *telnet = static_cast<TelnetContext*>(context);
+		telnet->batch.Flush();
+
+		m_Stats->AddPutCount(telnet->puts);
+		telnet->puts = 0;
+	}
+
+	bool OnReceive(void *context, socket_t sock, void *state, const char *buf,
+		std::size_t nbytes)
+	{
+		TelnetConnection *conn = static_cast<TelnetConnection*>(state);
+		if (m_Limiter)
+		{
+			// every line counts, before it has been parsed
+			m_Limiter->Charge(*conn->client, &conn->bucket,
+				std::count(buf, buf + nbytes, '\n'));
+		}
+
+		if (m_Parsers)
+		{
+			// handed over whole, the worker owns each buffer now
+			while (nbytes > 0)
+			{
+				std::size_t count = std::min(nbytes,
+					(std::size_t)PARSER_BUFFER_SIZE);
+				char *buffer = m_Parsers->Acquire();
+				memcpy(buffer, buf, count);
+				m_Parsers->Submit(conn->worker, conn, buffer, count);
+
+				buf += count;
+				nbytes -= count;
+			}
+
+			return true;
+		}
+
+		// the data was received straight into the framer
+		conn->framer.Commit(nbytes);
+		ParseLines(static_cast<TelnetContext*>(context), conn);
+		return true;
+	}
+
+	void OnDisconnect(socket_t sock, void *state)
+	{
+		TelnetConnection *conn = static_cast<TelnetConnection*>(state);
+		if (m_Parsers == nullptr)
+		{
+			delete conn;
+			return;
+		}
+
+		{
+			// no more replies, the socket is closed once this returns
+			std::lock_guard<std::mutex> lock(conn->lock);
+			conn->open = false;
+		}
+
+		// freed by the worker, behind the data still queued for it
+		m_Parsers->Close(conn->worker, conn);
+	}
+
+	void* OnWorkerStart(void)
+	{
+		return new TelnetContext(m_DataStore);
+	}
+
+	void OnWorkerStop(void *context)
+	{
+		OnThreadStop(context);
+	}
+
+	void OnParse(void *context, void *state, const char *data,
+		std::size_t length)
+	{
+		TelnetConnection *conn = static_cast<TelnetConnection*>(state);
+		while (length > 0)
+		{
+			std::size_t space = 0;
+			char *buffer = conn->framer.GetWriteBuffer(space);
+			std::size_t count = std::min(space, length);
+			memcpy(buffer, data, count);
+			conn->framer.Commit(count);
+
+			ParseLines(static_cast<TelnetContext*>(context), conn);
+			data += count;
+			length -= count;
+		}
+	}
+
+	void OnRelease(void *context, void *state)
+	{
+		delete static_cast<TelnetConnection*>(state);
+	}
+
+private:
+	// also drops the odd non-alpha first character some clients send
+	static std::string_view CleanTelnetLine(char *line, std::size_t length)
+	{
+		std::string_view view = CleanLine(line, length);
+		if (!view.empty() && !isalpha((unsigned char)view[0]))
+			view.remove_prefix(1);
+
+		return view;
+	}
+
+	void ParseLines(TelnetContext *context, TelnetConnection *conn)
+	{
+		char *line = nullptr;
+		std::size_t length = 0;
+		while (conn->framer.NextLine(line, length))
+			ProcessLine(context, conn, CleanTelnetLine(line, length));
+	}
+
+	void ProcessLine(TelnetContext *context, TelnetConnection *conn,
+		std::string_view line)
+	{
+		if (line.compare(0, 3, "put") == 0)
+		{
+			// ensure there are at least 5 fields
+			// put <metric> <timestamp> <value> <tagk_1=tagv_1> [<tagk_n=tagv_n>]
+			int32_t param_count = 1 + (int32_t)std::count(line.begin(), line.end(), ' ');
+			if (param_count < 5)
+			{
+				std::ostringstream err;
+				err << "put: invalid number of parameters (" << param_count << "), 5 required.\n\r";
+				Reply(conn, err.str());
+			}
+			else
+			{
+				std::string error;
+				line.remove_prefix(4);
+
+				// queued with the rest of this wakeup's metrics
+				if (context->batch.AddLine(line, error))
+					++context->puts;
+				else
+				{
+					std::ostringstream err;
+					err << "put: invalid value: " << error << "\r\n";
+					Reply(conn, err.str());
+				}
+			}
+		}
+		else
+		{
+			// @TODO
+			// check to see if there are any requests we can handle
+			// e.g. status, stats, etc.
+		}
+	}
+
+	void Reply(TelnetConnection *conn, const std::string &reply)
+	{
+		// a worker may still be parsing after the connection has closed,
+		// and the socket number may already belong to another client
+		std::lock_guard<std::mutex> lock(conn->lock);
+		if (conn->open)
+			Reactor::Send(conn->sock, reply.c_str(), reply.length() + 1);
+	}
+};
+
+class BinaryProcessor : public ReactorHandler
+{
+private:
+	// owned by one reactor thread
+	struct BinaryContext
+	{
+		MetricBatch batch;
+		std::size_t puts;
+		std::string reply;
+
+		BinaryContext(Datastore *datastore)
+			: batch(datastore), puts(0) {}
+	};
+
+	std::string m_BindAddr;
+	std::string m_BindPort;
+
+	Datastore *m_DataStore;
+	Statistics *m_Stats;
+
+	Reactor *m_Reactor;
 
 public:
-	TelnetProcessor(const std::string &bindAddr, const std::string &port,
-		int32_t backlog, Datastore *datastore, Statistics *stats)
-		: m_BindAddr(bindAddr), m_BindPort(port), m_Backlog(backlog),
-		  m_DataStore(datastore), m_Stats(stats)
+	BinaryProcessor(const std::string &bindAddr, const std::string &port,
+		int32_t backlog, uint32_t threads, bool uring, Datastore *datastore,
+		Statistics *stats)
+		: m_BindAddr(bindAddr), m_BindPort(port), m_DataStore(datastore),
+		  m_Stats(stats)
+	{
+		m_Reactor = new Reactor(bindAddr, port, backlog, threads, this, uring);
+		if (m_Reactor == nullptr)
+			throw std::runtime_error("Failed to create binary reactor");
+	}
+
+	~BinaryProcessor(void)
+	{
+		delete m_Reactor;
+	}
+
+	bool StartThread(void)
+	{
+		spdlog::info("Starting binary interface on {0}:{1}",
+			m_BindAddr.c_str(), m_BindPort.c_str());
+
+		if (!m_Reactor->Start())
+			return false;
+
+		spdlog::info("Binary interface running");
+		return true;
+	}
+
+	void StopThread(void)
+	{
+		spdlog::info("Binary interface stopping");
+
+		m_Reactor->Stop();
+
+		spdlog::info("Binary interface stopped");
+	}
+
+	void* OnConnect(socket_t sock, const std::string &remote)
+	{
+		return new BinaryDecoder();
+	}
+
+	char* GetReceiveBuffer(void *state, std::size_t &space)
+	{
+		return static_cast<BinaryDecoder*>(state)->GetWriteBuffer(space);
+	}
+
+	void* OnThreadStart(void)
+	{
+		return new BinaryContext(m_DataStore);
+	}
+
+	void OnThreadStop(void *context)
+	{
+		OnFlush(context);
+		delete static_cast<BinaryContext*>(context);
+	}
+
+	void OnFlush(void *context)
+	{
+		BinaryContext *binary = static_cast<BinaryContext*>(context);
+		binary->batch.Flush();
+
+		m_Stats->AddPutCount(binary->puts);
+		binary->puts = 0;
+	}
+
+	bool OnReceive(void *context, socket_t sock, void *state, const char *buf,
+		std::size_t nbytes)
+	{
+		// the data was received straight into the decoder
+		BinaryDecoder *decoder = static_cast<BinaryDecoder*>(state);
+		decoder->Commit(nbytes);
+
+		BinaryContext *binary = static_cast<BinaryContext*>(context);
+		binary->reply.clear();
+		bool ok = decoder->Decode(binary->batch, binary->puts, binary->reply);
+
+		// acks, or the reason the connection is being closed; a partial
+		// frame would break the client's framing for good
+		if (!binary->reply.empty() &&
+			Reactor::Send(sock, binary->reply.data(), binary->reply.length()) !=
+				(int32_t)binary->reply.length())
+		{
+			spdlog::debug("Binary client on socket {0} isn't reading its replies, closing",
+				sock);
+			return false;
+		}
+
+		return ok;
+	}
+
+	void OnDisconnect(socket_t sock, void *state)
+	{
+		delete static_cast<BinaryDecoder*>(state);
+	}
+};
+
+class UdpProcessor : public DatagramHandler
+{
+private:
+	std::string m_BindAddr;
+	std::string m_BindPort;
+
+	Datastore *m_DataStore;
+	Statistics *m_Stats;
+
+	DatagramListener *m_Listener;
+
+	// only used on the listener thread
+	MetricBatch m_Batch;
+	std::size_t m_Puts;
+	std::size_t m_Invalid;
+
+public:
+	UdpProcessor(const std::string &bindAddr, const std::string &port,
+		int32_t bufferSize, Datastore *datastore, Statistics *stats)
+		: m_BindAddr(bindAddr), m_BindPort(port), m_DataStore(datastore),
+		  m_Stats(stats), m_Batch(datastore), m_Puts(0), m_Invalid(0)
+	{
+		m_Listener = new DatagramListener(bindAddr, port, bufferSize, this);
+		if (m_Listener == nullptr)
+			throw std::runtime_error("Failed to create UDP listener");
+	}
+
+	~UdpProcessor(void)
+	{
+		delete m_Listener;
+	}
+
+	bool StartThread(void)
+	{
+		spdlog::info("Starting UDP interface on {0}:{1}",
+			m_BindAddr.c_str(), m_BindPort.c_str());
+
+		if (!m_Listener->StartThread())
+			return false;
+
+		spdlog::info("UDP interface running");
+		return true;
+	}
+
+	void StopThread(void)
+	{
+		spdlog::info("UDP interface stopping");
+
+		m_Listener->StopThread();
+		OnFlush(0);
+
+		spdlog::info("UDP interface stopped");
+	}
+
+	void OnDatagram(char *data, std::size_t length)
+	{
+		// one or more lines, each with or without the leading put
+		char *end = data + length;
+		while (data < end)
+		{
+			char *newline = static_cast<char*>(memchr(data, '\n', end - data));
+			char *lineEnd = newline ? newline : end;
+
+			std::string_view line = CleanLine(data, lineEnd - data);
+			if (line.compare(0, 4, "put ") == 0)
+				line.remove_prefix(4);
+
+			if (!line.empty())
+			{
+				// there's no one to report a bad line to, it is counted
+				std::string error;
+				if (m_Batch.AddLine(line, error))
+					++m_Puts;
+				else
+					++m_Invalid;
+			}
+
+			data = lineEnd + 1;
+		}
+	}
+
+	void OnFlush(std::size_t dropped)
+	{
+		m_Batch.Flush();
+
+		m_Stats->AddPutCount(m_Puts);
+		m_Stats->AddUdpDropCount(dropped + m_Invalid);
+		m_Puts = 0;
+		m_Invalid = 0;
+	}
+};
+
+#if defined(USE_WEBSOCKET)
+// /api/stream, a WebSocket carrying put lines in text messages and
+// binary protocol frames in binary messages. Every connection keeps its
+// civetweb worker; a thread of its own acknowledges what each has queued
+// for the datastore writer, which is not yet on disk
+class StreamProcessor : public ThreadProc
+{
+private:
+	// used by the connection's civetweb worker, the counters are also
+	// read by the ack thread. Both hold a reference, and the last to let
+	// go deletes it
+	struct StreamConnection
 	{
-		m_Listener = 0;
-		FD_ZERO(&m_Master);
-		m_Socket_max = 0;
+		struct mg_connection *conn;
+		std::atomic<int> refs;
 
-		m_Running = false;
+		// held while acknowledging; once closed, conn is not written to
+		std::mutex lock;
+		bool closed;
+
+		MetricBatch batch;
+		BinaryDecoder decoder;
+		std::string partial;	// a line split between frames
+		int opcode;				// of the message being received
+		std::string reply;
+
+		std::atomic<uint64_t> sequence;	// messages queued
+		std::atomic<uint64_t> points;
+		std::atomic<uint64_t> errors;
+		uint64_t acked;			// the last sequence acknowledged
+
+		// with rate limits
+		RateLimiter::client_t client;
+		TokenBucket bucket;
+
+		StreamConnection(struct mg_connection *connection, Datastore *datastore)
+			: conn(connection), refs(1), closed(false), batch(datastore),
+			  opcode(0), sequence(0), points(0), errors(0), acked(0) {}
+
+		void AddRef(void)
+		{
+			refs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void Release(void)
+		{
+			if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete this;
+		}
+	};
 
+	Datastore *m_DataStore;
+	Statistics *m_Stats;
+	RateLimiter *m_Limiter;
+
+	// held while the set changes or is copied, never while writing
+	std::mutex m_Lock;
+	std::set<StreamConnection*> m_Connections;
+
+	Thread *m_Thread;
+
+public:
+	StreamProcessor(Datastore *datastore, Statistics *stats,
+		RateLimiter *limiter)
+		: m_DataStore(datastore), m_Stats(stats), m_Limiter(limiter)
+	{
 		m_Thread = new Thread(this);
 		if (m_Thread == nullptr)
-			throw std::runtime_error("Failed to create telnet processor thread");
+			throw std::runtime_error("Failed to create stream ack thread");
 	}
 
-	~TelnetProcessor(void)
+	~StreamProcessor(void)
 	{
 		delete m_Thread;
 	}
@@ -98,264 +735,325 @@ public:
 
 	void StopThread(void)
 	{
-		spdlog::info("Telnet interface stopping");
-
 		m_Thread->Stop();
+	}
 
-		spdlog::info("Telnet interface stopped");
+	void Register(struct mg_context *ctx)
+	{
+		mg_set_websocket_handler(ctx, "/api/stream", nullptr,
+			mg_stream_ready, mg_stream_data, mg_stream_close, this);
 	}
 
 	void Start(void)
 	{
-		spdlog::info("Starting telnet interface on {0}:{1}",
-			m_BindAddr.c_str(), m_BindPort.c_str());
+		// nothing to do
+	}
 
-#if defined(_WIN32) || defined(WIN32)
-		WSADATA wsa;
-		if (WSAStartup(MAKEWORD(2, 0), &wsa) != 0)
+	void Process(void)
+	{
+		Sleep(STREAM_ACK_INTERVAL_MS);
+
+		// a slow client then only holds up its own close, not every
+		// stream opening or closing
+		std::vector<StreamConnection*> streams;
 		{
-			spdlog::error("Failed to initialize socket library: {0}", WSAGetLastError());
-			return;
+			std::lock_guard<std::mutex> lock(m_Lock);
+			streams.reserve(m_Connections.size());
+			for (std::set<StreamConnection*>::iterator stream = m_Connections.begin();
+				stream != m_Connections.end(); ++stream)
+			{
+				(*stream)->AddRef();
+				streams.push_back(*stream);
+			}
 		}
-#endif
 
-		int32_t yes = 1;
+		for (std::vector<StreamConnection*>::iterator stream = streams.begin();
+			stream != streams.end(); ++stream)
+		{
+			Acknowledge(*stream);
+			(*stream)->Release();
+		}
+	}
+
+	void Stop(void)
+	{
+		// nothing to do
+	}
 
-		struct addrinfo hints, *ai, *p;
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_PASSIVE;
+private:
+	// once the handshake is done, a close is certain to follow
+	static void mg_stream_ready(struct mg_connection *conn, void *cbdata)
+	{
+		StreamProcessor *stream = static_cast<StreamProcessor*>(cbdata);
+		StreamConnection *state = new StreamConnection(conn, stream->m_DataStore);
 
-		if (getaddrinfo(m_BindAddr.c_str(), m_BindPort.c_str(), &hints, &ai) != 0)
+		if (stream->m_Limiter)
 		{
-			spdlog::error("Failed to getaddrinfo: {0}", WSAGetLastError());
-			return;
+			state->client = stream->m_Limiter->GetClient(
+				mg_get_request_info(conn)->remote_addr);
+			stream->m_Limiter->InitBucket(state->bucket);
 		}
 
-		for (p = ai; p != nullptr; p = p->ai_next)
-		{
-			m_Listener = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-			if (m_Listener < 0)
-				continue;
+		mg_set_user_connection_data(conn, state);
 
-			setsockopt(m_Listener, SOL_SOCKET, SO_REUSEADDR, 
-				(const char*)&yes, sizeof(int32_t));
+		std::lock_guard<std::mutex> lock(stream->m_Lock);
+		stream->m_Connections.insert(state);
+	}
+
+	static int mg_stream_data(struct mg_connection *conn, int bits, char *data,
+		size_t length, void *cbdata)
+	{
+		StreamProcessor *stream = static_cast<StreamProcessor*>(cbdata);
+		StreamConnection *state = static_cast<StreamConnection*>(
+			mg_get_user_connection_data(conn));
+
+		return stream->OnFrame(state, bits, data, length) ? 1 : 0;
+	}
 
-			if (bind(m_Listener, p->ai_addr, p->ai_addrlen) < 0)
-			{
-				CLOSE_SOCKET(m_Listener);
-				continue;
-			}
+	static void mg_stream_close(const struct mg_connection *conn, void *cbdata)
+	{
+		StreamProcessor *stream = static_cast<StreamProcessor*>(cbdata);
+		StreamConnection *state = static_cast<StreamConnection*>(
+			mg_get_user_connection_data(conn));
+		if (state == nullptr)
+			return;
 
-			break;
+		{
+			std::lock_guard<std::mutex> lock(stream->m_Lock);
+			stream->m_Connections.erase(state);
 		}
 
-		if (p == nullptr)
 		{
-			spdlog::error("Failed to bind telnet socket: {0}", WSAGetLastError());
-			return;
+			// waits out an acknowledgement being written
+			std::lock_guard<std::mutex> lock(state->lock);
+			state->closed = true;
 		}
 
-		freeaddrinfo(ai);
+		state->batch.Flush();	// what is left of a partial message
+		state->Release();
+		mg_set_user_connection_data(const_cast<struct mg_connection*>(conn),
+			nullptr);
+	}
 
-		FD_SET(m_Listener, &m_Master);
-		m_Socket_max = m_Listener;
+	void Acknowledge(StreamConnection *state)
+	{
+		std::lock_guard<std::mutex> lock(state->lock);
+		if (state->closed)
+			return;
 
-		if (listen(m_Listener, m_Backlog) == -1)
-		{
-			spdlog::error("Failed to start listening: {0}", WSAGetLastError());
+		// cumulative, only sent once there is something new
+		uint64_t sequence = state->sequence.load(std::memory_order_acquire);
+		if (sequence == state->acked)
 			return;
-		}
 
-		spdlog::info("Telnet interface running");
+		char ack[128];
+		int32_t length = snprintf(ack, sizeof(ack),
+			"{\"seq\":%llu,\"points\":%llu,\"errors\":%llu}",
+			(unsigned long long)sequence,
+			(unsigned long long)state->points.load(),
+			(unsigned long long)state->errors.load());
+		mg_websocket_write(state->conn, MG_WEBSOCKET_OPCODE_TEXT, ack, length);
 
-		m_Running = true;
+		state->acked = sequence;
 	}
 
-	void Process(void)
+	// false closes the connection
+	bool OnFrame(StreamConnection *state, int bits, char *data,
+		std::size_t length)
 	{
-		if (!m_Running)
+		int opcode = bits & 0x0f;
+		if (opcode == MG_WEBSOCKET_OPCODE_TEXT ||
+			opcode == MG_WEBSOCKET_OPCODE_BINARY)
+			state->opcode = opcode;
+		else if (opcode != MG_WEBSOCKET_OPCODE_CONTINUATION)
+			return true;	// control frames are civetweb's
+
+		bool last = (bits & 0x80) != 0;
+		std::size_t points = 0;
+		if (state->opcode == MG_WEBSOCKET_OPCODE_TEXT)
 		{
-			m_Thread->Stop();
-			return;
+			if (!ParseText(state, data, length, last, points))
+			{
+				state->batch.Flush();
+				state->points += points;
+				m_Stats->AddPutCount(points);
+				return false;
+			}
 		}
+		else if (!ParseBinary(state, data, length, points))
+			return false;
 
-		// process the telnet interface
-		struct timeval timeout = { 0, 50000 };
-		fd_set readfds = m_Master;
-		if (select(m_Socket_max + 1, &readfds, nullptr, nullptr, &timeout) == -1)
+		if (!last)
 		{
-			spdlog::warn("Telnet select() failed");
-			return;
+			state->points += points;
+			m_Stats->AddPutCount(points);
+			return true;
 		}
-	
-		for (socket_t sock = 0; sock <= m_Socket_max; sock++)
+
+		// the whole message is queued before it is acknowledged
+		state->batch.Flush();
+		state->points += points;
+		state->sequence.fetch_add(1, std::memory_order_release);
+		m_Stats->AddPutCount(points);
+
+		if (m_Limiter)
 		{
-			if (FD_ISSET(sock, &readfds))
+			// not reading pushes back on the client
+			m_Limiter->Charge(*state->client, &state->bucket, points);
+			uint32_t delay = m_Limiter->GetDelay(*state->client, &state->bucket);
+			if (delay > 0)
 			{
-				if (sock == m_Listener)
-				{
-					// new connection
-					struct sockaddr_storage remoteaddr;
-					socklen_t addrlen = sizeof(remoteaddr);
-					socket_t newfd = accept(m_Listener,
-						(struct sockaddr*)&remoteaddr, &addrlen);
-					if (newfd == -1)
-						spdlog::warn("Failed to accept new telnet connection");
-					else
-					{
-						FD_SET(newfd, &m_Master);
-						if (newfd > m_Socket_max)
-							m_Socket_max = newfd;
-	
-						m_ClientBuffers.insert(std::pair<socket_t, std::string>(
-							newfd, std::string()));
-	
-						char remoteIP[INET6_ADDRSTRLEN];
-						spdlog::debug("new connection from {0} on socket {1}",
-							inet_ntop(remoteaddr.ss_family, get_in_addr((struct sockaddr*)&remoteaddr),
-								remoteIP, sizeof(remoteIP)), newfd);
-					}
-				}
-				else
-				{
-					// existing connection has new data
-					char buf[2048];
-					memset(buf, 0, sizeof(buf));
-					int32_t nbytes = recv(sock, buf, sizeof(buf), 0);
-					if (nbytes <= 0)
-					{
-						if (nbytes == 0)
-							spdlog::debug("socket {0} hung up", sock);
-						else
-							spdlog::warn("Failed to read on socket {0}", sock);
-	
-						CLOSE_SOCKET(sock);
-						FD_CLR(sock, &m_Master);
-						m_ClientBuffers.erase(sock);
-					}
-					else
-					{
-						std::string &line = m_ClientBuffers[sock];
-						for (int32_t c = 0; c < nbytes; c++)
-						{
-							// cast the buffer value to unsigned char to prevent assertions
-							unsigned char ch = (unsigned char)buf[c];
-							if ((isalnum(ch) || (ispunct(ch) && ch != '\'') || ch == ' ') && (ch != '\n' || ch != '\r'))
-							{
-								line.append(1, ch);
-							}
-							else if (ch == '\n')
-							{
-								// sometimes the first character is non-alpha, remove it
-								if (!isalpha(line[0]) || ispunct(line[0]) || line[0] == '\'')
-									line = line.substr(1);
-	
-								if (line.find("put") == 0)
-								{
-									// ensure there are at least 5 fields
-									// put <metric> <timestamp> <value> <tagk_1=tagv_1> [<tagk_n=tagv_n>]
-									int32_t param_count = 1;
-									std::string::size_type pos = line.find(' ');
-									while (pos != std::string::npos)
-									{
-										param_count++;
-										pos = line.find(' ', pos + 1);
-									}
-	
-									if (param_count < 5)
-									{
-										std::ostringstream err;
-										err << "put: invalid number of parameters (" << param_count << "), 5 required.\n\r";
-										send(sock, err.str().c_str(), err.str().length() + 1, 0);
-									}
-									else
-									{
-										std::string error;
-										line = line.substr(4);
-										Metric metric(line);
-										if (metric.IsValid(error))
-										{
-											// queue this metric
-											m_DataStore->QueueMetric(metric);
-
-											m_Stats->AddPutCount(1);
-										}
-										else
-										{
-											std::ostringstream err;
-											err << "put: invalid value: " << error << "\r\n";
-											send(sock, err.str().c_str(), err.str().length() + 1, 0);
-										}
-									}
-								}
-								else
-								{
-									// @TODO
-									// check to see if there are any requests we can handle
-									// e.g. status, stats, etc.
-								}
-	
-								line.clear();
-							}
-						}
-					}
-				}
+				m_Limiter->AddThrottled(*state->client);
+				Sleep(delay);
 			}
 		}
+
+		return true;
 	}
 
-	void Stop(void)
+	// false when a line is too long, after the close has been sent
+	bool ParseText(StreamConnection *state, char *data, std::size_t length,
+		bool last, std::size_t &points)
 	{
-		// close all client sockets
-		for (clientbuffers_t::iterator client = m_ClientBuffers.begin();
-			client != m_ClientBuffers.end(); ++client)
+		// one or more lines, each with or without the leading put
+		char *end = data + length;
+		while (data < end)
 		{
-			CLOSE_SOCKET(client->first);
+			char *newline = static_cast<char*>(memchr(data, '\n', end - data));
+			std::size_t count = (newline ? newline : end) - data;
+			if (state->partial.length() + count > STREAM_MAX_LINE)
+			{
+				const unsigned char status[2] = {
+					STREAM_CLOSE_TOO_BIG >> 8, STREAM_CLOSE_TOO_BIG & 0xff };
+				mg_websocket_write(state->conn,
+					MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE,
+					reinterpret_cast<const char*>(status), sizeof(status));
+				return false;
+			}
+
+			if (newline == nullptr)
+			{
+				state->partial.append(data, end - data);
+				break;
+			}
+
+			if (state->partial.empty())
+				ParseLine(state, data, newline - data, points);
+			else
+			{
+				state->partial.append(data, newline - data);
+				ParseLine(state, &state->partial[0], state->partial.length(), points);
+				state->partial.clear();
+			}
+
+			data = newline + 1;
 		}
-		m_ClientBuffers.clear();
 
-		if (m_Listener)
+		// a message always ends a line
+		if (last && !state->partial.empty())
 		{
-			CLOSE_SOCKET(m_Listener);
-			m_Listener = 0;
+			ParseLine(state, &state->partial[0], state->partial.length(), points);
+			state->partial.clear();
 		}
 
-#if defined(_WIN32) || defined(WIN32)
-		WSACleanup();
-#endif
+		return true;
+	}
+
+	void ParseLine(StreamConnection *state, char *data, std::size_t length,
+		std::size_t &points)
+	{
+		std::string_view line = CleanLine(data, length);
+		if (line.compare(0, 4, "put ") == 0)
+			line.remove_prefix(4);
+
+		if (line.empty())
+			return;
+
+		// counted in the next acknowledgement
+		std::string error;
+		if (state->batch.AddLine(line, error))
+			++points;
+		else
+			++state->errors;
 	}
 
-protected:
-	void *get_in_addr(struct sockaddr *sa)
+	bool ParseBinary(StreamConnection *state, const char *data,
+		std::size_t length, std::size_t &points)
 	{
-		if (sa->sa_family == AF_INET)
-			return &(((struct sockaddr_in*)sa)->sin_addr);
+		// frames may span messages, the decoder keeps the remainder
+		while (length > 0)
+		{
+			std::size_t space = 0;
+			char *buffer = state->decoder.GetWriteBuffer(space);
+			std::size_t count = std::min(space, length);
+			memcpy(buffer, data, count);
+			state->decoder.Commit(count);
+			data += count;
+			length -= count;
+
+			bool decoded = state->decoder.Decode(state->batch, points,
+				state->reply);
+			if (!state->reply.empty())
+			{
+				mg_websocket_write(state->conn, MG_WEBSOCKET_OPCODE_BINARY,
+					state->reply.data(), state->reply.length());
+				state->reply.clear();
+			}
+
+			if (!decoded)
+			{
+				// the REJECT frame has been sent
+				state->batch.Flush();
+				state->points += points;
+				m_Stats->AddPutCount(points);
+				return false;
+			}
+		}
 
-		return &(((struct sockaddr_in6*)sa)->sin6_addr);
+		return true;
 	}
 };
+#endif
 
 class HttpProcessor
 {
 private:
 	Datastore *m_DataStore;
 	Statistics *m_Stats;
+	RateLimiter *m_Limiter;	// null without rate limits
 
 	std::string m_BindAddr;
 	std::string m_BindPort;
 
+	// passed to civetweb as they are
+	std::string m_Threads;
+	std::string m_Queue;
+	std::string m_Timeout;
+	std::string m_KeepAlive;
+
 	mg_context *m_Ctx;
 	mg_callbacks m_Callbacks;
 
+#if defined(USE_WEBSOCKET)
+	StreamProcessor *m_Stream;
+#endif
+
 public:
 	HttpProcessor(const std::string &bindAddr, const std::string &port,
-		Datastore *datastore, Statistics *stats)
+		uint32_t threads, uint32_t queue, uint32_t timeout, uint32_t keepAlive,
+		Datastore *datastore, Statistics *stats, RateLimiter *limiter)
 		: m_BindAddr(bindAddr), m_BindPort(port), m_DataStore(datastore),
-		m_Stats(stats)
+		m_Stats(stats), m_Limiter(limiter)
 	{
+		m_Threads = std::to_string(threads);
+		m_Queue = std::to_string(queue);
+		m_Timeout = std::to_string(timeout);
+		m_KeepAlive = std::to_string(keepAlive);
+
 		m_Ctx = nullptr;
+#if defined(USE_WEBSOCKET)
+		m_Stream = nullptr;
+#endif
 	}
 
 	~HttpProcessor(void)
@@ -370,9 +1068,21 @@ public:
 
 		spdlog::info("Starting HTTP interface on {0}", bind.c_str());
 
+		// a keep-alive connection holds its worker until it goes idle
 		const char *options[] =
 		{
 			"listening_ports", bind.c_str(),
+			"num_threads", m_Threads.c_str(),
+			"connection_queue", m_Queue.c_str(),
+			"request_timeout_ms", m_Timeout.c_str(),
+			"enable_keep_alive", m_KeepAlive == "0" ? "no" : "yes",
+			"keep_alive_timeout_ms", m_KeepAlive.c_str(),
+			"tcp_nodelay", "1",
+#if defined(USE_WEBSOCKET)
+			// an idle stream is pinged, and closed if it doesn't answer
+			"websocket_timeout_ms", m_Timeout.c_str(),
+			"enable_websocket_ping_pong", "yes",
+#endif
 			NULL
 		};
 
@@ -390,6 +1100,16 @@ public:
 		mg_set_request_handler(m_Ctx, "/api/put", mg_put_handler, this);
 		mg_set_request_handler(m_Ctx, "/api/query", mg_query_handler, this);
 		mg_set_request_handler(m_Ctx, "/api/stats", mg_stats_handler, this);
+		mg_set_request_handler(m_Ctx, "/api/v1/write", mg_remote_write_handler, this);
+		mg_set_request_handler(m_Ctx, "/api/v2/write", mg_write_handler, this);
+		mg_set_request_handler(m_Ctx, "/write", mg_write_handler, this);
+
+#if defined(USE_WEBSOCKET)
+		m_Stream = new StreamProcessor(m_DataStore, m_Stats, m_Limiter);
+		if (m_Stream == nullptr || !m_Stream->StartThread())
+			return false;
+		m_Stream->Register(m_Ctx);
+#endif
 
 		spdlog::info("HTTP interface running");
 		return true;
@@ -406,6 +1126,16 @@ public:
 			m_Ctx = nullptr;
 		}
 
+#if defined(USE_WEBSOCKET)
+		// after civetweb, which closes the streams first
+		if (m_Stream)
+		{
+			m_Stream->StopThread();
+			delete m_Stream;
+			m_Stream = nullptr;
+		}
+#endif
+
 		spdlog::info("HTTP interface stopped");
 	}
 
@@ -427,6 +1157,24 @@ public:
 		return http->ApiPutHandler(conn);	// success
 	}
 
+	static int mg_write_handler(struct mg_connection *conn, void *cbdata)
+	{
+		HttpProcessor *http = static_cast<HttpProcessor*>(cbdata);
+		if (http == nullptr)
+			return mg_write_500(conn);
+
+		return http->ApiWriteHandler(conn);	// success
+	}
+
+	static int mg_remote_write_handler(struct mg_connection *conn, void *cbdata)
+	{
+		HttpProcessor *http = static_cast<HttpProcessor*>(cbdata);
+		if (http == nullptr)
+			return mg_write_500(conn);
+
+		return http->ApiRemoteWriteHandler(conn);	// success
+	}
+
 	static int mg_query_handler(struct mg_connection *conn, void *cbdata)
 	{
 		HttpProcessor *http = static_cast<HttpProcessor*>(cbdata);
@@ -451,104 +1199,245 @@ public:
 		const struct mg_request_info *request = mg_get_request_info(conn);
 		if (strcmp(request->request_method, "GET") != 0 &&
 			strcmp(request->request_method, "POST") != 0)
+			return mg_write_405(conn, request->request_method);
+
+		return mg_write_response(conn, 200, "OK", "Content-Type: text/text\r\n",
+			"[\r\n"
+			"\t\"avg\",\r\n"
+			"\t\"min\",\r\n"
+			"\t\"max\",\r\n"
+			"\t\"sum\"\r\n"
+			"]\r\n");
+	}
+
+	int32_t ApiPutHandler(struct mg_connection *conn)
+	{
+		const struct mg_request_info *request = mg_get_request_info(conn);
+		if (strcmp(request->request_method, "POST") != 0)
+			return mg_write_405(conn, request->request_method);
+
+		int32_t throttled = Throttle(conn);
+		if (throttled != 0)
+			return throttled;
+
+		// compressed bodies are inflated as they arrive, never in full
+		RequestBody body(conn);
+		const char *encoding = mg_get_header(conn, "Content-Encoding");
+		if (!body.SetEncoding(encoding))
+			return mg_write_415(conn, encoding);
+
+		const char *type = mg_get_header(conn, "Content-Type");
+		if (type && strncmp(type, "application/json", 16) == 0)
+			return PutJson(conn, body);
+
+		return PutLines(conn, body);
+	}
+
+	int32_t PutLines(struct mg_connection *conn, RequestBody &body)
+	{
+		// parse the body as it arrives, a buffer at a time; mg_read also
+		// decodes chunked bodies, which have no content length
+		LineFramer framer(HTTP_BUFFER_SIZE);
+		MetricBatch batch(m_DataStore);
+		std::size_t count = 0;
+		std::string error;
+
+		char *line = nullptr;
+		std::size_t length = 0;
+		for (;;)
 		{
-			mg_printf(conn,
-				"HTTP/1.1 405 Method Not Allowed\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n");
-			mg_printf(conn, "Error 405: %s requests not allowed for this endpoint.",
-				request->request_method);
+			std::size_t space = 0;
+			char *buffer = framer.GetWriteBuffer(space);
+			int32_t len = body.Read(buffer, space);
+			if (len < 0)
+				return PutFailed(conn, batch, count, body.GetError());
+			if (len == 0)
+				break;
+
+			framer.Commit(len);
+			while (framer.NextLine(line, length))
+			{
+				if (!PutLine(CleanLine(line, length), batch, count, error))
+					return PutFailed(conn, batch, count, error);
+			}
+		}
+
+		if (framer.LastLine(line, length) &&
+			!PutLine(CleanLine(line, length), batch, count, error))
+			return PutFailed(conn, batch, count, error);
 
-			return 405;	// this verb is not allowed
+		batch.Flush();
+		AddPuts(conn, count);
+
+		// complete the request
+		return mg_write_response(conn, 200, "OK", "", "");
+	}
+
+	int32_t PutJson(struct mg_connection *conn, RequestBody &body)
+	{
+		MetricBatch batch(m_DataStore);
+		JsonPutParser parser(batch);
+
+		// each piece is parsed as it arrives, no document is built
+		std::unique_ptr<char[]> buffer(new char[HTTP_BUFFER_SIZE]);
+		for (;;)
+		{
+			int32_t len = body.Read(buffer.get(), HTTP_BUFFER_SIZE);
+			if (len < 0)
+				return PutFailed(conn, batch, parser.GetCount(), body.GetError());
+			if (len == 0)
+				break;
+
+			if (!parser.Parse(buffer.get(), len))
+				return PutFailed(conn, batch, parser.GetCount(), parser.GetError());
 		}
 
-		mg_printf(conn,
-			"HTTP/1.1 200 OK\r\nContent-Type: text/text\r\nConnection: close\r\n\r\n");
-		mg_printf(conn, "[\r\n");
-		mg_printf(conn, "\t\"avg\",\r\n");
-		mg_printf(conn, "\t\"min\",\r\n");
-		mg_printf(conn, "\t\"max\",\r\n");
-		mg_printf(conn, "\t\"sum\"\r\n");
-		mg_printf(conn, "]\r\n");
+		if (!parser.Finish())
+			return PutFailed(conn, batch, parser.GetCount(), parser.GetError());
+
+		batch.Flush();
+		AddPuts(conn, parser.GetCount());
 
-		return 200;
+		// as OpenTSDB does
+		return mg_write_response(conn, 204, "No Content", "", "");
 	}
 
-	int32_t ApiPutHandler(struct mg_connection *conn)
+	// Influx line protocol, as /write (1.x) and /api/v2/write (2.x)
+	int32_t ApiWriteHandler(struct mg_connection *conn)
 	{
 		const struct mg_request_info *request = mg_get_request_info(conn);
 		if (strcmp(request->request_method, "POST") != 0)
+			return mg_write_405(conn, request->request_method);
+
+		int32_t throttled = Throttle(conn);
+		if (throttled != 0)
+			return throttled;
+
+		// timestamps are in nanoseconds unless the client says otherwise
+		uint64_t divisor = 1000000000;
+		char precision[8];
+		if (request->query_string && mg_get_var(request->query_string,
+			strlen(request->query_string), "precision", precision, sizeof(precision)) > 0 &&
+			!InfluxParser::GetDivisor(precision, divisor))
+			return mg_write_400(conn, "write: invalid precision\r\n");
+
+		RequestBody body(conn);
+		const char *encoding = mg_get_header(conn, "Content-Encoding");
+		if (!body.SetEncoding(encoding))
+			return mg_write_415(conn, encoding);
+
+		LineFramer framer(HTTP_BUFFER_SIZE);
+		MetricBatch batch(m_DataStore);
+		InfluxParser parser(batch, divisor);
+		std::size_t count = 0;
+		std::string error;
+
+		char *line = nullptr;
+		std::size_t length = 0;
+		for (;;)
 		{
-			mg_printf(conn,
-				"HTTP/1.1 405 Method Not Allowed\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n");
-			mg_printf(conn, "Error 405: %s requests not allowed for this endpoint.",
-				request->request_method);
-	
-			return 405;	// this verb is not allowed
+			std::size_t space = 0;
+			char *buffer = framer.GetWriteBuffer(space);
+			int32_t len = body.Read(buffer, space);
+			if (len < 0)
+				return PutFailed(conn, batch, count, body.GetError());
+			if (len == 0)
+				break;
+
+			framer.Commit(len);
+			while (framer.NextLine(line, length))
+			{
+				if (!parser.ParseLine(std::string_view(line, length), count, error))
+					return PutFailed(conn, batch, count, error);
+			}
 		}
-	
-		// read in the post data
-		std::unique_ptr<char[]> buffer(new char[request->content_length + 1]);
-		if (!buffer)
+
+		if (framer.LastLine(line, length) &&
+			!parser.ParseLine(std::string_view(line, length), count, error))
+			return PutFailed(conn, batch, count, error);
+
+		batch.Flush();
+		AddPuts(conn, count);
+
+		// as Influx does
+		return mg_write_response(conn, 204, "No Content", "", "");
+	}
+
+	// Prometheus remote_write, snappy compressed protobuf
+	int32_t ApiRemoteWriteHandler(struct mg_connection *conn)
+	{
+		const struct mg_request_info *request = mg_get_request_info(conn);
+		if (strcmp(request->request_method, "POST") != 0)
+			return mg_write_405(conn, request->request_method);
+
+		int32_t throttled = Throttle(conn);
+		if (throttled != 0)
+			return throttled;
+
+		const char *encoding = mg_get_header(conn, "Content-Encoding");
+		if (encoding == nullptr || mg_strcasecmp(encoding, "snappy") != 0)
+			return mg_write_415(conn, encoding ? encoding : "identity");
+
+		// only the 1.0 message is understood
+		const char *type = mg_get_header(conn, "Content-Type");
+		if (type && strstr(type, "io.prometheus.write.v2") != nullptr)
+			return mg_write_error(conn, 415, "Unsupported Media Type",
+				"remote_write 2.0 is not supported.");
+
+		if (request->content_length > REMOTE_WRITE_MAX_BODY)
+			return mg_write_413(conn);
+
+		std::string compressed;
+		if (request->content_length > 0)
+			compressed.reserve((std::size_t)request->content_length);
+
+		// room for one byte more than allowed, to tell a body of exactly
+		// the limit from a longer one
+		std::size_t length = 0;
+		for (;;)
 		{
-			spdlog::warn("Failed to allocate buffer");
-			return mg_write_500(conn);
+			compressed.resize(std::min<std::size_t>(length + HTTP_BUFFER_SIZE,
+				REMOTE_WRITE_MAX_BODY + 1));
+			int32_t len = mg_read(conn, &compressed[length],
+				compressed.length() - length);
+			if (len < 0)
+				return mg_write_400(conn, "write: Failed to read the request body\r\n");
+			if (len == 0)
+				break;
+
+			length += len;
+			if (length > REMOTE_WRITE_MAX_BODY)
+				return mg_write_413(conn);
 		}
-	
-		memset(buffer.get(), 0, request->content_length + 1);
-	
-		int64_t len = mg_read(conn, buffer.get(), request->content_length);
-		if (len > 0)
-		{
-			std::istringstream iss(buffer.get());
-			std::string line;
-			std::size_t count = 0;
-			while (std::getline(iss, line))
-			{
-				// clean the line
-				line.erase(std::remove_if(line.begin(), line.end(), isValidChar), line.end());
-	
-				// the line may be empty, so check that
-				if (line.length() == 0)
-					continue;
 
-				std::string error;
-				Metric metric(line);
-				if (metric.IsValid(error))
-				{
-					++count;
+		std::string body;
+		std::string error;
+		if (!SnappyUncompress(compressed.data(), length, body,
+			REMOTE_WRITE_MAX_REQUEST, error))
+			return mg_write_400(conn, "write: " + error + "\r\n");
 
-					// queue this metric
-					m_DataStore->QueueMetric(metric);
+		MetricBatch batch(m_DataStore);
+		RemoteWriteDecoder decoder(batch);
+		std::size_t count = 0;
+		std::size_t rejected = 0;
+		if (!decoder.Decode(body.data(), body.length(), count, rejected, error))
+			return PutFailed(conn, batch, count, error);
 
-					// complete the request
-					mg_printf(conn,
-						"HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
-				}
-				else
-				{
-					std::ostringstream err;
-					err << "put: invalid value: " << error << "\r\n";
-					return mg_write_400(conn, err.str());
-				}
-			}
+		batch.Flush();
+		AddPuts(conn, count);
 
-			m_Stats->AddPutCount(count);
-		}
-	
-		return 200;
+		if (rejected > 0)
+			spdlog::warn("remote_write: skipped {0} series without tags or with "
+				"spaces in their labels", rejected);
+
+		return mg_write_response(conn, 204, "No Content", "", "");
 	}
-	
+
 	int32_t ApiQueryHandler(struct mg_connection *conn)
 	{
 		const struct mg_request_info *request = mg_get_request_info(conn);
 		if (strcmp(request->request_method, "GET") != 0)
-		{
-			mg_printf(conn,
-				"HTTP/1.1 405 Method Not Allowed\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n");
-			mg_printf(conn, "Error 405: %s requests not allowed for this endpoint.",
-				request->request_method);
-	
-			return 405;	// this verb is not allowed
-		}
+			return mg_write_405(conn, request->request_method);
 	
 		// Step 1: break up the query string into parts
 		std::string query(request->query_string);
@@ -574,7 +1463,7 @@ public:
 		uint64_t curTime = time(nullptr);
 		uint64_t startTime = 0;
 		uint64_t endTime = curTime;	// by default, the end time is now
-		std::vector<ResultSet*> subqueries;
+		std::vector<std::string> metrics;
 
 		// Step 2: Identify the parts and process them
 		for (std::vector<std::string>::iterator part = parts.begin();
@@ -590,30 +1479,35 @@ public:
 			}
 			else if ((*part).find("m=") == 0)
 			{
-				Query q((*part).substr(2));
-
-				ResultSet *rs = m_DataStore->PrepareQuery(q);
-				if (rs)
-					subqueries.push_back(rs);
+				metrics.push_back((*part).substr(2));
 			}
 		}
 
 		nlohmann::json response;
 
-		// Step 4: Get the result sets
-		for (std::vector<ResultSet*>::iterator resultset = subqueries.begin();
-			resultset != subqueries.end(); ++resultset)
+		// Step 3: Run the sub queries, now that the time range is known; each
+		// one is executed right after it is prepared, as a prepared query
+		// holds off sealing its metric
+		for (std::vector<std::string>::iterator metric = metrics.begin();
+			metric != metrics.end(); ++metric)
 		{
+			Query q(*metric);
+
+			ResultSet *resultset = m_DataStore->PrepareQuery(q, startTime, endTime);
+			if (resultset == nullptr)
+				continue;
+
+			// Step 4: Get the result set
 			std::vector<ResultSet::dps> results;
-			if ((*resultset)->Execute(startTime, endTime, results))
+			if (resultset->Execute(startTime, endTime, results))
 			{
 				nlohmann::json jr;
 
-				jr["metric"] = (*resultset)->GetMetric();
+				jr["metric"] = resultset->GetMetric();
 
 				// Step 5: downsample the data
 				std::vector<ResultSet::dps> output;
-				Downsampler ds((*resultset)->GetDownsampler());
+				Downsampler ds(resultset->GetDownsampler());
 				if (ds.Decimate(results, output) > 0)
 				{
 					// Step 6: serialize each result set
@@ -629,60 +1523,201 @@ public:
 				response.push_back(jr);
 			}
 
-			delete (*resultset);
+			delete resultset;
 		}
 
 		// Step 7: write the data to the client
-		mg_printf(conn,
-			"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n");
-		mg_printf(conn, response.dump(1).c_str());
-
-		return 200;
+		return mg_write_response(conn, 200, "OK",
+			"Content-Type: application/json\r\n", response.dump(1));
 	}
 
 	int32_t ApiStatsHandler(struct mg_connection *conn)
 	{
 		const struct mg_request_info *request = mg_get_request_info(conn);
 		if (strcmp(request->request_method, "GET") != 0)
+			return mg_write_405(conn, request->request_method);
+
+		Statistics::Stats stats;
+		m_Stats->GetStats(stats);
+
+		char body[256];
+		snprintf(body, sizeof(body),
+			"Puts/second: %.2f\r\n"
+			"Writes/second: %.2f\r\n"
+			"Queue backlog: %.2f\r\n"
+			"UDP drops/second: %.2f\r\n"
+			"Series: %llu\r\n"
+			"Series over limit/second: %.2f\r\n",
+			stats.putsPerSecond, stats.writesPerSecond, stats.queueBacklog,
+			stats.udpDropsPerSecond,
+			(unsigned long long)m_DataStore->GetSeriesCount(),
+			stats.seriesOverLimitPerSecond);
+		std::string text(body);
+
+		// the metrics that have run into the series limits
+		std::vector<Datastore::SeriesStats> metrics;
+		m_DataStore->GetSeriesStats(metrics);
+		for (std::vector<Datastore::SeriesStats>::iterator metric = metrics.begin();
+			metric != metrics.end(); ++metric)
 		{
-			mg_printf(conn,
-				"HTTP/1.1 405 Method Not Allowed\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n");
-			mg_printf(conn, "Error 405: %s requests not allowed for this endpoint.",
-				request->request_method);
+			snprintf(body, sizeof(body),
+				"Metric %s: %llu series, %llu over limit\r\n",
+				metric->metric.c_str(), (unsigned long long)metric->series,
+				(unsigned long long)metric->overLimit);
+			text.append(body);
+		}
 
-			return 405;	// this verb is not allowed
+		// the clients that have run into their rate limits
+		if (m_Limiter)
+		{
+			std::vector<RateLimiter::ClientStats> clients;
+			m_Limiter->GetStats(clients);
+			for (std::vector<RateLimiter::ClientStats>::iterator client = clients.begin();
+				client != clients.end(); ++client)
+			{
+				snprintf(body, sizeof(body),
+					"Client %s: throttled %llu, dropped %llu\r\n",
+					client->address.c_str(), (unsigned long long)client->throttled,
+					(unsigned long long)client->dropped);
+				text.append(body);
+			}
 		}
 
-		mg_printf(conn,
-			"HTTP/1.1 200 OK\r\nContent-Type: text/text\r\nRefresh: 5;url=/api/stats\r\nConnection: close\r\n\r\n");
+		return mg_write_response(conn, 200, "OK",
+			"Content-Type: text/text\r\nRefresh: 5;url=/api/stats\r\n", text);
+	}
 
-		Statistics::Stats stats;
-		m_Stats->GetStats(stats);
+private:
+	static bool PutLine(std::string_view line, MetricBatch &batch,
+		std::size_t &count, std::string &error)
+	{
+		// the line may be empty, so check that
+		if (line.length() == 0)
+			return true;
+
+		// queue this metric
+		if (!batch.AddLine(line, error))
+			return false;
 
-		mg_printf(conn, "Puts/second: %.2f\r\n", stats.putsPerSecond);
-		mg_printf(conn, "Writes/second: %.2f\r\n", stats.writesPerSecond);
-		mg_printf(conn, "Queue backlog: %.2f\r\n", stats.queueBacklog);
+		++count;
+		return true;
+	}
+
+	// refuses a write from a client over its rate, 0 if it may go ahead
+	int32_t Throttle(struct mg_connection *conn)
+	{
+		if (m_Limiter == nullptr)
+			return 0;
 
-		return 200;
+		RateLimiter::client_t client = m_Limiter->GetClient(
+			mg_get_request_info(conn)->remote_addr);
+		uint32_t delay = m_Limiter->GetDelay(*client, nullptr);
+		if (delay == 0)
+			return 0;
+
+		m_Limiter->AddDropped(*client);
+		return mg_write_429(conn, delay);
 	}
 
-private:
-	static int mg_write_500(struct mg_connection *conn)
+	// counts the points against the client's rate too
+	void AddPuts(struct mg_connection *conn, std::size_t count)
+	{
+		m_Stats->AddPutCount(count);
+
+		if (m_Limiter)
+			m_Limiter->Charge(*m_Limiter->GetClient(
+				mg_get_request_info(conn)->remote_addr), nullptr, count);
+	}
+
+	int32_t PutFailed(struct mg_connection *conn, MetricBatch &batch,
+		std::size_t count, const std::string &error)
+	{
+		// the points before the error are kept
+		batch.Flush();
+		AddPuts(conn, count);
+
+		std::ostringstream err;
+		err << "put: invalid value: " << error << "\r\n";
+		return mg_write_400(conn, err.str());
+	}
+
+	// a complete response, sized so that the connection can be kept open
+	static int mg_write_response(struct mg_connection *conn, int status,
+		const char *reason, const char *headers, const std::string &body)
+	{
+		if (status == 204)
+			mg_printf(conn, "HTTP/1.1 204 %s\r\n%s\r\n", reason, headers);
+		else
+		{
+			mg_printf(conn, "HTTP/1.1 %d %s\r\n%sContent-Length: %zu\r\n\r\n",
+				status, reason, headers, body.length());
+			mg_write(conn, body.data(), body.length());
+		}
+
+		return status;
+	}
+
+	// errors close the connection, as the request body may not have been
+	// read to its end; civetweb then skips reading the rest of it
+	static int mg_write_error(struct mg_connection *conn, int status,
+		const char *reason, const std::string &message, const char *headers = "")
 	{
+		mg_set_must_close(conn);
+
+		std::ostringstream body;
+		body << "Error " << status << ": " << message;
+		std::string text = body.str();
+
 		mg_printf(conn,
-			"HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n");
-		mg_printf(conn, "Error 500: Internal Server Error.");
+			"HTTP/1.1 %d %s\r\nContent-Type: text/html\r\n%sContent-Length: %zu\r\nConnection: close\r\n\r\n",
+			status, reason, headers, text.length());
+		mg_write(conn, text.data(), text.length());
+
+		return status;
+	}
 
-		return 500;	// this shouldn't have happened
+	static int mg_write_500(struct mg_connection *conn)
+	{
+		// this shouldn't have happened
+		return mg_write_error(conn, 500, "Internal Server Error",
+			"Internal Server Error.");
 	}
 
 	static int mg_write_400(struct mg_connection *conn, const std::string &error)
 	{
-		mg_printf(conn,
-			"HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n");
-		mg_printf(conn, "Error 400: %s", error.c_str());
+		return mg_write_error(conn, 400, "Bad Request", error);
+	}
+
+	static int mg_write_405(struct mg_connection *conn, const char *method)
+	{
+		std::string error(method);
+		error.append(" requests not allowed for this endpoint.");
+		return mg_write_error(conn, 405, "Method Not Allowed", error);
+	}
 
-		return 400;	// this shouldn't have happened
+	static int mg_write_413(struct mg_connection *conn)
+	{
+		// won't be buffered
+		return mg_write_error(conn, 413, "Payload Too Large",
+			"The request body is too large.");
+	}
+
+	static int mg_write_415(struct mg_connection *conn, const char *encoding)
+	{
+		// can't read this body
+		std::string error(encoding);
+		error.append(" encoding is not supported.");
+		return mg_write_error(conn, 415, "Unsupported Media Type", error);
+	}
+
+	static int mg_write_429(struct mg_connection *conn, uint32_t delay)
+	{
+		// in whole seconds, rounded up
+		std::string retry("Retry-After: ");
+		retry.append(std::to_string((delay + 999) / 1000));
+		retry.append("\r\n");
+		return mg_write_error(conn, 429, "Too Many Requests",
+			"The client is over its rate limit.", retry.c_str());
 	}
 
 	static int mg_log_message(const struct mg_connection *conn, const char *message)
@@ -699,37 +1734,85 @@ private:
 };
 
 NetworkProcessor::NetworkProcessor(const std::string &bindAddr,
-	Datastore *datastore, Statistics *stats)
+	Datastore *datastore, Statistics *stats, uint32_t connectionRate,
+	uint32_t addressRate, uint32_t burst)
 	: m_BindAddr(bindAddr), m_DataStore(datastore), m_Stats(stats)
 {
 	m_Telnet = nullptr;
+	m_Binary = nullptr;
+	m_Udp = nullptr;
 	m_Http = nullptr;
+
+	m_Uring = false;
+
+	m_Limiter = nullptr;
+	if (connectionRate > 0 || addressRate > 0)
+	{
+		m_Limiter = new RateLimiter(connectionRate, addressRate, burst);
+		if (m_Limiter == nullptr)
+			throw std::runtime_error("Failed to create rate limiter");
+	}
 }
 
 NetworkProcessor::~NetworkProcessor(void)
 {
+	delete m_Limiter;
+}
+
+void NetworkProcessor::ConfigureReactors(bool uring)
+{
+	m_Uring = uring;
 }
 
 bool NetworkProcessor::StartTelnetInterface(const std::string &port,
-	uint32_t backlog)
+	uint32_t backlog, uint32_t threads, uint32_t parsers)
 {
 	if (port == "0")
 		return true; // we are not starting this up
 
-	m_Telnet = new TelnetProcessor(m_BindAddr, port, backlog,
-		m_DataStore, m_Stats);
+	m_Telnet = new TelnetProcessor(m_BindAddr, port, backlog, threads,
+		parsers, m_Uring, m_DataStore, m_Stats, m_Limiter);
 	if (m_Telnet == nullptr)
 		return false;
 
 	return m_Telnet->StartThread();
 }
 
-bool NetworkProcessor::StartHTTPInterface(const std::string &port)
+bool NetworkProcessor::StartBinaryInterface(const std::string &port,
+	uint32_t backlog, uint32_t threads)
+{
+	if (port == "0")
+		return true; // we are not starting this up
+
+	m_Binary = new BinaryProcessor(m_BindAddr, port, backlog, threads,
+		m_Uring, m_DataStore, m_Stats);
+	if (m_Binary == nullptr)
+		return false;
+
+	return m_Binary->StartThread();
+}
+
+bool NetworkProcessor::StartUDPInterface(const std::string &port,
+	int32_t bufferSize)
+{
+	if (port == "0")
+		return true; // we are not starting this up
+
+	m_Udp = new UdpProcessor(m_BindAddr, port, bufferSize, m_DataStore, m_Stats);
+	if (m_Udp == nullptr)
+		return false;
+
+	return m_Udp->StartThread();
+}
+
+bool NetworkProcessor::StartHTTPInterface(const std::string &port,
+	uint32_t threads, uint32_t queue, uint32_t timeout, uint32_t keepAlive)
 {
 	if (port == "0")
 		return true; // we are not starting this up
 
-	m_Http = new HttpProcessor(m_BindAddr, port, m_DataStore, m_Stats);
+	m_Http = new HttpProcessor(m_BindAddr, port, threads, queue, timeout,
+		keepAlive, m_DataStore, m_Stats, m_Limiter);
 	if (m_Http == nullptr)
 		return false;
 
@@ -746,6 +1829,26 @@ void NetworkProcessor::StopTelnetInterface(void)
 	}
 }
 
+void NetworkProcessor::StopBinaryInterface(void)
+{
+	if (m_Binary)
+	{
+		m_Binary->StopThread();
+		delete m_Binary;
+		m_Binary = nullptr;
+	}
+}
+
+void NetworkProcessor::StopUDPInterface(void)
+{
+	if (m_Udp)
+	{
+		m_Udp->StopThread();
+		delete m_Udp;
+		m_Udp = nullptr;
+	}
+}
+
 void NetworkProcessor::StopHTTPInterface(void)
 {
 	if (m_Http)
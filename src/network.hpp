@@ -15,7 +15,10 @@
 #include "stats.hpp"
 
 class TelnetProcessor;
+class BinaryProcessor;
+class UdpProcessor;
 class HttpProcessor;
+class RateLimiter;
 
 class NetworkProcessor
 {
@@ -26,17 +29,40 @@ private:
 	Statistics *m_Stats;
 
 	TelnetProcessor *m_Telnet;
+	BinaryProcessor *m_Binary;
+	UdpProcessor *m_Udp;
 	HttpProcessor *m_Http;
 
+	RateLimiter *m_Limiter;	// null without rate limits
+	bool m_Uring;
+
 public:
+	// the rates are the data points per second a telnet connection, and
+	// all the telnet connections and HTTP writes from one address, may
+	// send; burst is the seconds of that rate they may send at once
 	NetworkProcessor(const std::string &bindAddr,
-		Datastore *datastore, Statistics *stats);
+		Datastore *datastore, Statistics *stats, uint32_t connectionRate = 0,
+		uint32_t addressRate = 0, uint32_t burst = 1);
 	~NetworkProcessor(void);
 
+	// whether the telnet and binary interfaces use io_uring, where the
+	// kernel supports it; set before they are started
+	void ConfigureReactors(bool uring);
+
+	// parsers is the number of threads parsing what the telnet threads
+	// receive, 0 parses on the telnet threads themselves
 	bool StartTelnetInterface(const std::string &port,
-		uint32_t backlog = 10);
-	bool StartHTTPInterface(const std::string &port);
+		uint32_t backlog = 10, uint32_t threads = 1, uint32_t parsers = 1);
+	bool StartBinaryInterface(const std::string &port,
+		uint32_t backlog = 10, uint32_t threads = 1);
+	bool StartUDPInterface(const std::string &port, int32_t bufferSize = 0);
+	// timeout and keepAlive are in milliseconds, a keepAlive of 0 closes
+	// every connection after its request
+	bool StartHTTPInterface(const std::string &port, uint32_t threads = 50,
+		uint32_t queue = 20, uint32_t timeout = 30000, uint32_t keepAlive = 500);
 
 	void StopTelnetInterface(void);
+	void StopBinaryInterface(void);
+	void StopUDPInterface(void);
 	void StopHTTPInterface(void);
 };
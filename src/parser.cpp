@@ -0,0 +1,222 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Parser pool
+ *
+ */
+
+#include "parser.hpp"
+#include "thread.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+
+#define PARSER_BULK_COUNT	64
+#define POLL_TIMEOUT_MS		50	// how quickly a stopping thread notices
+
+class ParserWorker : public ThreadProc
+{
+private:
+	// a null buffer marks a closed connection
+	struct Task
+	{
+		void *state;
+		char *buffer;
+		std::size_t length;
+	};
+
+	ParserPool *m_Pool;
+	ParserHandler *m_Handler;
+	void *m_Context;
+	bool m_HasContext;
+
+	moodycamel::ConcurrentQueue<Task> m_Queue;
+
+	// an idle worker sleeps until something is queued
+	std::mutex m_Lock;
+	std::condition_variable m_Wake;
+	std::atomic_bool m_Idle;
+
+	Thread *m_Thread;
+
+public:
+	ParserWorker(ParserPool *pool, ParserHandler *handler)
+		: m_Pool(pool), m_Handler(handler), m_Context(nullptr),
+		  m_HasContext(false), m_Idle(false)
+	{
+		m_Thread = new Thread(this);
+		if (m_Thread == nullptr)
+			throw std::runtime_error("Failed to create parser thread");
+	}
+
+	~ParserWorker(void)
+	{
+		delete m_Thread;
+	}
+
+	bool StartThread(void)
+	{
+		return m_Thread->Start();
+	}
+
+	void StopThread(void)
+	{
+		m_Thread->Stop();
+	}
+
+	void Push(void *state, char *buffer, std::size_t length)
+	{
+		// the implicit producer of each thread keeps its items in order
+		Task task = { state, buffer, length };
+		m_Queue.enqueue(task);
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_Idle.load())
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+			m_Wake.notify_one();
+		}
+	}
+
+	void Start(void)
+	{
+		m_Context = m_Handler->OnWorkerStart();
+		m_HasContext = true;
+	}
+
+	void Process(void)
+	{
+		if (Parse())
+			return;
+
+		std::unique_lock<std::mutex> lock(m_Lock);
+		m_Idle.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_Queue.size_approx() == 0)
+			m_Wake.wait_for(lock, std::chrono::milliseconds(POLL_TIMEOUT_MS));
+		m_Idle.store(false);
+	}
+
+	void Stop(void)
+	{
+		// the reactors have stopped, nothing more will be queued
+		while (Parse())
+			;
+
+		if (m_HasContext)
+		{
+			m_Handler->OnWorkerStop(m_Context);
+			m_Context = nullptr;
+			m_HasContext = false;
+		}
+	}
+
+private:
+	bool Parse(void)
+	{
+		Task tasks[PARSER_BULK_COUNT];
+		std::size_t count = m_Queue.try_dequeue_bulk(tasks, PARSER_BULK_COUNT);
+		if (count == 0)
+			return false;
+
+		for (std::size_t t = 0; t < count; t++)
+		{
+			if (tasks[t].buffer)
+			{
+				m_Handler->OnParse(m_Context, tasks[t].state, tasks[t].buffer,
+					tasks[t].length);
+				m_Pool->Release(tasks[t].buffer);
+			}
+			else
+				m_Handler->OnRelease(m_Context, tasks[t].state);
+		}
+
+		m_Handler->OnFlush(m_Context);
+		return true;
+	}
+};
+
+ParserPool::ParserPool(uint32_t workers, ParserHandler *handler)
+	: m_WorkerCount(workers), m_Handler(handler), m_Next(0), m_Allocated(0)
+{
+	if (m_WorkerCount == 0)
+		m_WorkerCount = 1;
+}
+
+ParserPool::~ParserPool(void)
+{
+	Stop();
+
+	char *buffer = nullptr;
+	while (m_Free.try_dequeue(buffer))
+		delete [] buffer;
+}
+
+bool ParserPool::Start(void)
+{
+	for (uint32_t w = 0; w < m_WorkerCount; w++)
+	{
+		ParserWorker *worker = new ParserWorker(this, m_Handler);
+		m_Workers.push_back(worker);
+
+		if (!worker->StartThread())
+		{
+			spdlog::error("Failed to start parser thread {0}", w);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ParserPool::Stop(void)
+{
+	for (std::vector<ParserWorker*>::iterator worker = m_Workers.begin();
+		worker != m_Workers.end(); ++worker)
+	{
+		(*worker)->StopThread();
+		delete *worker;
+	}
+	m_Workers.clear();
+}
+
+uint32_t ParserPool::Assign(void)
+{
+	return m_Next.fetch_add(1) % m_WorkerCount;
+}
+
+bool ParserPool::IsFull(void) const
+{
+	return m_Allocated.load(std::memory_order_relaxed) >= PARSER_MAX_BUFFERS &&
+		m_Free.size_approx() == 0;
+}
+
+char* ParserPool::Acquire(void)
+{
+	char *buffer = nullptr;
+	if (m_Free.try_dequeue(buffer))
+		return buffer;
+
+	m_Allocated.fetch_add(1, std::memory_order_relaxed);
+	return new char[PARSER_BUFFER_SIZE];
+}
+
+void ParserPool::Release(char *buffer)
+{
+	m_Free.enqueue(buffer);
+}
+
+void ParserPool::Submit(uint32_t worker, void *state, char *buffer,
+	std::size_t length)
+{
+	m_Workers[worker]->Push(state, buffer, length);
+}
+
+void ParserPool::Close(uint32_t worker, void *state)
+{
+	m_Workers[worker]->Push(state, nullptr, 0);
+}
@@ -0,0 +1,101 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Parser pool
+ *
+ * Moves parsing off the reactor threads. A reactor thread copies what it
+ * receives into a buffer taken from the pool and queues it, unparsed, to
+ * the worker its connection was assigned to. Each worker has its own
+ * lock-free queue, so the buffers of one connection are parsed in the
+ * order they arrived while different connections are parsed on different
+ * cores. Buffers return to the pool once parsed; when too many are
+ * waiting a reactor thread pauses the connections it would read until
+ * one comes back, which pushes back on the clients instead of growing
+ * without bound.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "concurrentqueue.h"
+
+#define PARSER_BUFFER_SIZE	65536
+#define PARSER_MAX_BUFFERS	256		// received but not yet parsed
+#define PARSER_FULL_DELAY_MS	1	// how long a connection waits for one
+
+class ParserHandler
+{
+public:
+	virtual ~ParserHandler(void) {}
+
+	// returns the state kept by each worker, for anything that mustn't be
+	// shared between workers; passed to OnParse, OnFlush and OnRelease
+	virtual void* OnWorkerStart(void)
+	{
+		return nullptr;
+	}
+
+	virtual void OnWorkerStop(void *context)
+	{
+	}
+
+	// a buffer received on a connection; workers are called concurrently,
+	// but only ever one for the same connection
+	virtual void OnParse(void *context, void *state, const char *data,
+		std::size_t length) = 0;
+
+	// called after each batch of buffers a worker takes from its queue
+	virtual void OnFlush(void *context)
+	{
+	}
+
+	// the connection has closed and everything it sent has been parsed
+	virtual void OnRelease(void *context, void *state) = 0;
+};
+
+class ParserWorker;
+
+class ParserPool
+{
+private:
+	uint32_t m_WorkerCount;
+	ParserHandler *m_Handler;
+
+	std::vector<ParserWorker*> m_Workers;
+	std::atomic<uint32_t> m_Next;
+
+	moodycamel::ConcurrentQueue<char*> m_Free;
+	std::atomic_size_t m_Allocated;
+
+public:
+	ParserPool(uint32_t workers, ParserHandler *handler);
+	~ParserPool(void);
+
+	bool Start(void);
+
+	// parses whatever is still queued before returning
+	void Stop(void);
+
+	// the worker for a new connection; all of its buffers go to that one
+	uint32_t Assign(void);
+
+	// true while too many buffers are queued; a reactor thread checks it
+	// before reading, so the limit is passed by at most one buffer for
+	// each reactor thread
+	bool IsFull(void) const;
+
+	// a buffer of PARSER_BUFFER_SIZE bytes, never waits
+	char* Acquire(void);
+	void Release(char *buffer);
+
+	// a connection's buffers must all be submitted, and closed, from the
+	// same thread, which keeps them in order
+	void Submit(uint32_t worker, void *state, char *buffer,
+		std::size_t length);
+	void Close(uint32_t worker, void *state);
+};
@@ -0,0 +1,27 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Point
+ *
+ * The record queued between the producers and the datastore writer. A
+ * Metric is parsed and checked by its producer; once valid, its name
+ * and canonical tag set are interned and the point only carries their
+ * IDs, so it is small and trivially copyable.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+struct Point
+{
+	uint64_t timestamp;
+	double value;
+	uint32_t metric;	// interned metric name
+	uint32_t series;	// interned canonical tag set
+};
+
+static_assert(std::is_trivially_copyable<Point>::value,
+	"points are copied as plain memory");
@@ -11,15 +11,12 @@
 #include "spdlog/spdlog.h"
 #include "sql-builder/sql.h"
 
+#include <cstring>
 #include <sstream>
 
 Query::Query(const std::string &query)
+	: m_Valid(false)
 {
-	sql::SelectModel sql;
-	sql.from("METRIC");
-	sql.group_by("timestamp");
-	sql.where("(timestamp >= ?001 and timestamp <= ?002)");
-
 	// process the query string
 	// it's a fixed format, so we can make assumptions
 	std::vector<std::string> elems;
@@ -31,9 +28,13 @@ Query::Query(const std::string &query)
 	}
 	else
 	{
-		std::string agg(elems[0]);
-		agg.append("(value) as value");
-		sql.select("timestamp", agg);
+		m_Aggregator = elems[0];
+		if (m_Aggregator != "avg" && m_Aggregator != "sum" &&
+			m_Aggregator != "min" && m_Aggregator != "max")
+		{
+			spdlog::info("Invalid aggregator: {0}", m_Aggregator.c_str());
+			return;
+		}
 
 		// get the metric name
 		std::string::size_type ob = elems[1].find('{');
@@ -61,11 +62,6 @@ Query::Query(const std::string &query)
 			for (std::vector<std::string>::iterator filter = filters.begin();
 				filter != filters.end(); ++filter)
 			{
-				std::ostringstream oss;
-
-				// replace the wildcard with something we use internally
-				std::replace((*filter).begin(), (*filter).end(), '*', '%');
-
 				// split the filter into parts
 				std::vector<std::string> filterparts;
 				std::size_t fp = SplitString((*filter), '=', filterparts);
@@ -76,41 +72,15 @@ Query::Query(const std::string &query)
 				}
 				else
 				{
+					Filter f;
+					f.key = filterparts[0];
+
 					// check to see if there is a | in the filter and update accordingly
-					std::vector<std::string> orparts;
-					std::size_t op = SplitString(filterparts[1], '|', orparts);
-					if (op > 0)
-					{
-						oss << "and (";
-
-						for (std::size_t i = 0; i < orparts.size(); i++)
-						{
-							std::string nf("tags like '%");
-							nf.append(filterparts[0]);
-							nf.append("=");
-							nf.append(orparts[i]);
-							nf.append("%'");
-
-							oss << nf;
-							if (i < orparts.size() - 1)
-								oss << " or ";
-						}
-
-						oss << ")";
-					}
-					else
-					{
-						std::string nf("tags like '%");
-						nf.append(filterparts[0]);
-						nf.append("=");
-						nf.append(filterparts[1]);
-						nf.append("%'");
-						if (oss.str().length() > 0)
-							oss << " and ";
-						oss << nf;
-					}
-
-					sql.where(oss.str());
+					SplitString(filterparts[1], '|', f.values);
+					if (f.values.empty())
+						f.values.push_back("*");
+
+					m_Filters.push_back(f);
 				}
 			}
 		}
@@ -119,9 +89,104 @@ Query::Query(const std::string &query)
 			m_Downsampler = elems[2];
 	}
 
-	m_Query.assign(sql.str());
+	m_Valid = true;
 }
 
 Query::~Query(void)
 {
 }
+
+std::string Query::GetSeriesQuery(std::size_t count) const
+{
+	if (!m_Valid || count == 0)
+		return std::string();
+
+	// the series were resolved by the tag index, and TAGS is indexed
+	sql::SelectModel sql;
+	sql.select("timestamp", "sum(value)", "count(value)", "min(value)", "max(value)");
+	sql.from("METRIC");
+	sql.group_by("timestamp");
+	sql.where("(timestamp >= ?001 and timestamp <= ?002)");
+
+	std::ostringstream oss;
+	oss << "and tags in (";
+	for (std::size_t i = 0; i < count; i++)
+	{
+		if (i > 0)
+			oss << ", ";
+		oss << "?" << (i + 3);
+	}
+	oss << ")";
+
+	sql.where(oss.str());
+	return sql.str();
+}
+
+bool Query::MayMatch(const BloomFilter &bloom) const
+{
+	for (std::vector<Filter>::const_iterator filter = m_Filters.begin();
+		filter != m_Filters.end(); ++filter)
+	{
+		// every filter needs its key to be present
+		if (!bloom.MayContain(filter->key.c_str(), filter->key.length()))
+			return false;
+
+		// literal values can be checked as key=value pairs
+		bool wildcard = false;
+		bool found = false;
+		for (std::vector<std::string>::const_iterator value = filter->values.begin();
+			value != filter->values.end() && !found; ++value)
+		{
+			if (value->find('*') != std::string::npos)
+			{
+				wildcard = true;
+				break;
+			}
+
+			std::string pair(filter->key);
+			pair.append("=");
+			pair.append(*value);
+			found = bloom.MayContain(pair.c_str(), pair.length());
+		}
+
+		if (!wildcard && !found)
+			return false;
+	}
+
+	return true;
+}
+
+bool Query::MatchPattern(const char *pattern, std::size_t patternLen,
+	const char *value, std::size_t valueLen)
+{
+	// case insensitive glob match, '*' matches any run of characters
+	std::size_t p = 0, v = 0;
+	std::size_t star = std::string::npos, mark = 0;
+
+	while (v < valueLen)
+	{
+		if (p < patternLen && pattern[p] == '*')
+		{
+			star = p++;
+			mark = v;
+		}
+		else if (p < patternLen && tolower((unsigned char)pattern[p]) ==
+			tolower((unsigned char)value[v]))
+		{
+			++p;
+			++v;
+		}
+		else if (star != std::string::npos)
+		{
+			p = star + 1;
+			v = ++mark;
+		}
+		else
+			return false;
+	}
+
+	while (p < patternLen && pattern[p] == '*')
+		++p;
+
+	return p == patternLen;
+}
@@ -8,19 +8,43 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include "bloom.hpp"
 
 class Query
 {
+public:
+	struct Filter
+	{
+		std::string key;
+		std::vector<std::string> values;	// OR'd together, '*' is a wildcard
+	};
+
 private:
-	std::string m_Query;
+	bool m_Valid;	// the query string parsed
 	std::string m_Metric;
+	std::string m_Aggregator;
 	std::string m_Downsampler;
 
+	std::vector<Filter> m_Filters;
+
 public:
 	Query(const std::string &query);
 	~Query(void);
 
+	bool IsValid(void) const { return m_Valid; }
 	const std::string& GetMetric(void) const { return m_Metric; }
-	const std::string& GetQuery(void) const { return m_Query; }
+	const std::string& GetAggregator(void) const { return m_Aggregator; }
 	const std::string& GetDownsampler(void) const { return m_Downsampler; }
+	const std::vector<Filter>& GetFilters(void) const { return m_Filters; }
+
+	// the query restricted to count series, bound as parameters ?003 onwards
+	std::string GetSeriesQuery(std::size_t count) const;
+
+	// false when a shard with this tag bloom filter cannot hold a match
+	bool MayMatch(const BloomFilter &bloom) const;
+
+	static bool MatchPattern(const char *pattern, std::size_t patternLen,
+		const char *value, std::size_t valueLen);
 };
@@ -0,0 +1,172 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Rate limiter
+ *
+ */
+
+#include "ratelimit.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#define RATE_LIMIT_PRUNE_SECONDS	60		// how often idle clients are dropped
+#define RATE_LIMIT_IDLE_SECONDS		300		// idle for this long
+
+TokenBucket::TokenBucket(void)
+	: m_Rate(0), m_Capacity(0), m_Tokens(0), m_Last(clock_t::now())
+{
+}
+
+TokenBucket::~TokenBucket(void)
+{
+}
+
+void TokenBucket::SetRate(uint32_t rate, uint32_t burst)
+{
+	m_Rate = rate;
+	m_Capacity = (double)rate * std::max<uint32_t>(burst, 1);
+	m_Tokens = m_Capacity;	// starts full
+	m_Last = clock_t::now();
+}
+
+void TokenBucket::Take(std::size_t count, clock_t::time_point now)
+{
+	if (m_Rate <= 0)
+		return;
+
+	Refill(now);
+	m_Tokens -= (double)count;
+}
+
+uint32_t TokenBucket::GetDelay(clock_t::time_point now)
+{
+	if (m_Rate <= 0)
+		return 0;
+
+	Refill(now);
+	if (m_Tokens >= 0)
+		return 0;
+
+	return (uint32_t)std::ceil(-m_Tokens * 1000.0 / m_Rate);
+}
+
+void TokenBucket::Refill(clock_t::time_point now)
+{
+	std::chrono::duration<double> elapsed = now - m_Last;
+	if (elapsed.count() <= 0)
+		return;
+
+	m_Tokens = std::min(m_Capacity, m_Tokens + elapsed.count() * m_Rate);
+	m_Last = now;
+}
+
+RateLimiter::Client::Client(const std::string &address)
+	: m_Address(address), m_LastSeen(clock_t::now()), m_Throttled(0),
+	  m_Dropped(0)
+{
+}
+
+RateLimiter::RateLimiter(uint32_t connectionRate, uint32_t addressRate,
+	uint32_t burst)
+	: m_ConnectionRate(connectionRate), m_AddressRate(addressRate),
+	  m_Burst(burst), m_LastPrune(clock_t::now())
+{
+}
+
+RateLimiter::~RateLimiter(void)
+{
+}
+
+bool RateLimiter::IsEnabled(void) const
+{
+	return m_ConnectionRate > 0 || m_AddressRate > 0;
+}
+
+RateLimiter::client_t RateLimiter::GetClient(const std::string &address)
+{
+	clock_t::time_point now = clock_t::now();
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	Prune(now);
+
+	client_t &client = m_Clients[address];
+	if (!client)
+	{
+		client.reset(new Client(address));
+		client->m_Bucket.SetRate(m_AddressRate, m_Burst);
+	}
+
+	client->m_LastSeen = now;
+	return client;
+}
+
+void RateLimiter::InitBucket(TokenBucket &connection) const
+{
+	connection.SetRate(m_ConnectionRate, m_Burst);
+}
+
+void RateLimiter::Charge(Client &client, TokenBucket *connection,
+	std::size_t points)
+{
+	clock_t::time_point now = clock_t::now();
+	if (connection)
+		connection->Take(points, now);
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	client.m_Bucket.Take(points, now);
+	client.m_LastSeen = now;
+}
+
+uint32_t RateLimiter::GetDelay(Client &client, TokenBucket *connection)
+{
+	clock_t::time_point now = clock_t::now();
+	uint32_t delay = connection ? connection->GetDelay(now) : 0;
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	return std::max(delay, client.m_Bucket.GetDelay(now));
+}
+
+void RateLimiter::AddThrottled(Client &client)
+{
+	++client.m_Throttled;
+}
+
+void RateLimiter::AddDropped(Client &client)
+{
+	++client.m_Dropped;
+}
+
+void RateLimiter::GetStats(std::vector<ClientStats> &stats)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	for (clients_t::iterator client = m_Clients.begin();
+		client != m_Clients.end(); ++client)
+	{
+		ClientStats entry;
+		entry.address = client->first;
+		entry.throttled = client->second->m_Throttled;
+		entry.dropped = client->second->m_Dropped;
+
+		if (entry.throttled > 0 || entry.dropped > 0)
+			stats.push_back(entry);
+	}
+}
+
+void RateLimiter::Prune(clock_t::time_point now)
+{
+	if (now - m_LastPrune < std::chrono::seconds(RATE_LIMIT_PRUNE_SECONDS))
+		return;
+	m_LastPrune = now;
+
+	// clients still connected hold a reference of their own
+	for (clients_t::iterator client = m_Clients.begin();
+		client != m_Clients.end();)
+	{
+		if (client->second.use_count() == 1 && now - client->second->m_LastSeen >
+			std::chrono::seconds(RATE_LIMIT_IDLE_SECONDS))
+			client = m_Clients.erase(client);
+		else
+			++client;
+	}
+}
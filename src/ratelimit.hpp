@@ -0,0 +1,123 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Rate limiter
+ *
+ * Token buckets that hold clients to a rate of data points. A telnet
+ * connection has a bucket of its own, and every client address has one
+ * that its telnet connections and HTTP puts draw from together. A bucket
+ * may be overdrawn by the points that have already been received; the
+ * client then waits until it has refilled. A telnet connection isn't
+ * read from while it waits, and an HTTP put is refused with 429.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class TokenBucket
+{
+public:
+	typedef std::chrono::steady_clock clock_t;
+
+private:
+	double m_Rate;			// points per second, 0 is unlimited
+	double m_Capacity;
+	double m_Tokens;
+	clock_t::time_point m_Last;
+
+public:
+	TokenBucket(void);
+	~TokenBucket(void);
+
+	// burst is the number of seconds of the rate the bucket holds
+	void SetRate(uint32_t rate, uint32_t burst);
+	bool IsLimited(void) const { return m_Rate > 0; }
+
+	// may overdraw the bucket
+	void Take(std::size_t count, clock_t::time_point now);
+
+	// milliseconds until the bucket is no longer overdrawn
+	uint32_t GetDelay(clock_t::time_point now);
+
+private:
+	void Refill(clock_t::time_point now);
+};
+
+class RateLimiter
+{
+public:
+	typedef TokenBucket::clock_t clock_t;
+
+	// everything sent from one address
+	class Client
+	{
+		friend class RateLimiter;
+
+	private:
+		std::string m_Address;
+		TokenBucket m_Bucket;		// guarded by the limiter's lock
+		clock_t::time_point m_LastSeen;
+
+		std::atomic<uint64_t> m_Throttled;	// times a connection was paused
+		std::atomic<uint64_t> m_Dropped;	// requests refused
+
+	public:
+		Client(const std::string &address);
+	};
+
+	typedef std::shared_ptr<Client> client_t;
+
+	struct ClientStats
+	{
+		std::string address;
+		uint64_t throttled;
+		uint64_t dropped;
+	};
+
+private:
+	uint32_t m_ConnectionRate;
+	uint32_t m_AddressRate;
+	uint32_t m_Burst;
+
+	std::mutex m_Lock;
+	typedef std::map<std::string, client_t> clients_t;
+	clients_t m_Clients;
+	clock_t::time_point m_LastPrune;
+
+public:
+	// the rates are in points per second, 0 doesn't limit
+	RateLimiter(uint32_t connectionRate, uint32_t addressRate, uint32_t burst);
+	~RateLimiter(void);
+
+	bool IsEnabled(void) const;
+
+	client_t GetClient(const std::string &address);
+
+	// sets up the bucket of a new connection
+	void InitBucket(TokenBucket &connection) const;
+
+	// counts points that have been received; connection may be null
+	void Charge(Client &client, TokenBucket *connection, std::size_t points);
+
+	// milliseconds before any more should be received
+	uint32_t GetDelay(Client &client, TokenBucket *connection);
+
+	void AddThrottled(Client &client);
+	void AddDropped(Client &client);
+
+	// the clients that have been throttled or dropped
+	void GetStats(std::vector<ClientStats> &stats);
+
+private:
+	void Prune(clock_t::time_point now);
+};
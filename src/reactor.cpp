@@ -0,0 +1,1084 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Network reactor
+ *
+ */
+
+#include "reactor.hpp"
+#include "thread.hpp"
+#include "uring.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+
+#if defined(_WIN32) || defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <ws2tcpip.h>
+
+#define CLOSE_SOCKET	closesocket
+#define SOCKET_ERROR_CODE	WSAGetLastError()
+#define SEND_FLAGS		0
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
+
+#define CLOSE_SOCKET	close
+#define SOCKET_ERROR_CODE	errno
+#define INVALID_SOCKET	-1
+
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS		MSG_NOSIGNAL
+#else
+#define SEND_FLAGS		0
+#endif
+#endif
+
+#define RECV_BUFFER_SIZE	65536
+#define MAX_EVENTS			256
+#define POLL_TIMEOUT_MS		50	// how quickly a stopping thread notices
+
+static void* GetInAddr(struct sockaddr *sa)
+{
+	if (sa->sa_family == AF_INET)
+		return &(((struct sockaddr_in*)sa)->sin_addr);
+
+	return &(((struct sockaddr_in6*)sa)->sin6_addr);
+}
+
+static std::string GetRemoteAddr(struct sockaddr_storage &remoteaddr)
+{
+	char remoteIP[INET6_ADDRSTRLEN];
+	const char *addr = inet_ntop(remoteaddr.ss_family,
+		GetInAddr((struct sockaddr*)&remoteaddr), remoteIP, sizeof(remoteIP));
+
+	return std::string(addr ? addr : "");
+}
+
+// what the reactor needs of a thread, however it waits for its sockets
+class ReactorThread : public ThreadProc
+{
+public:
+	virtual ~ReactorThread(void) {}
+
+	// takes ownership of the listening socket
+	virtual bool Open(socket_t listener) = 0;
+
+	virtual bool StartThread(void) = 0;
+	virtual void StopThread(void) = 0;
+};
+
+// epoll, or select() where there is no epoll
+class PollThread : public ReactorThread
+{
+private:
+	typedef std::chrono::steady_clock clock_t;
+
+	struct Connection
+	{
+		socket_t sock;
+		void *state;
+
+		// not read from until the handler's delay has passed
+		bool paused;
+		clock_t::time_point resume;
+	};
+
+	ReactorHandler *m_Handler;
+	void *m_Context;
+	bool m_HasContext;
+
+	socket_t m_Listener;
+
+#if defined(USE_EPOLL)
+	int32_t m_Epoll;
+#else
+	fd_set m_Master;
+	socket_t m_SocketMax;
+#endif
+
+	typedef std::map<socket_t, Connection*> connections_t;
+	connections_t m_Connections;
+	std::vector<Connection*> m_Paused;
+
+	std::vector<char> m_Buffer;
+
+	Thread *m_Thread;
+
+public:
+	PollThread(ReactorHandler *handler)
+		: m_Handler(handler)
+	{
+		m_Context = nullptr;
+		m_HasContext = false;
+
+		m_Listener = INVALID_SOCKET;
+#if defined(USE_EPOLL)
+		m_Epoll = -1;
+#else
+		FD_ZERO(&m_Master);
+		m_SocketMax = 0;
+#endif
+
+		m_Buffer.resize(RECV_BUFFER_SIZE);
+
+		m_Thread = new Thread(this);
+		if (m_Thread == nullptr)
+			throw std::runtime_error("Failed to create reactor thread");
+	}
+
+	~PollThread(void)
+	{
+		delete m_Thread;
+		Stop();	// in case the thread never ran
+	}
+
+	bool Open(socket_t listener)
+	{
+		m_Listener = listener;
+
+#if defined(USE_EPOLL)
+		m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (m_Epoll == -1)
+		{
+			spdlog::error("Failed to create epoll set: {0}", errno);
+			return false;
+		}
+
+		// a null pointer marks the listener
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = nullptr;
+		if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Listener, &ev) == -1)
+		{
+			spdlog::error("Failed to watch listener: {0}", errno);
+			return false;
+		}
+#else
+		FD_SET(m_Listener, &m_Master);
+		m_SocketMax = m_Listener;
+#endif
+
+		return true;
+	}
+
+	bool StartThread(void)
+	{
+		return m_Thread->Start();
+	}
+
+	void StopThread(void)
+	{
+		m_Thread->Stop();
+	}
+
+	void Start(void)
+	{
+		m_Context = m_Handler->OnThreadStart();
+		m_HasContext = true;
+	}
+
+	void Process(void)
+	{
+#if defined(USE_EPOLL)
+		struct epoll_event events[MAX_EVENTS];
+		int32_t count = epoll_wait(m_Epoll, events, MAX_EVENTS, GetTimeout());
+		if (count == -1)
+		{
+			if (errno != EINTR)
+				spdlog::warn("epoll_wait() failed: {0}", errno);
+			return;
+		}
+
+		for (int32_t e = 0; e < count; e++)
+		{
+			Connection *conn = static_cast<Connection*>(events[e].data.ptr);
+			if (conn == nullptr)
+				Accept();
+			else if (!conn->paused)	// read once it resumes
+				Receive(conn);
+		}
+
+		if (Resume() || count > 0)
+			m_Handler->OnFlush(m_Context);
+#else
+		struct timeval timeout = { 0, (long)GetTimeout() * 1000 };
+		fd_set readfds = m_Master;
+		if (select((int)m_SocketMax + 1, &readfds, nullptr, nullptr, &timeout) == -1)
+		{
+			spdlog::warn("select() failed: {0}", SOCKET_ERROR_CODE);
+			return;
+		}
+
+		if (FD_ISSET(m_Listener, &readfds))
+			Accept();
+
+		// only the open connections are visited, not every descriptor
+		for (connections_t::iterator conn = m_Connections.begin();
+			conn != m_Connections.end();)
+		{
+			Connection *ready = conn->second;
+			++conn;	// Receive may close and erase the connection
+
+			if (FD_ISSET(ready->sock, &readfds))
+				Receive(ready);
+		}
+
+		Resume();
+		m_Handler->OnFlush(m_Context);
+#endif
+	}
+
+	void Stop(void)
+	{
+		for (connections_t::iterator conn = m_Connections.begin();
+			conn != m_Connections.end(); ++conn)
+		{
+			m_Handler->OnDisconnect(conn->second->sock, conn->second->state);
+			CLOSE_SOCKET(conn->second->sock);
+			delete conn->second;
+		}
+		m_Connections.clear();
+		m_Paused.clear();
+
+		if (m_HasContext)
+		{
+			m_Handler->OnThreadStop(m_Context);
+			m_Context = nullptr;
+			m_HasContext = false;
+		}
+
+		if (m_Listener != INVALID_SOCKET)
+		{
+			CLOSE_SOCKET(m_Listener);
+			m_Listener = INVALID_SOCKET;
+		}
+
+#if defined(USE_EPOLL)
+		if (m_Epoll != -1)
+		{
+			close(m_Epoll);
+			m_Epoll = -1;
+		}
+#endif
+	}
+
+private:
+	void Accept(void)
+	{
+		// edge-triggered, so drain every pending connection
+		for (;;)
+		{
+			struct sockaddr_storage remoteaddr;
+			socklen_t addrlen = sizeof(remoteaddr);
+#if defined(USE_EPOLL)
+			socket_t newfd = accept4(m_Listener, (struct sockaddr*)&remoteaddr,
+				&addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (newfd == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					spdlog::warn("Failed to accept new connection: {0}", errno);
+				return;
+			}
+#else
+			socket_t newfd = accept(m_Listener, (struct sockaddr*)&remoteaddr,
+				&addrlen);
+			if (newfd == INVALID_SOCKET)
+			{
+				spdlog::warn("Failed to accept new connection: {0}", SOCKET_ERROR_CODE);
+				return;
+			}
+#endif
+
+			Connection *conn = new Connection;
+			conn->sock = newfd;
+			conn->state = nullptr;
+			conn->paused = false;
+
+#if defined(USE_EPOLL)
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+			ev.data.ptr = conn;
+			if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, newfd, &ev) == -1)
+			{
+				spdlog::warn("Failed to watch socket {0}: {1}", newfd, errno);
+				CLOSE_SOCKET(newfd);
+				delete conn;
+				continue;
+			}
+#else
+			FD_SET(newfd, &m_Master);
+			if (newfd > m_SocketMax)
+				m_SocketMax = newfd;
+#endif
+
+			std::string remote = GetRemoteAddr(remoteaddr);
+			spdlog::debug("new connection from {0} on socket {1}",
+				remote.c_str(), newfd);
+
+			conn->state = m_Handler->OnConnect(newfd, remote);
+			m_Connections.insert(std::pair<socket_t, Connection*>(newfd, conn));
+
+#if !defined(USE_EPOLL)
+			return;	// the listener is blocking, accept one per wakeup
+#endif
+		}
+	}
+
+	void Receive(Connection *conn)
+	{
+		// edge-triggered, so read until the socket would block
+		for (;;)
+		{
+			uint32_t delay = m_Handler->GetReceiveDelay(conn->state);
+			if (delay > 0)
+			{
+				Pause(conn, delay);
+				return;
+			}
+
+			std::size_t space = 0;
+			char *buffer = m_Handler->GetReceiveBuffer(conn->state, space);
+			if (buffer == nullptr || space == 0)
+			{
+				buffer = m_Buffer.data();
+				space = m_Buffer.size();
+			}
+
+			int32_t nbytes = recv(conn->sock, buffer, (int)space, 0);
+			if (nbytes > 0)
+			{
+				if (!m_Handler->OnReceive(m_Context, conn->sock, conn->state,
+					buffer, nbytes))
+				{
+					Close(conn);
+					return;
+				}
+
+#if defined(USE_EPOLL)
+				continue;
+#else
+				return;	// blocking socket, wait for select() again
+#endif
+			}
+
+			if (nbytes == 0)
+				spdlog::debug("socket {0} hung up", conn->sock);
+			else
+			{
+#if defined(USE_EPOLL)
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return;
+#endif
+				spdlog::warn("Failed to read on socket {0}", conn->sock);
+			}
+
+			Close(conn);
+			return;
+		}
+	}
+
+	void Pause(Connection *conn, uint32_t delay)
+	{
+		conn->paused = true;
+		conn->resume = clock_t::now() + std::chrono::milliseconds(delay);
+		m_Paused.push_back(conn);
+
+#if !defined(USE_EPOLL)
+		// select() would keep waking up for the data left unread
+		FD_CLR(conn->sock, &m_Master);
+#endif
+	}
+
+	// reads the paused connections that are due; true if any were
+	bool Resume(void)
+	{
+		if (m_Paused.empty())
+			return false;
+
+		clock_t::time_point now = clock_t::now();
+		std::vector<Connection*> due;
+		for (std::vector<Connection*>::iterator conn = m_Paused.begin();
+			conn != m_Paused.end();)
+		{
+			if ((*conn)->resume <= now)
+			{
+				due.push_back(*conn);
+				conn = m_Paused.erase(conn);
+			}
+			else
+				++conn;
+		}
+
+		// Receive may pause a connection again, or close it
+		for (std::vector<Connection*>::iterator conn = due.begin();
+			conn != due.end(); ++conn)
+		{
+			(*conn)->paused = false;
+#if !defined(USE_EPOLL)
+			FD_SET((*conn)->sock, &m_Master);
+#endif
+			Receive(*conn);
+		}
+
+		return !due.empty();
+	}
+
+	// milliseconds to wait for the sockets, less when a pause ends sooner
+	int32_t GetTimeout(void) const
+	{
+		int32_t timeout = POLL_TIMEOUT_MS;
+		if (m_Paused.empty())
+			return timeout;
+
+		clock_t::time_point now = clock_t::now();
+		for (std::vector<Connection*>::const_iterator conn = m_Paused.begin();
+			conn != m_Paused.end(); ++conn)
+		{
+			if ((*conn)->resume <= now)
+				return 0;
+
+			int32_t wait = (int32_t)std::chrono::duration_cast<
+				std::chrono::milliseconds>((*conn)->resume - now).count();
+			timeout = std::min(timeout, std::max(wait, 1));
+		}
+
+		return timeout;
+	}
+
+	void Close(Connection *conn)
+	{
+		if (conn->paused)
+			m_Paused.erase(std::find(m_Paused.begin(), m_Paused.end(), conn));
+
+		m_Handler->OnDisconnect(conn->sock, conn->state);
+
+		// closing the descriptor also removes it from the epoll set
+		CLOSE_SOCKET(conn->sock);
+#if !defined(USE_EPOLL)
+		FD_CLR(conn->sock, &m_Master);
+#endif
+
+		m_Connections.erase(conn->sock);
+		delete conn;
+	}
+};
+
+#if defined(USE_URING)
+#define URING_ENTRIES		256		// requests queued between waits
+#define URING_COMPLETIONS	4096
+#define URING_BUFFER_COUNT	256		// a power of two
+#define URING_BUFFER_SIZE	16384
+#define URING_BUFFER_GROUP	0
+#define URING_STOP_WAITS	20		// of POLL_TIMEOUT_MS, for requests to end
+
+// completions that aren't for a connection
+#define URING_LISTENER		0
+#define URING_CANCEL		1
+
+// io_uring: the listener and each connection are read by a multishot
+// request that keeps completing until it is cancelled, into buffers the
+// kernel takes from a shared ring, so a wakeup makes no system call for
+// each socket that is ready
+class UringThread : public ReactorThread
+{
+private:
+	typedef std::chrono::steady_clock clock_t;
+
+	struct Connection
+	{
+		socket_t sock;
+		void *state;
+
+		bool armed;		// its receive is in flight
+		bool closed;	// freed once its receive has ended
+
+		// not read from until the handler's delay has passed
+		bool paused;
+		clock_t::time_point resume;
+	};
+
+	ReactorHandler *m_Handler;
+	void *m_Context;
+	bool m_HasContext;
+
+	socket_t m_Listener;
+	IoUring m_Ring;
+
+	bool m_Accepting;
+	bool m_Stopping;
+	clock_t::time_point m_AcceptRetry;
+	uint32_t m_InFlight;	// multishot requests that haven't ended
+
+	typedef std::map<socket_t, Connection*> connections_t;
+	connections_t m_Connections;
+	std::vector<Connection*> m_Paused;
+	std::vector<Connection*> m_Closed;
+
+	Thread *m_Thread;
+
+public:
+	UringThread(ReactorHandler *handler)
+		: m_Handler(handler)
+	{
+		m_Context = nullptr;
+		m_HasContext = false;
+
+		m_Listener = INVALID_SOCKET;
+		m_Accepting = false;
+		m_Stopping = false;
+		m_AcceptRetry = clock_t::now();
+		m_InFlight = 0;
+
+		m_Thread = new Thread(this);
+		if (m_Thread == nullptr)
+			throw std::runtime_error("Failed to create reactor thread");
+	}
+
+	~UringThread(void)
+	{
+		delete m_Thread;
+		Stop();	// in case the thread never ran
+	}
+
+	bool Open(socket_t listener)
+	{
+		m_Listener = listener;
+
+		if (!m_Ring.Open(URING_ENTRIES, URING_COMPLETIONS) ||
+			!m_Ring.ProvideBuffers(URING_BUFFER_GROUP, URING_BUFFER_COUNT,
+				URING_BUFFER_SIZE))
+		{
+			spdlog::error("Failed to set up io_uring: {0}", errno);
+			return false;
+		}
+
+		return Listen();
+	}
+
+	bool StartThread(void)
+	{
+		return m_Thread->Start();
+	}
+
+	void StopThread(void)
+	{
+		m_Thread->Stop();
+	}
+
+	void Start(void)
+	{
+		m_Context = m_Handler->OnThreadStart();
+		m_HasContext = true;
+	}
+
+	void Process(void)
+	{
+		if (!m_Accepting && m_AcceptRetry <= clock_t::now())
+			Listen();
+
+		// submits whatever was queued while handling the last completions
+		if (!m_Ring.Wait(GetTimeout()))
+		{
+			spdlog::warn("io_uring_enter() failed: {0}", errno);
+			return;
+		}
+
+		struct io_uring_cqe cqes[MAX_EVENTS];
+		uint32_t count = m_Ring.Reap(cqes, MAX_EVENTS);
+		for (uint32_t c = 0; c < count; c++)
+			Complete(cqes[c]);
+
+		if (Resume() || count > 0)
+			m_Handler->OnFlush(m_Context);
+	}
+
+	void Stop(void)
+	{
+		m_Stopping = true;
+
+		for (connections_t::iterator conn = m_Connections.begin();
+			conn != m_Connections.end(); ++conn)
+		{
+			m_Handler->OnDisconnect(conn->second->sock, conn->second->state);
+			CLOSE_SOCKET(conn->second->sock);
+			conn->second->closed = true;
+			if (conn->second->armed)
+				m_Closed.push_back(conn->second);
+			else
+				delete conn->second;
+		}
+		m_Connections.clear();
+		m_Paused.clear();
+
+		if (m_HasContext)
+		{
+			m_Handler->OnThreadStop(m_Context);
+			m_Context = nullptr;
+			m_HasContext = false;
+		}
+
+		// the buffers are only freed once nothing can be received into them
+		if (m_InFlight > 0 && m_Ring.CancelAll(URING_CANCEL))
+		{
+			for (uint32_t wait = 0; m_InFlight > 0 && wait < URING_STOP_WAITS;
+				wait++)
+			{
+				m_Ring.Wait(POLL_TIMEOUT_MS);
+
+				struct io_uring_cqe cqes[MAX_EVENTS];
+				uint32_t count = m_Ring.Reap(cqes, MAX_EVENTS);
+				for (uint32_t c = 0; c < count; c++)
+					Complete(cqes[c]);
+			}
+		}
+
+		m_Ring.Close();
+		m_InFlight = 0;
+		m_Accepting = false;
+
+		for (std::vector<Connection*>::iterator conn = m_Closed.begin();
+			conn != m_Closed.end(); ++conn)
+			delete *conn;
+		m_Closed.clear();
+
+		if (m_Listener != INVALID_SOCKET)
+		{
+			CLOSE_SOCKET(m_Listener);
+			m_Listener = INVALID_SOCKET;
+		}
+	}
+
+private:
+	bool Listen(void)
+	{
+		if (!m_Ring.Accept(m_Listener, URING_LISTENER))
+		{
+			spdlog::warn("Failed to queue an accept");
+			m_AcceptRetry = clock_t::now() +
+				std::chrono::milliseconds(POLL_TIMEOUT_MS);
+			return false;
+		}
+
+		m_Accepting = true;
+		++m_InFlight;
+		return true;
+	}
+
+	void Complete(const struct io_uring_cqe &cqe)
+	{
+		if (cqe.user_data == URING_CANCEL)
+			return;
+
+		bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+		if (cqe.user_data == URING_LISTENER)
+		{
+			Accept(cqe.res, more);
+			return;
+		}
+
+		Connection *conn = (Connection*)(uintptr_t)cqe.user_data;
+		if (cqe.flags & IORING_CQE_F_BUFFER)
+		{
+			uint16_t id = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			if (cqe.res > 0 && !conn->closed)
+				Receive(conn, m_Ring.GetBuffer(id), cqe.res);
+			m_Ring.RecycleBuffer(id);
+		}
+		else if (cqe.res == 0 && !conn->closed)
+		{
+			spdlog::debug("socket {0} hung up", conn->sock);
+			Close(conn);
+		}
+		else if (cqe.res < 0 && !conn->closed && cqe.res != -ENOBUFS &&
+			cqe.res != -ECANCELED)
+		{
+			spdlog::warn("Failed to read on socket {0}: {1}", conn->sock, -cqe.res);
+			Close(conn);
+		}
+
+		if (more)
+			return;
+
+		// ended by a cancel, or when it ran out of buffers or completions
+		conn->armed = false;
+		--m_InFlight;
+
+		if (conn->closed)
+		{
+			m_Closed.erase(std::find(m_Closed.begin(), m_Closed.end(), conn));
+			delete conn;
+		}
+		else if (!conn->paused)
+			Arm(conn);
+	}
+
+	void Accept(int32_t result, bool more)
+	{
+		if (!more)
+		{
+			// a failure would only repeat straight away
+			m_Accepting = false;
+			--m_InFlight;
+			m_AcceptRetry = clock_t::now() +
+				std::chrono::milliseconds(result < 0 ? POLL_TIMEOUT_MS : 0);
+		}
+
+		if (result < 0)
+		{
+			if (result != -ECANCELED)
+				spdlog::warn("Failed to accept new connection: {0}", -result);
+			return;
+		}
+
+		socket_t newfd = result;
+		if (m_Stopping)
+		{
+			CLOSE_SOCKET(newfd);
+			return;
+		}
+
+		// a multishot accept has nowhere to put each address
+		struct sockaddr_storage remoteaddr;
+		socklen_t addrlen = sizeof(remoteaddr);
+		std::string remote;
+		if (getpeername(newfd, (struct sockaddr*)&remoteaddr, &addrlen) == 0)
+			remote = GetRemoteAddr(remoteaddr);
+
+		spdlog::debug("new connection from {0} on socket {1}",
+			remote.c_str(), newfd);
+
+		Connection *conn = new Connection;
+		conn->sock = newfd;
+		conn->armed = false;
+		conn->closed = false;
+		conn->paused = false;
+
+		conn->state = m_Handler->OnConnect(newfd, remote);
+		m_Connections.insert(std::pair<socket_t, Connection*>(newfd, conn));
+
+		Arm(conn);
+	}
+
+	void Arm(Connection *conn)
+	{
+		if (!m_Ring.Receive(conn->sock, (uint64_t)(uintptr_t)conn))
+		{
+			spdlog::warn("Failed to queue a receive on socket {0}", conn->sock);
+			Close(conn);
+			return;
+		}
+
+		conn->armed = true;
+		++m_InFlight;
+	}
+
+	void Receive(Connection *conn, const char *data, std::size_t length)
+	{
+		// into the handler's own buffer when it has one, as a read would
+		while (length > 0)
+		{
+			std::size_t space = 0;
+			char *buffer = m_Handler->GetReceiveBuffer(conn->state, space);
+
+			const char *received = data;
+			std::size_t count = length;
+			if (buffer != nullptr && space > 0)
+			{
+				count = std::min(space, length);
+				memcpy(buffer, data, count);
+				received = buffer;
+			}
+
+			if (!m_Handler->OnReceive(m_Context, conn->sock, conn->state,
+				received, count))
+			{
+				Close(conn);
+				return;
+			}
+
+			data += count;
+			length -= count;
+		}
+
+		// what was in flight when it paused is still handed over
+		if (conn->paused)
+			return;
+
+		uint32_t delay = m_Handler->GetReceiveDelay(conn->state);
+		if (delay > 0)
+			Pause(conn, delay);
+	}
+
+	void Pause(Connection *conn, uint32_t delay)
+	{
+		conn->paused = true;
+		conn->resume = clock_t::now() + std::chrono::milliseconds(delay);
+		m_Paused.push_back(conn);
+
+		// rearmed once it resumes
+		if (conn->armed)
+			m_Ring.Cancel((uint64_t)(uintptr_t)conn, URING_CANCEL);
+	}
+
+	// rearms the paused connections that are due; true if any were
+	bool Resume(void)
+	{
+		if (m_Paused.empty())
+			return false;
+
+		clock_t::time_point now = clock_t::now();
+		bool resumed = false;
+		for (std::vector<Connection*>::iterator conn = m_Paused.begin();
+			conn != m_Paused.end();)
+		{
+			if ((*conn)->resume > now)
+			{
+				++conn;
+				continue;
+			}
+
+			// one whose cancel hasn't completed yet is rearmed when it does
+			Connection *due = *conn;
+			conn = m_Paused.erase(conn);
+			due->paused = false;
+			if (!due->armed)
+				Arm(due);
+			resumed = true;
+		}
+
+		return resumed;
+	}
+
+	// milliseconds to wait for completions, less when a pause ends sooner
+	int32_t GetTimeout(void) const
+	{
+		clock_t::time_point now = clock_t::now();
+		int32_t timeout = POLL_TIMEOUT_MS;
+		if (!m_Accepting)
+			timeout = std::min(timeout, Until(m_AcceptRetry, now));
+
+		for (std::vector<Connection*>::const_iterator conn = m_Paused.begin();
+			conn != m_Paused.end(); ++conn)
+			timeout = std::min(timeout, Until((*conn)->resume, now));
+
+		return timeout;
+	}
+
+	static int32_t Until(clock_t::time_point when, clock_t::time_point now)
+	{
+		if (when <= now)
+			return 0;
+
+		int32_t wait = (int32_t)std::chrono::duration_cast<
+			std::chrono::milliseconds>(when - now).count();
+		return std::max(wait, 1);
+	}
+
+	void Close(Connection *conn)
+	{
+		if (conn->paused)
+			m_Paused.erase(std::find(m_Paused.begin(), m_Paused.end(), conn));
+		conn->paused = false;
+
+		m_Handler->OnDisconnect(conn->sock, conn->state);
+
+		// the receive holds on to the socket until its cancel ends it
+		CLOSE_SOCKET(conn->sock);
+		m_Connections.erase(conn->sock);
+		conn->closed = true;
+
+		if (conn->armed)
+		{
+			m_Ring.Cancel((uint64_t)(uintptr_t)conn, URING_CANCEL);
+			m_Closed.push_back(conn);
+		}
+		else
+			delete conn;
+	}
+};
+#endif
+
+Reactor::Reactor(const std::string &bindAddr, const std::string &port,
+	int32_t backlog, uint32_t threads, ReactorHandler *handler, bool uring)
+	: m_BindAddr(bindAddr), m_BindPort(port), m_Backlog(backlog),
+	  m_ThreadCount(threads), m_Uring(uring), m_Handler(handler)
+{
+#if !defined(USE_EPOLL)
+	if (m_ThreadCount > 1)
+		spdlog::warn("Only one reactor thread is supported on this platform");
+	m_ThreadCount = 1;
+#endif
+
+	if (m_ThreadCount == 0)
+		m_ThreadCount = 1;
+}
+
+Reactor::~Reactor(void)
+{
+	Stop();
+}
+
+bool Reactor::Start(void)
+{
+#if defined(_WIN32) || defined(WIN32)
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(2, 0), &wsa) != 0)
+	{
+		spdlog::error("Failed to initialize socket library: {0}", WSAGetLastError());
+		return false;
+	}
+#endif
+
+#if defined(USE_URING)
+	if (m_Uring && !IoUring::IsSupported())
+	{
+		spdlog::warn("io_uring is unavailable, port {0} falls back to epoll",
+			m_BindPort.c_str());
+		m_Uring = false;
+	}
+	else if (m_Uring)
+		spdlog::info("Port {0} uses io_uring", m_BindPort.c_str());
+#else
+	if (m_Uring)
+	{
+		spdlog::warn("io_uring is not supported on this platform");
+		m_Uring = false;
+	}
+#endif
+
+	// every thread gets its own listener, and the kernel balances
+	// incoming connections between them
+	for (uint32_t t = 0; t < m_ThreadCount; t++)
+	{
+		socket_t listener = Listen(m_ThreadCount > 1);
+		if (listener == INVALID_SOCKET)
+			return false;
+
+		ReactorThread *thread = nullptr;
+#if defined(USE_URING)
+		if (m_Uring)
+			thread = new UringThread(m_Handler);
+		else
+#endif
+			thread = new PollThread(m_Handler);
+		m_Threads.push_back(thread);
+
+		if (!thread->Open(listener) || !thread->StartThread())
+			return false;
+	}
+
+	return true;
+}
+
+void Reactor::Stop(void)
+{
+	if (m_Threads.empty())
+		return;
+
+	for (std::vector<ReactorThread*>::iterator thread = m_Threads.begin();
+		thread != m_Threads.end(); ++thread)
+	{
+		(*thread)->StopThread();
+		delete (*thread);
+	}
+	m_Threads.clear();
+
+#if defined(_WIN32) || defined(WIN32)
+	WSACleanup();
+#endif
+}
+
+int32_t Reactor::Send(socket_t sock, const char *data, std::size_t length)
+{
+	return send(sock, data, (int)length, SEND_FLAGS);
+}
+
+socket_t Reactor::Listen(bool reusePort)
+{
+	int32_t yes = 1;
+
+	struct addrinfo hints, *ai, *p;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (getaddrinfo(m_BindAddr.c_str(), m_BindPort.c_str(), &hints, &ai) != 0)
+	{
+		spdlog::error("Failed to getaddrinfo: {0}", SOCKET_ERROR_CODE);
+		return INVALID_SOCKET;
+	}
+
+	socket_t listener = INVALID_SOCKET;
+	for (p = ai; p != nullptr; p = p->ai_next)
+	{
+		listener = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (listener == INVALID_SOCKET)
+			continue;
+
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+			(const char*)&yes, sizeof(int32_t));
+#if defined(SO_REUSEPORT)
+		if (reusePort)
+		{
+			setsockopt(listener, SOL_SOCKET, SO_REUSEPORT,
+				(const char*)&yes, sizeof(int32_t));
+		}
+#endif
+
+		if (bind(listener, p->ai_addr, (int)p->ai_addrlen) < 0)
+		{
+			CLOSE_SOCKET(listener);
+			listener = INVALID_SOCKET;
+			continue;
+		}
+
+		break;
+	}
+
+	freeaddrinfo(ai);
+
+	if (listener == INVALID_SOCKET)
+	{
+		spdlog::error("Failed to bind socket: {0}", SOCKET_ERROR_CODE);
+		return INVALID_SOCKET;
+	}
+
+	if (listen(listener, m_Backlog) == -1)
+	{
+		spdlog::error("Failed to start listening: {0}", SOCKET_ERROR_CODE);
+		CLOSE_SOCKET(listener);
+		return INVALID_SOCKET;
+	}
+
+#if defined(USE_EPOLL)
+	// accepted in a loop until it would block
+	fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	return listener;
+}
@@ -0,0 +1,111 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Network reactor
+ *
+ * Accepts TCP connections on a port and hands the data they receive to
+ * a handler. On Linux each reactor thread owns its own SO_REUSEPORT
+ * listener and edge-triggered epoll set, so the kernel spreads new
+ * connections over the threads and a wakeup only visits sockets that
+ * are ready. Other platforms fall back to a single select() thread.
+ *
+ * On a recent enough Linux kernel the threads can use io_uring instead:
+ * the listener and every connection keep a multishot request in flight
+ * that completes into buffers the kernel picks from a shared ring, so a
+ * busy thread makes one system call per wakeup rather than one for each
+ * socket. It falls back to epoll where io_uring isn't available.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+typedef SOCKET socket_t;
+#else
+typedef int32_t socket_t;
+#endif
+
+class ReactorHandler
+{
+public:
+	virtual ~ReactorHandler(void) {}
+
+	// returns the state kept by each reactor thread, for anything that
+	// mustn't be shared between threads; passed to OnReceive and OnFlush
+	virtual void* OnThreadStart(void)
+	{
+		return nullptr;
+	}
+
+	virtual void OnThreadStop(void *context)
+	{
+	}
+
+	// returns the state kept for a new connection; a handler shared by
+	// several reactor threads is called concurrently, but never for the
+	// same connection
+	virtual void* OnConnect(socket_t sock, const std::string &remote) = 0;
+
+	// where the next read for a connection lands; by default the reactor
+	// reads into a buffer of its own and OnReceive gets a view of it
+	virtual char* GetReceiveBuffer(void *state, std::size_t &space)
+	{
+		return nullptr;
+	}
+
+	// milliseconds to stop reading a connection for, checked before each
+	// read; the data waiting meanwhile pushes back on the client
+	virtual uint32_t GetReceiveDelay(void *state)
+	{
+		return 0;
+	}
+
+	// false closes the connection
+	virtual bool OnReceive(void *context, socket_t sock, void *state,
+		const char *data, std::size_t length) = 0;
+
+	// called once all the sockets ready in a wakeup have been read
+	virtual void OnFlush(void *context)
+	{
+	}
+
+	virtual void OnDisconnect(socket_t sock, void *state) = 0;
+};
+
+class ReactorThread;
+
+class Reactor
+{
+private:
+	std::string m_BindAddr;
+	std::string m_BindPort;
+	int32_t m_Backlog;
+	uint32_t m_ThreadCount;
+	bool m_Uring;
+
+	ReactorHandler *m_Handler;
+
+	std::vector<ReactorThread*> m_Threads;
+
+public:
+	// uring uses io_uring where the kernel supports it, epoll otherwise
+	Reactor(const std::string &bindAddr, const std::string &port,
+		int32_t backlog, uint32_t threads, ReactorHandler *handler,
+		bool uring = false);
+	~Reactor(void);
+
+	bool Start(void);
+	void Stop(void);
+
+	// best effort, a client that isn't reading its replies loses them
+	static int32_t Send(socket_t sock, const char *data, std::size_t length);
+
+private:
+	socket_t Listen(bool reusePort);
+};
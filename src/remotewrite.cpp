@@ -0,0 +1,294 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Prometheus remote_write decoder
+ *
+ */
+
+#include "remotewrite.hpp"
+
+#include <cmath>
+#include <cstring>
+
+// protobuf wire types
+#define WIRE_VARINT		0
+#define WIRE_FIXED64	1
+#define WIRE_BYTES		2
+#define WIRE_FIXED32	5
+
+static bool Fail(std::string &error, const char *message)
+{
+	error.assign(message);
+	return false;
+}
+
+// reads the fields of one protobuf message, without copying
+class ProtoReader
+{
+private:
+	const uint8_t *m_Pos;
+	const uint8_t *m_End;
+
+public:
+	ProtoReader(std::string_view message)
+		: m_Pos(reinterpret_cast<const uint8_t*>(message.data())),
+		  m_End(m_Pos + message.length()) {}
+
+	bool AtEnd(void) const { return m_Pos == m_End; }
+
+	bool ReadVarint(uint64_t &value)
+	{
+		value = 0;
+		for (uint32_t shift = 0; shift < 64; shift += 7)
+		{
+			if (m_Pos == m_End)
+				return false;
+
+			uint8_t byte = *m_Pos++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+
+		return false;	// more than 10 bytes
+	}
+
+	bool ReadKey(uint32_t &field, uint32_t &wire)
+	{
+		uint64_t key;
+		if (!ReadVarint(key))
+			return false;
+
+		field = (uint32_t)(key >> 3);
+		wire = (uint32_t)(key & 7);
+		return field != 0;
+	}
+
+	bool ReadBytes(std::string_view &bytes)
+	{
+		uint64_t length;
+		if (!ReadVarint(length) || length > (uint64_t)(m_End - m_Pos))
+			return false;
+
+		bytes = std::string_view(reinterpret_cast<const char*>(m_Pos),
+			(std::size_t)length);
+		m_Pos += length;
+		return true;
+	}
+
+	bool ReadDouble(double &value)
+	{
+		if (m_End - m_Pos < 8)
+			return false;
+
+		// little-endian on the wire, as on every platform we build for
+		memcpy(&value, m_Pos, sizeof(value));
+		m_Pos += 8;
+		return true;
+	}
+
+	bool Skip(uint32_t wire)
+	{
+		uint64_t value;
+		std::string_view bytes;
+
+		switch (wire)
+		{
+		case WIRE_VARINT:
+			return ReadVarint(value);
+
+		case WIRE_FIXED64:
+			if (m_End - m_Pos < 8)
+				return false;
+			m_Pos += 8;
+			return true;
+
+		case WIRE_BYTES:
+			return ReadBytes(bytes);
+
+		case WIRE_FIXED32:
+			if (m_End - m_Pos < 4)
+				return false;
+			m_Pos += 4;
+			return true;
+		}
+
+		return false;	// groups are long deprecated
+	}
+};
+
+RemoteWriteDecoder::RemoteWriteDecoder(MetricBatch &batch)
+	: m_Batch(batch)
+{
+}
+
+RemoteWriteDecoder::~RemoteWriteDecoder(void)
+{
+}
+
+bool RemoteWriteDecoder::Decode(const char *data, std::size_t length,
+	std::size_t &points, std::size_t &rejected, std::string &error)
+{
+	ProtoReader request(std::string_view(data, length));
+	while (!request.AtEnd())
+	{
+		uint32_t field, wire;
+		if (!request.ReadKey(field, wire))
+			return Fail(error, "Invalid WriteRequest");
+
+		if (field == 1 && wire == WIRE_BYTES)
+		{
+			std::string_view series;
+			if (!request.ReadBytes(series))
+				return Fail(error, "Invalid WriteRequest");
+
+			if (!DecodeSeries(series, points, rejected, error))
+				return false;
+		}
+		else if (!request.Skip(wire))
+			return Fail(error, "Invalid WriteRequest");
+	}
+
+	return true;
+}
+
+bool RemoteWriteDecoder::DecodeSeries(std::string_view series,
+	std::size_t &points, std::size_t &rejected, std::string &error)
+{
+	// the labels first, wherever they are in the message
+	m_Name.clear();
+	m_Tags.clear();
+	bool storable = true;
+
+	ProtoReader labels(series);
+	while (!labels.AtEnd())
+	{
+		uint32_t field, wire;
+		if (!labels.ReadKey(field, wire))
+			return Fail(error, "Invalid TimeSeries");
+
+		if (field != 1 || wire != WIRE_BYTES)
+		{
+			if (!labels.Skip(wire))
+				return Fail(error, "Invalid TimeSeries");
+			continue;
+		}
+
+		std::string_view label;
+		if (!labels.ReadBytes(label))
+			return Fail(error, "Invalid TimeSeries");
+
+		std::string_view name, value;
+		ProtoReader reader(label);
+		while (!reader.AtEnd())
+		{
+			if (!reader.ReadKey(field, wire))
+				return Fail(error, "Invalid Label");
+
+			if (field == 1 && wire == WIRE_BYTES)
+			{
+				if (!reader.ReadBytes(name))
+					return Fail(error, "Invalid Label");
+			}
+			else if (field == 2 && wire == WIRE_BYTES)
+			{
+				if (!reader.ReadBytes(value))
+					return Fail(error, "Invalid Label");
+			}
+			else if (!reader.Skip(wire))
+				return Fail(error, "Invalid Label");
+		}
+
+		if (name == "__name__")
+		{
+			m_Name.assign(value);
+			continue;
+		}
+
+		// tags are space separated, so their values can't hold spaces
+		if (name.empty() || value.empty() ||
+			name.find_first_of(" =") != std::string_view::npos ||
+			value.find(' ') != std::string_view::npos)
+			storable = false;
+
+		if (!m_Tags.empty())
+			m_Tags.append(1, ' ');
+		m_Tags.append(name);
+		m_Tags.append(1, '=');
+		m_Tags.append(value);
+	}
+
+	// resolved once, every sample only refers to it
+	Point point;
+	std::string invalid;
+	if (!storable || !m_Batch.GetMetric(m_Name, point.metric, invalid) ||
+		!m_Batch.GetSeries(point.metric, m_Tags, point.series, invalid))
+	{
+		++rejected;
+		return true;	// the rest of the request is still stored
+	}
+
+	// points are stored by the second, so of the samples that fall in the
+	// same second only the first is kept; they arrive in time order
+	bool sampled = false;
+	uint64_t lastSecond = 0;
+
+	ProtoReader samples(series);
+	while (!samples.AtEnd())
+	{
+		uint32_t field, wire;
+		if (!samples.ReadKey(field, wire))
+			return Fail(error, "Invalid TimeSeries");
+
+		if (field != 2 || wire != WIRE_BYTES)
+		{
+			if (!samples.Skip(wire))
+				return Fail(error, "Invalid TimeSeries");
+			continue;
+		}
+
+		std::string_view sample;
+		if (!samples.ReadBytes(sample))
+			return Fail(error, "Invalid TimeSeries");
+
+		uint64_t milliseconds = 0;
+		double value = 0;
+		ProtoReader reader(sample);
+		while (!reader.AtEnd())
+		{
+			if (!reader.ReadKey(field, wire))
+				return Fail(error, "Invalid Sample");
+
+			if (field == 1 && wire == WIRE_FIXED64)
+			{
+				if (!reader.ReadDouble(value))
+					return Fail(error, "Invalid Sample");
+			}
+			else if (field == 2 && wire == WIRE_VARINT)
+			{
+				if (!reader.ReadVarint(milliseconds))
+					return Fail(error, "Invalid Sample");
+			}
+			else if (!reader.Skip(wire))
+				return Fail(error, "Invalid Sample");
+		}
+
+		// NaN includes the staleness markers, and negative times are
+		// before the epoch
+		if (std::isnan(value) || (int64_t)milliseconds < 0)
+			continue;
+
+		point.timestamp = milliseconds / 1000;
+		if (sampled && point.timestamp == lastSecond)
+			continue;
+
+		sampled = true;
+		lastSecond = point.timestamp;
+
+		point.value = value;
+		m_Batch.Add(point);
+		++points;
+	}
+
+	return true;
+}
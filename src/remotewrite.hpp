@@ -0,0 +1,53 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Prometheus remote_write decoder
+ *
+ * Decodes the protobuf WriteRequest of remote_write 1.0 directly from
+ * the uncompressed body; only the fields needed here are read and the
+ * rest are skipped:
+ *
+ *	WriteRequest	{ repeated TimeSeries timeseries = 1; }
+ *	TimeSeries		{ repeated Label labels = 1; repeated Sample samples = 2; }
+ *	Label			{ string name = 1; string value = 2; }
+ *	Sample			{ double value = 1; int64 timestamp = 2; }
+ *
+ * The __name__ label is the metric name and the other labels are its
+ * tags. Each series is checked and interned once, and its samples only
+ * carry its IDs.
+ * Timestamps are in milliseconds and NaN samples, which include the
+ * staleness markers, are skipped.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "datastore.hpp"
+
+class RemoteWriteDecoder
+{
+private:
+	MetricBatch &m_Batch;
+
+	// reused from series to series
+	std::string m_Name;
+	std::string m_Tags;
+
+public:
+	RemoteWriteDecoder(MetricBatch &batch);
+	~RemoteWriteDecoder(void);
+
+	// false if the request is malformed; series that can't be stored,
+	// such as those without tags, are counted in rejected and skipped
+	bool Decode(const char *data, std::size_t length, std::size_t &points,
+		std::size_t &rejected, std::string &error);
+
+private:
+	bool DecodeSeries(std::string_view series, std::size_t &points,
+		std::size_t &rejected, std::string &error);
+};
@@ -7,14 +7,22 @@
 
 #include "datastore.hpp"
 #include "resultset.hpp"
+#include "segment.hpp"
+#include "selfmetrics.hpp"
 
 #include <ctime>
+#include <utility>
 
-ResultSet::ResultSet(sqlite3_stmt *query,
-	const std::string &metric,
-	const std::string &downsampler)
-	: m_Query(query), m_Metric(metric), m_Downsampler(downsampler)
+ResultSet::ResultSet(sqlite3_stmt *query, sqlite3_stmt *tail,
+	const std::vector<std::shared_ptr<Segment> > &segments,
+	std::vector<std::string> &series,
+	const Query &request, const SelfMetrics *selfMetrics,
+	std::shared_lock<std::shared_timed_mutex> sealing)
+	: m_Query(query), m_Tail(tail), m_Segments(segments),
+	  m_SelfMetrics(selfMetrics), m_Sealing(std::move(sealing)),
+	  m_Request(request)
 {
+	m_Series.swap(series);
 }
 
 ResultSet::~ResultSet(void)
@@ -24,28 +32,105 @@ ResultSet::~ResultSet(void)
 		sqlite3_finalize(m_Query);
 		m_Query = nullptr;
 	}
+
+	if (m_Tail)
+	{
+		sqlite3_finalize(m_Tail);
+		m_Tail = nullptr;
+	}
 }
 
 bool ResultSet::Execute(uint64_t startTime, uint64_t endTime,
 	std::vector<dps> &results)
 {
-	if (m_Query == nullptr)
-		return false;
+	std::map<uint64_t, Aggregate> buckets;
 
-	sqlite3_bind_int64(m_Query, 1, startTime);
-	sqlite3_bind_int64(m_Query, 2, endTime);
+	// self-metrics still in memory, their persisted copies are only read
+	// for the time before them
+	bool stored = true;
+	if (m_SelfMetrics)
+	{
+		uint64_t oldest = m_SelfMetrics->Scan(m_Request, startTime, endTime,
+			buckets);
+		if (oldest <= startTime)
+			stored = false;
+		else if (oldest <= endTime)
+			endTime = oldest - 1;
+	}
 
-	int result = sqlite3_step(m_Query);
-	while (result == SQLITE_ROW)
+	// recent data from the database, unless it was pruned, a chunk of
+	// the series resolved by the tag index at a time
+	if (m_Query && stored)
+	{
+		std::size_t chunk = sqlite3_bind_parameter_count(m_Query) - 2;
+		std::size_t first = 0;
+		while (chunk > 0 && m_Series.size() - first >= chunk)
+			first += Step(m_Query, first, startTime, endTime, buckets);
+
+		if (first < m_Series.size() && m_Tail)
+			Step(m_Tail, first, startTime, endTime, buckets);
+	}
+
+	// historical data from the sealed segments
+	for (std::vector<std::shared_ptr<Segment> >::const_iterator segment = m_Segments.begin();
+		stored && segment != m_Segments.end(); ++segment)
+	{
+		(*segment)->Scan(startTime, endTime, m_Series, buckets);
+	}
+
+	if (m_Sealing.owns_lock())
+		m_Sealing.unlock();	// everything has been read
+
+	// apply the aggregator
+	const std::string &aggregator = m_Request.GetAggregator();
+	results.reserve(results.size() + buckets.size());
+	for (std::map<uint64_t, Aggregate>::const_iterator bucket = buckets.begin();
+		bucket != buckets.end(); ++bucket)
 	{
 		dps ret;
-		ret.timestamp = sqlite3_column_int64(m_Query, 0);
-		ret.value = sqlite3_column_double(m_Query, 1);
-		results.push_back(ret);
+		ret.timestamp = bucket->first;
 
-		result = sqlite3_step(m_Query);
+		if (aggregator == "sum")
+			ret.value = bucket->second.sum;
+		else if (aggregator == "min")
+			ret.value = bucket->second.min;
+		else if (aggregator == "max")
+			ret.value = bucket->second.max;
+		else // avg
+			ret.value = bucket->second.sum / bucket->second.count;
+
+		results.push_back(ret);
 	}
 
-	sqlite3_reset(m_Query);	// reset the query
 	return true;
 }
+
+std::size_t ResultSet::Step(sqlite3_stmt *query, std::size_t first,
+	uint64_t startTime, uint64_t endTime, std::map<uint64_t, Aggregate> &buckets)
+{
+	sqlite3_bind_int64(query, 1, startTime);
+	sqlite3_bind_int64(query, 2, endTime);
+
+	int params = sqlite3_bind_parameter_count(query);
+	std::size_t count = 0;
+	for (int i = 3; i <= params && first + count < m_Series.size(); i++, count++)
+	{
+		const std::string &tags = m_Series[first + count];
+		sqlite3_bind_text(query, i, tags.c_str(), (int)tags.length(), SQLITE_STATIC);
+	}
+
+	int result = sqlite3_step(query);
+	while (result == SQLITE_ROW)
+	{
+		buckets[sqlite3_column_int64(query, 0)].Merge(
+			sqlite3_column_double(query, 1),
+			sqlite3_column_int64(query, 2),
+			sqlite3_column_double(query, 3),
+			sqlite3_column_double(query, 4));
+
+		result = sqlite3_step(query);
+	}
+
+	sqlite3_reset(query);	// reset the query
+	return count;
+}
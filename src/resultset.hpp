@@ -8,11 +8,19 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 
+#include "query.hpp"
+
 #include "sqlite3.h"
 
+class Segment;
+class SelfMetrics;
+
 class ResultSet
 {
 public:
@@ -22,21 +30,72 @@ public:
 		double value;
 	};
 
+	// partial aggregate for one timestamp, so that rows from the database
+	// and from sealed segments can be combined before the final aggregation
+	struct Aggregate
+	{
+		double sum;
+		double min;
+		double max;
+		uint64_t count;
+
+		Aggregate(void)
+			: sum(0), min(0), max(0), count(0) {}
+
+		void Add(double value)
+		{
+			Merge(value, 1, value, value);
+		}
+
+		void Merge(double _sum, uint64_t _count, double _min, double _max)
+		{
+			if (_count == 0)
+				return;
+
+			if (count == 0 || _min < min)
+				min = _min;
+			if (count == 0 || _max > max)
+				max = _max;
+
+			sum += _sum;
+			count += _count;
+		}
+	};
+
 private:
+	// the series are bound in chunks, the size of the query's parameter
+	// list, with the rest bound to the tail query
 	sqlite3_stmt *m_Query;
+	sqlite3_stmt *m_Tail;
+	std::vector<std::shared_ptr<Segment> > m_Segments;
+	std::vector<std::string> m_Series;	// sorted tags of the matching series
+	const SelfMetrics *m_SelfMetrics;	// recent data held in memory, if any
 
-	std::string m_Metric;
-	std::string m_Downsampler;
+	// keeps a span from being sealed between preparing and executing, so
+	// its rows can't leave the database before the segment is listed
+	std::shared_lock<std::shared_timed_mutex> m_Sealing;
+
+	Query m_Request;
 
 public:
-	ResultSet(sqlite3_stmt *query,
-		const std::string &metric,
-		const std::string &downsampler);
+	ResultSet(sqlite3_stmt *query, sqlite3_stmt *tail,
+		const std::vector<std::shared_ptr<Segment> > &segments,
+		std::vector<std::string> &series,
+		const Query &request, const SelfMetrics *selfMetrics = nullptr,
+		std::shared_lock<std::shared_timed_mutex> sealing =
+			std::shared_lock<std::shared_timed_mutex>());
 	~ResultSet(void);
 
 	bool Execute(uint64_t startTime, uint64_t endTime,
 		std::vector<dps> &results);
 
-	const std::string& GetMetric(void) const { return m_Metric; }
-	const std::string& GetDownsampler(void) const { return m_Downsampler; }
+	const std::string& GetMetric(void) const { return m_Request.GetMetric(); }
+	const std::string& GetDownsampler(void) const { return m_Request.GetDownsampler(); }
+
+private:
+	// runs a query for as many series from first as it has parameters
+	// for, and returns how many that was
+	std::size_t Step(sqlite3_stmt *query, std::size_t first,
+		uint64_t startTime, uint64_t endTime,
+		std::map<uint64_t, Aggregate> &buckets);
 };
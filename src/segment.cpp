@@ -0,0 +1,430 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Sealed segment
+ *
+ */
+
+#include "segment.hpp"
+#include "utility.hpp"
+
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32) || defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SEGMENT_MAGIC		"STSDBSEG"
+#define SEGMENT_HEADER_SIZE	16
+#define SEGMENT_VERSION		2	// 2 added the tag filter to the footer
+#define SEGMENT_TEMP_EXT	".tmp"
+
+#if defined(_WIN32) || defined(WIN32)
+#define PATH_SEP	"\\"
+#else
+#define PATH_SEP	"/"
+#endif
+
+Segment::Segment(const std::string &path)
+	: m_Path(path)
+{
+	m_File = nullptr;
+	m_Mapping = nullptr;
+	m_Data = nullptr;
+	m_Size = 0;
+
+	m_Footer = nullptr;
+	m_Timestamps = nullptr;
+	m_Values = nullptr;
+	m_Series = nullptr;
+	m_Strings = nullptr;
+
+	m_Remove = false;
+}
+
+Segment::~Segment(void)
+{
+	Close();
+
+	// the file was moved to another tier, and nobody is reading this copy
+	if (m_Remove && remove(m_Path.c_str()) != 0)
+		spdlog::warn("Failed to remove segment {0}", m_Path.c_str());
+}
+
+bool Segment::Open(void)
+{
+#if defined(_WIN32) || defined(WIN32)
+	HANDLE file = CreateFileA(m_Path.c_str(), GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		spdlog::warn("Failed to open segment {0}: {1}", m_Path.c_str(), GetLastError());
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	m_File = file;
+	m_Size = size.QuadPart;
+
+	if (m_Size >= sizeof(Footer) + SEGMENT_HEADER_SIZE)
+	{
+		m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_Mapping)
+			m_Data = static_cast<const uint8_t*>(
+				MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+#else
+	int fd = open(m_Path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		spdlog::warn("Failed to open segment {0}: {1}", m_Path.c_str(), errno);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	m_Size = st.st_size;
+
+	if (m_Size >= sizeof(Footer) + SEGMENT_HEADER_SIZE)
+	{
+		void *data = mmap(nullptr, m_Size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data != MAP_FAILED)
+			m_Data = static_cast<const uint8_t*>(data);
+	}
+
+	// the mapping holds its own reference to the file
+	close(fd);
+#endif
+
+	if (m_Data == nullptr)
+	{
+		spdlog::warn("Failed to map segment {0}", m_Path.c_str());
+		Close();
+		return false;
+	}
+
+	// validate the header and footer
+	m_Footer = reinterpret_cast<const Footer*>(m_Data + m_Size - sizeof(Footer));
+	if (memcmp(m_Data, SEGMENT_MAGIC, 8) != 0 ||
+		memcmp(m_Footer->magic, SEGMENT_MAGIC, 8) != 0)
+	{
+		spdlog::warn("Segment {0} is not a TSDB segment, skipping", m_Path.c_str());
+		Close();
+		return false;
+	}
+
+	// the footer layout depends on the version
+	if (m_Data[8] != SEGMENT_VERSION)
+	{
+		spdlog::warn("Segment {0} has unknown version {1}, skipping", m_Path.c_str(),
+			m_Data[8]);
+		Close();
+		return false;
+	}
+
+	uint64_t limit = m_Size - sizeof(Footer);
+	if (!Fits(m_Footer->timestampOffset, m_Footer->rowCount, sizeof(uint64_t), limit) ||
+		!Fits(m_Footer->valueOffset, m_Footer->rowCount, sizeof(double), limit) ||
+		!Fits(m_Footer->seriesOffset, m_Footer->seriesCount, sizeof(SeriesEntry), limit) ||
+		!Fits(m_Footer->stringOffset, m_Footer->stringLength, 1, limit) ||
+		!Fits(m_Footer->bloomOffset, m_Footer->bloomLength, 1, limit))
+	{
+		spdlog::warn("Segment {0} is truncated, skipping", m_Path.c_str());
+		Close();
+		return false;
+	}
+
+	m_Timestamps = reinterpret_cast<const uint64_t*>(m_Data + m_Footer->timestampOffset);
+	m_Values = reinterpret_cast<const double*>(m_Data + m_Footer->valueOffset);
+	m_Series = reinterpret_cast<const SeriesEntry*>(m_Data + m_Footer->seriesOffset);
+	m_Strings = reinterpret_cast<const char*>(m_Data + m_Footer->stringOffset);
+
+	// every series must point into the columns and the string table, as
+	// queries use them unchecked
+	for (uint64_t s = 0; s < m_Footer->seriesCount; s++)
+	{
+		if (!Fits(m_Series[s].firstRow, m_Series[s].rowCount, 1, m_Footer->rowCount) ||
+			!Fits(m_Series[s].tagsOffset, m_Series[s].tagsLength, 1, m_Footer->stringLength))
+		{
+			spdlog::warn("Segment {0} has a corrupt series index, skipping", m_Path.c_str());
+			Close();
+			return false;
+		}
+	}
+
+	if (!m_Bloom.Load(m_Data + m_Footer->bloomOffset, m_Footer->bloomLength))
+	{
+		spdlog::warn("Segment {0} has no tag filter, skipping", m_Path.c_str());
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool Segment::Fits(uint64_t offset, uint64_t count, uint64_t size,
+	uint64_t limit)
+{
+	// without overflowing
+	return offset <= limit && count <= (limit - offset) / size;
+}
+
+void Segment::Close(void)
+{
+#if defined(_WIN32) || defined(WIN32)
+	if (m_Data)
+		UnmapViewOfFile(m_Data);
+	if (m_Mapping)
+		CloseHandle((HANDLE)m_Mapping);
+	if (m_File)
+		CloseHandle((HANDLE)m_File);
+#else
+	if (m_Data)
+		munmap(const_cast<uint8_t*>(m_Data), m_Size);
+#endif
+
+	m_File = nullptr;
+	m_Mapping = nullptr;
+	m_Data = nullptr;
+	m_Size = 0;
+
+	m_Footer = nullptr;
+	m_Timestamps = nullptr;
+	m_Values = nullptr;
+	m_Series = nullptr;
+	m_Strings = nullptr;
+}
+
+bool Segment::MayMatch(uint64_t startTime, uint64_t endTime,
+	const Query &query) const
+{
+	if (m_Data == nullptr || m_Footer->rowCount == 0)
+		return false;
+
+	if (endTime < m_Footer->minTimestamp || startTime > m_Footer->maxTimestamp)
+		return false;
+
+	return query.MayMatch(m_Bloom);
+}
+
+void Segment::AddToIndex(TagIndex &index) const
+{
+	if (m_Data == nullptr)
+		return;
+
+	for (uint64_t s = 0; s < m_Footer->seriesCount; s++)
+		index.AddSeries(m_Strings + m_Series[s].tagsOffset, m_Series[s].tagsLength);
+}
+
+void Segment::Scan(uint64_t startTime, uint64_t endTime,
+	const std::vector<std::string> &series,
+	std::map<uint64_t, ResultSet::Aggregate> &buckets) const
+{
+	if (m_Data == nullptr)
+		return;
+
+	// skip the whole segment when the time range doesn't overlap
+	if (m_Footer->rowCount == 0 || endTime < m_Footer->minTimestamp ||
+		startTime > m_Footer->maxTimestamp)
+		return;
+
+	// both lists are sorted by tags, so walk them together
+	const SeriesEntry *entry = m_Series;
+	const SeriesEntry *last = m_Series + m_Footer->seriesCount;
+	for (std::vector<std::string>::const_iterator tags = series.begin();
+		tags != series.end() && entry != last; ++tags)
+	{
+		entry = std::lower_bound(entry, last, *tags,
+			[this](const SeriesEntry &e, const std::string &t)
+			{
+				return t.compare(0, std::string::npos,
+					m_Strings + e.tagsOffset, e.tagsLength) > 0;
+			});
+		if (entry == last)
+			break;
+
+		if (tags->compare(0, std::string::npos, m_Strings + entry->tagsOffset,
+			entry->tagsLength) != 0)
+			continue;	// not in this segment
+
+		if (endTime < entry->minTimestamp || startTime > entry->maxTimestamp)
+			continue;
+
+		// the timestamps are sorted within a series
+		const uint64_t *first = m_Timestamps + entry->firstRow;
+		const uint64_t *end = first + entry->rowCount;
+		const uint64_t *ts = std::lower_bound(first, end, startTime);
+
+		std::map<uint64_t, ResultSet::Aggregate>::iterator hint = buckets.end();
+		for (; ts != end && *ts <= endTime; ++ts)
+		{
+			hint = buckets.emplace_hint(hint, *ts, ResultSet::Aggregate());
+			hint->second.Add(m_Values[ts - m_Timestamps]);
+		}
+	}
+}
+
+SegmentWriter::SegmentWriter(const std::string &path, uint64_t startTime,
+	uint64_t endTime)
+	: m_Path(path), m_StartTime(startTime), m_EndTime(endTime)
+{
+}
+
+SegmentWriter::~SegmentWriter(void)
+{
+}
+
+void SegmentWriter::Append(const char *tags, std::size_t tagsLength,
+	uint64_t timestamp, double value)
+{
+	if (m_Series.empty() || m_LastTags.length() != tagsLength ||
+		m_LastTags.compare(0, tagsLength, tags, tagsLength) != 0)
+	{
+		// start a new series
+		Segment::SeriesEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.tagsOffset = m_Strings.length();
+		entry.tagsLength = static_cast<uint32_t>(tagsLength);
+		entry.firstRow = m_Timestamps.size();
+		entry.minTimestamp = timestamp;
+		m_Series.push_back(entry);
+
+		m_Strings.append(tags, tagsLength);
+		m_LastTags.assign(tags, tagsLength);
+
+		m_Bloom.AddTags(tags, tagsLength);
+	}
+
+	Segment::SeriesEntry &entry = m_Series.back();
+	entry.rowCount++;
+	entry.maxTimestamp = timestamp;
+
+	m_Timestamps.push_back(timestamp);
+	m_Values.push_back(value);
+}
+
+bool SegmentWriter::Write(void)
+{
+	std::string tmpPath = GetTempPath(m_Path);
+
+	FILE *fp = fopen(tmpPath.c_str(), "wb");
+	if (fp == nullptr)
+	{
+		spdlog::warn("Failed to create segment {0}", tmpPath.c_str());
+		return false;
+	}
+
+	Segment::Footer footer;
+	memset(&footer, 0, sizeof(footer));
+	footer.startTime = m_StartTime;
+	footer.endTime = m_EndTime;
+	footer.rowCount = m_Timestamps.size();
+	footer.seriesCount = m_Series.size();
+
+	footer.minTimestamp = m_EndTime;
+	for (std::vector<Segment::SeriesEntry>::const_iterator series = m_Series.begin();
+		series != m_Series.end(); ++series)
+	{
+		footer.minTimestamp = std::min(footer.minTimestamp, series->minTimestamp);
+		footer.maxTimestamp = std::max(footer.maxTimestamp, series->maxTimestamp);
+	}
+
+	// every column starts on an 8 byte boundary
+	footer.timestampOffset = SEGMENT_HEADER_SIZE;
+	footer.valueOffset = footer.timestampOffset + footer.rowCount * sizeof(uint64_t);
+	footer.seriesOffset = footer.valueOffset + footer.rowCount * sizeof(double);
+	footer.stringOffset = footer.seriesOffset + footer.seriesCount * sizeof(Segment::SeriesEntry);
+	footer.stringLength = m_Strings.length();
+	memcpy(footer.magic, SEGMENT_MAGIC, 8);
+
+	// pad the string table so the tag filter and footer stay aligned
+	std::size_t padding = (8 - (m_Strings.length() % 8)) % 8;
+	const char zeros[8] = { 0 };
+
+	std::vector<uint8_t> bloom(m_Bloom.GetSize());
+	m_Bloom.Save(bloom.data());
+	footer.bloomOffset = footer.stringOffset + footer.stringLength + padding;
+	footer.bloomLength = bloom.size();
+
+	uint8_t header[SEGMENT_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, SEGMENT_MAGIC, 8);
+	header[8] = SEGMENT_VERSION;
+
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+	if (ok && footer.rowCount > 0)
+	{
+		ok = fwrite(m_Timestamps.data(), sizeof(uint64_t), m_Timestamps.size(), fp) == m_Timestamps.size() &&
+			fwrite(m_Values.data(), sizeof(double), m_Values.size(), fp) == m_Values.size() &&
+			fwrite(m_Series.data(), sizeof(Segment::SeriesEntry), m_Series.size(), fp) == m_Series.size() &&
+			fwrite(m_Strings.data(), 1, m_Strings.length(), fp) == m_Strings.length();
+	}
+	if (ok && padding > 0)
+		ok = fwrite(zeros, 1, padding, fp) == padding;
+	if (ok)
+		ok = fwrite(bloom.data(), 1, bloom.size(), fp) == bloom.size();
+	if (ok)
+		ok = fwrite(&footer, sizeof(footer), 1, fp) == 1;
+	if (ok)
+		ok = SyncFile(fp);
+
+	fclose(fp);
+
+	if (!ok)
+	{
+		spdlog::warn("Failed to write segment {0}", tmpPath.c_str());
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool SegmentWriter::Commit(void)
+{
+	std::string tmpPath = GetTempPath(m_Path);
+	if (rename(tmpPath.c_str(), m_Path.c_str()) != 0)
+	{
+		spdlog::warn("Failed to rename segment {0}", tmpPath.c_str());
+		return false;
+	}
+
+	if (!SyncDirectory(m_Path.substr(0, m_Path.rfind(PATH_SEP))))
+		spdlog::warn("Failed to sync the directory of segment {0}", m_Path.c_str());
+
+	return true;
+}
+
+void SegmentWriter::Discard(void)
+{
+	remove(GetTempPath(m_Path).c_str());
+}
+
+std::string SegmentWriter::GetTempPath(const std::string &path)
+{
+	std::string tmpPath(path);
+	tmpPath.append(SEGMENT_TEMP_EXT);
+	return tmpPath;
+}
@@ -0,0 +1,152 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Sealed segment
+ *
+ * A segment is an immutable, columnar file holding every data point of
+ * one metric for a closed time range. Rows are sorted by series (tags),
+ * then by timestamp, and a footer index locates each series. Segments
+ * are read through a shared, read-only memory mapping, so any number of
+ * query threads can scan them without copies or locks.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bloom.hpp"
+#include "query.hpp"
+#include "resultset.hpp"
+#include "tagindex.hpp"
+
+class Segment
+{
+public:
+#pragma pack(push, 1)
+	struct SeriesEntry
+	{
+		uint64_t tagsOffset;	// into the string table
+		uint32_t tagsLength;
+		uint32_t reserved;
+		uint64_t firstRow;
+		uint64_t rowCount;
+		uint64_t minTimestamp;
+		uint64_t maxTimestamp;
+	};
+
+	struct Footer
+	{
+		uint64_t startTime;		// inclusive
+		uint64_t endTime;		// exclusive
+		uint64_t minTimestamp;
+		uint64_t maxTimestamp;
+		uint64_t rowCount;
+		uint64_t seriesCount;
+		uint64_t timestampOffset;
+		uint64_t valueOffset;
+		uint64_t seriesOffset;
+		uint64_t stringOffset;
+		uint64_t stringLength;
+		uint64_t bloomOffset;
+		uint64_t bloomLength;
+		char magic[8];
+	};
+#pragma pack(pop)
+
+private:
+	std::string m_Path;
+
+	void *m_File;
+	void *m_Mapping;
+	const uint8_t *m_Data;
+	uint64_t m_Size;
+
+	const Footer *m_Footer;
+	const uint64_t *m_Timestamps;
+	const double *m_Values;
+	const SeriesEntry *m_Series;
+	const char *m_Strings;
+
+	BloomFilter m_Bloom;
+
+	std::atomic_bool m_Remove;
+
+public:
+	Segment(const std::string &path);
+	~Segment(void);
+
+	bool Open(void);
+	void Close(void);
+
+	// deletes the file once the last reference to the segment is released
+	void RemoveOnRelease(void) { m_Remove = true; }
+
+	const std::string& GetPath(void) const { return m_Path; }
+	uint64_t GetStartTime(void) const { return m_Footer->startTime; }
+	uint64_t GetEndTime(void) const { return m_Footer->endTime; }
+	uint64_t GetMinTimestamp(void) const { return m_Footer->minTimestamp; }
+	uint64_t GetMaxTimestamp(void) const { return m_Footer->maxTimestamp; }
+	uint64_t GetRowCount(void) const { return m_Footer->rowCount; }
+
+	// false when no series in the segment can match the query
+	bool MayMatch(uint64_t startTime, uint64_t endTime, const Query &query) const;
+
+	// adds every series in the segment to a tag index
+	void AddToIndex(TagIndex &index) const;
+
+	// aggregates the points of the given (sorted) series that fall in
+	// [startTime, endTime] into buckets
+	void Scan(uint64_t startTime, uint64_t endTime,
+		const std::vector<std::string> &series,
+		std::map<uint64_t, ResultSet::Aggregate> &buckets) const;
+
+private:
+	// whether count items of size bytes from offset end within limit
+	static bool Fits(uint64_t offset, uint64_t count, uint64_t size,
+		uint64_t limit);
+};
+
+typedef std::shared_ptr<Segment> segment_ptr;
+
+class SegmentWriter
+{
+private:
+	std::string m_Path;
+	uint64_t m_StartTime;
+	uint64_t m_EndTime;
+
+	std::vector<uint64_t> m_Timestamps;
+	std::vector<double> m_Values;
+	std::vector<Segment::SeriesEntry> m_Series;
+	std::string m_Strings;
+	std::string m_LastTags;
+
+	BloomFilter m_Bloom;
+
+public:
+	SegmentWriter(const std::string &path, uint64_t startTime,
+		uint64_t endTime);
+	~SegmentWriter(void);
+
+	// rows must be appended sorted by tags, then timestamp
+	void Append(const char *tags, std::size_t tagsLength,
+		uint64_t timestamp, double value);
+
+	std::size_t GetRowCount(void) const { return m_Timestamps.size(); }
+
+	// writes the segment to a temporary file and syncs it to the disk,
+	// then either renames it into place and syncs the directory, or
+	// removes it
+	bool Write(void);
+	bool Commit(void);
+	void Discard(void);
+
+	// the temporary file a segment is written to before it is committed
+	static std::string GetTempPath(const std::string &path);
+};
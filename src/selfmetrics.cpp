@@ -0,0 +1,162 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Self-metric store
+ *
+ */
+
+#include "selfmetrics.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#define SELF_METRICS_TAG	"host"	// the only tag the self-metrics have
+
+SelfMetrics::SelfMetrics(void)
+	: m_Capacity(1)
+{
+}
+
+SelfMetrics::~SelfMetrics(void)
+{
+	for (std::vector<Series*>::iterator series = m_Series.begin();
+		series != m_Series.end(); ++series)
+		delete *series;
+}
+
+void SelfMetrics::Configure(const std::string &hostname, std::size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	// before anything is recorded
+	m_Hostname = hostname;
+	m_Capacity = std::max<std::size_t>(capacity, 1);
+}
+
+void SelfMetrics::Record(const std::string &name, uint64_t timestamp,
+	double value)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	Series *series = Find(name);
+	if (series == nullptr)
+	{
+		series = new Series;
+		series->name = name;
+		series->host = m_Hostname;
+		series->tags.assign(SELF_METRICS_TAG "=");
+		series->tags.append(m_Hostname);
+		series->ring.resize(m_Capacity);
+		series->head = 0;
+		series->count = 0;
+		series->pending = 0;
+		m_Series.push_back(series);
+	}
+
+	Sample &sample = series->ring[series->head];
+	sample.timestamp = timestamp;
+	sample.value = value;
+
+	series->head = (series->head + 1) % series->ring.size();
+	series->count = std::min(series->count + 1, series->ring.size());
+	series->pending = std::min(series->pending + 1, series->ring.size());
+}
+
+bool SelfMetrics::Holds(const std::string &name) const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	return Find(name) != nullptr;
+}
+
+uint64_t SelfMetrics::Scan(const Query &query, uint64_t startTime,
+	uint64_t endTime, std::map<uint64_t, ResultSet::Aggregate> &buckets) const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	Series *series = Find(query.GetMetric());
+	if (series == nullptr || series->count == 0)
+		return std::numeric_limits<uint64_t>::max();
+
+	// the oldest sample is where the next one will go, once the ring is full
+	std::size_t size = series->ring.size();
+	std::size_t first = (series->head + size - series->count) % size;
+	uint64_t oldest = series->ring[first].timestamp;
+
+	// a series that doesn't match still answers for its time range, so
+	// nothing older is read back from its persisted copy either
+	if (!Matches(*series, query))
+		return oldest;
+
+	for (std::size_t s = 0; s < series->count; s++)
+	{
+		const Sample &sample = series->ring[(first + s) % size];
+		if (sample.timestamp >= startTime && sample.timestamp <= endTime)
+			buckets[sample.timestamp].Add(sample.value);
+	}
+
+	return oldest;
+}
+
+void SelfMetrics::Drain(std::vector<Entry> &entries)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	for (std::vector<Series*>::iterator series = m_Series.begin();
+		series != m_Series.end(); ++series)
+	{
+		std::size_t size = (*series)->ring.size();
+		std::size_t first = ((*series)->head + size - (*series)->pending) % size;
+		for (std::size_t s = 0; s < (*series)->pending; s++)
+		{
+			const Sample &sample = (*series)->ring[(first + s) % size];
+
+			Entry entry;
+			entry.name = &(*series)->name;
+			entry.tags = &(*series)->tags;
+			entry.timestamp = sample.timestamp;
+			entry.value = sample.value;
+			entries.push_back(entry);
+		}
+
+		(*series)->pending = 0;
+	}
+}
+
+SelfMetrics::Series* SelfMetrics::Find(const std::string &name) const
+{
+	// only a handful of series
+	for (std::vector<Series*>::const_iterator series = m_Series.begin();
+		series != m_Series.end(); ++series)
+	{
+		if ((*series)->name == name)
+			return *series;
+	}
+
+	return nullptr;
+}
+
+bool SelfMetrics::Matches(const Series &series, const Query &query) const
+{
+	// filters are a logical AND, their values a logical OR
+	const std::vector<Query::Filter> &filters = query.GetFilters();
+	for (std::vector<Query::Filter>::const_iterator filter = filters.begin();
+		filter != filters.end(); ++filter)
+	{
+		if (!Query::MatchPattern(filter->key.c_str(), filter->key.length(),
+			SELF_METRICS_TAG, sizeof(SELF_METRICS_TAG) - 1))
+			return false;
+
+		bool matched = false;
+		for (std::vector<std::string>::const_iterator pattern = filter->values.begin();
+			pattern != filter->values.end() && !matched; ++pattern)
+		{
+			matched = Query::MatchPattern(pattern->c_str(), pattern->length(),
+				series.host.c_str(), series.host.length());
+		}
+
+		if (!matched)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,88 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Self-metric store
+ *
+ * Keeps the tsdb.internal metrics in memory, apart from user data. Each
+ * series is a fixed-size ring of its latest samples, recorded by the
+ * statistics thread without going through the datastore queue, so the
+ * backlog they report can't delay them. Queries read the ring first and
+ * only go to disk for anything older; samples can also be drained for
+ * the datastore to persist in the background.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "query.hpp"
+#include "resultset.hpp"
+
+class SelfMetrics
+{
+public:
+	// a sample waiting to be persisted
+	struct Entry
+	{
+		const std::string *name;
+		const std::string *tags;
+		uint64_t timestamp;
+		double value;
+	};
+
+private:
+	struct Sample
+	{
+		uint64_t timestamp;
+		double value;
+	};
+
+	struct Series
+	{
+		std::string name;
+		std::string tags;
+		std::string host;
+
+		std::vector<Sample> ring;
+		std::size_t head;		// where the next sample goes
+		std::size_t count;
+		std::size_t pending;	// the newest samples not yet drained
+	};
+
+	std::string m_Hostname;
+	std::size_t m_Capacity;
+
+	// series are only ever added, so the entries drained stay valid
+	std::vector<Series*> m_Series;
+	mutable std::mutex m_Lock;
+
+public:
+	SelfMetrics(void);
+	~SelfMetrics(void);
+
+	// capacity is the number of samples kept for each series
+	void Configure(const std::string &hostname, std::size_t capacity);
+
+	void Record(const std::string &name, uint64_t timestamp, double value);
+
+	// whether a metric is kept here
+	bool Holds(const std::string &name) const;
+
+	// adds the matching samples to the buckets, and returns the oldest
+	// timestamp held, from which on the disk need not be read
+	uint64_t Scan(const Query &query, uint64_t startTime, uint64_t endTime,
+		std::map<uint64_t, ResultSet::Aggregate> &buckets) const;
+
+	// the samples recorded since the last call
+	void Drain(std::vector<Entry> &entries);
+
+private:
+	Series* Find(const std::string &name) const;
+	bool Matches(const Series &series, const Query &query) const;
+};
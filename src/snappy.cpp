@@ -0,0 +1,132 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Snappy decompression
+ *
+ */
+
+#include "snappy.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+// the two low bits of an element's tag byte
+#define SNAPPY_LITERAL		0
+#define SNAPPY_COPY_1		1	// 1 byte offset
+#define SNAPPY_COPY_2		2	// 2 byte offset
+#define SNAPPY_COPY_4		3	// 4 byte offset
+
+static bool Fail(std::string &error, const char *message)
+{
+	error.assign(message);
+	return false;
+}
+
+// reads a little-endian integer of 1 to 4 bytes
+static uint32_t ReadLE(const uint8_t *p, std::size_t bytes)
+{
+	uint32_t value = 0;
+	for (std::size_t b = 0; b < bytes; b++)
+		value |= (uint32_t)p[b] << (8 * b);
+	return value;
+}
+
+bool SnappyUncompress(const char *input, std::size_t length,
+	std::string &output, std::size_t maxLength, std::string &error)
+{
+	const uint8_t *in = reinterpret_cast<const uint8_t*>(input);
+	const uint8_t *end = in + length;
+
+	// the uncompressed length, as a varint of at most 5 bytes
+	uint64_t total = 0;
+	for (uint32_t shift = 0; ; shift += 7)
+	{
+		if (in == end || shift > 28)
+			return Fail(error, "Invalid snappy length");
+
+		uint8_t byte = *in++;
+		total |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			break;
+	}
+
+	if (total > maxLength)
+		return Fail(error, "Snappy block is too large");
+
+	output.resize((std::size_t)total);
+	char *out = &output[0];
+	std::size_t pos = 0;
+
+	while (in < end)
+	{
+		uint8_t tag = *in++;
+		std::size_t len;
+		std::size_t offset;
+
+		switch (tag & 3)
+		{
+		case SNAPPY_LITERAL:
+			len = tag >> 2;
+			if (len >= 60)
+			{
+				// the length minus one follows, in 1 to 4 bytes
+				std::size_t bytes = len - 59;
+				if ((std::size_t)(end - in) < bytes)
+					return Fail(error, "Truncated snappy literal");
+				len = ReadLE(in, bytes);
+				in += bytes;
+			}
+			++len;
+
+			if ((std::size_t)(end - in) < len || total - pos < len)
+				return Fail(error, "Truncated snappy literal");
+
+			memcpy(out + pos, in, len);
+			in += len;
+			pos += len;
+			continue;
+
+		case SNAPPY_COPY_1:
+			if (in == end)
+				return Fail(error, "Truncated snappy copy");
+			len = 4 + ((tag >> 2) & 7);
+			offset = ((std::size_t)(tag >> 5) << 8) | *in++;
+			break;
+
+		case SNAPPY_COPY_2:
+			if (end - in < 2)
+				return Fail(error, "Truncated snappy copy");
+			len = 1 + (tag >> 2);
+			offset = ReadLE(in, 2);
+			in += 2;
+			break;
+
+		default:	// SNAPPY_COPY_4
+			if (end - in < 4)
+				return Fail(error, "Truncated snappy copy");
+			len = 1 + (tag >> 2);
+			offset = ReadLE(in, 4);
+			in += 4;
+			break;
+		}
+
+		if (offset == 0 || offset > pos || total - pos < len)
+			return Fail(error, "Invalid snappy copy");
+
+		const char *src = out + pos - offset;
+		if (offset >= len)
+			memcpy(out + pos, src, len);
+		else
+		{
+			// overlapping, the pattern repeats
+			for (std::size_t b = 0; b < len; b++)
+				out[pos + b] = src[b];
+		}
+		pos += len;
+	}
+
+	if (pos != total)
+		return Fail(error, "Truncated snappy block");
+
+	return true;
+}
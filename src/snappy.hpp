@@ -0,0 +1,21 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Snappy decompression
+ *
+ * Only the raw block format, which is what Prometheus remote_write
+ * sends: a varint holding the uncompressed length, then a sequence of
+ * literals and back-references into the output. The framing format
+ * used for streams isn't supported.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// replaces output with the uncompressed block; false if the block is
+// malformed or would be larger than maxLength
+bool SnappyUncompress(const char *input, std::size_t length,
+	std::string &output, std::size_t maxLength, std::string &error);
@@ -5,6 +5,8 @@
  *
  */
 
+#include <cstring>
+#include <ctime>
 #include <stdexcept>
 
 #include "stats.hpp"
@@ -17,6 +19,8 @@ Statistics::Statistics(void)
 	m_PutCount = 0;
 	m_WriteCount = 0;
 	m_QueueBacklog = 0;
+	m_UdpDropCount = 0;
+	m_SeriesOverLimitCount = 0;
 
 	m_Thread = new Thread(this);
 	if (m_Thread == nullptr)
@@ -38,6 +42,13 @@ void Statistics::StopThread(void)
 	m_Thread->Stop();
 }
 
+void Statistics::ConfigureSelfMetrics(const std::string &hostname,
+	std::size_t retention)
+{
+	// one sample a second
+	m_SelfMetrics.Configure(hostname, retention);
+}
+
 bool Statistics::GetStats(Stats &stats, bool updated)
 {
 	if (updated && !m_Updated)
@@ -63,6 +74,16 @@ void Statistics::SetQueueBacklog(std::size_t count)
 	m_QueueBacklog.store(count);
 }
 
+void Statistics::AddUdpDropCount(std::size_t count)
+{
+	m_UdpDropCount += count;
+}
+
+void Statistics::AddSeriesOverLimitCount(std::size_t count)
+{
+	m_SeriesOverLimitCount += count;
+}
+
 void Statistics::Start(void)
 {
 	// nothing to do
@@ -78,13 +99,30 @@ void Statistics::Process(void)
 		m_Stats.putsPerSecond = m_PutCount / deltaTime;
 		m_Stats.writesPerSecond = m_WriteCount / deltaTime;
 		m_Stats.queueBacklog = (double)m_QueueBacklog;
+		m_Stats.udpDropsPerSecond = m_UdpDropCount / deltaTime;
+		m_Stats.seriesOverLimitPerSecond = m_SeriesOverLimitCount / deltaTime;
 
 		// reset the values
 		m_PutCount = 0;
 		m_WriteCount = 0;
+		m_UdpDropCount = 0;
+		m_SeriesOverLimitCount = 0;
 
 		m_LastTime = curTime;
 		m_Updated = true;
+
+		// straight into memory, however far behind the datastore is
+		uint64_t timestamp = time(nullptr);
+		m_SelfMetrics.Record("tsdb.internal.putspersecond", timestamp,
+			m_Stats.putsPerSecond);
+		m_SelfMetrics.Record("tsdb.internal.writespersecond", timestamp,
+			m_Stats.writesPerSecond);
+		m_SelfMetrics.Record("tsdb.internal.queuebacklog", timestamp,
+			m_Stats.queueBacklog);
+		m_SelfMetrics.Record("tsdb.internal.udpdropspersecond", timestamp,
+			m_Stats.udpDropsPerSecond);
+		m_SelfMetrics.Record("tsdb.internal.seriesoverlimitpersecond", timestamp,
+			m_Stats.seriesOverLimitPerSecond);
 	}
 	else
 		Sleep(50);
@@ -9,7 +9,9 @@
 
 #include <atomic>
 #include <cstdint>
+#include <string>
 
+#include "selfmetrics.hpp"
 #include "thread.hpp"
 #include "timer.hpp"
 
@@ -22,6 +24,10 @@ public:
 		double writesPerSecond;
 
 		double queueBacklog;
+
+		double udpDropsPerSecond;
+
+		double seriesOverLimitPerSecond;
 	};
 
 private:
@@ -34,6 +40,11 @@ private:
 	std::atomic_size_t m_PutCount;
 	std::atomic_size_t m_WriteCount;
 	std::atomic_size_t m_QueueBacklog;
+	std::atomic_size_t m_UdpDropCount;
+	std::atomic_size_t m_SeriesOverLimitCount;
+
+	// the rates, as the tsdb.internal metrics
+	SelfMetrics m_SelfMetrics;
 
 	Thread *m_Thread;
 
@@ -44,6 +55,11 @@ public:
 	bool StartThread(void);
 	void StopThread(void);
 
+	// the self-metrics are tagged with the host name, and the latest
+	// retention seconds of them are kept in memory
+	void ConfigureSelfMetrics(const std::string &hostname, std::size_t retention);
+	SelfMetrics& GetSelfMetrics(void) { return m_SelfMetrics; }
+
 	bool GetStats(Statistics::Stats &stats,
 		bool updated = false);
 
@@ -52,6 +68,12 @@ public:
 
 	void SetQueueBacklog(std::size_t count);
 
+	// UDP datagrams lost, and UDP lines that couldn't be parsed
+	void AddUdpDropCount(std::size_t count);
+
+	// points for new series past a series limit, whether dropped or not
+	void AddSeriesOverLimitCount(std::size_t count);
+
 protected:
 	void Start(void);
 	void Process(void);
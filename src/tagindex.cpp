@@ -0,0 +1,174 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Tag index
+ *
+ */
+
+#include "tagindex.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+
+static std::string ToLower(const char *str, std::size_t length)
+{
+	std::string lower(str, length);
+	std::transform(lower.begin(), lower.end(), lower.begin(),
+		[](unsigned char ch) { return (char)tolower(ch); });
+	return lower;
+}
+
+TagIndex::TagIndex(void)
+	: m_Count(0)
+{
+}
+
+TagIndex::~TagIndex(void)
+{
+}
+
+uint32_t TagIndex::AddSeries(const char *tags, std::size_t length,
+	bool *added)
+{
+	std::string key(tags, length);
+
+	// only the writer adds, so a lookup without the lock is safe here
+	std::unordered_map<std::string, uint32_t>::const_iterator existing =
+		m_SeriesIds.find(key);
+	if (existing != m_SeriesIds.end())
+	{
+		if (added)
+			*added = false;
+		return existing->second;
+	}
+
+	if (added)
+		*added = true;
+
+	std::unique_lock<std::shared_timed_mutex> lock(m_Lock);
+
+	uint32_t id = (uint32_t)m_Series.size();
+	m_Series.push_back(key);
+	m_SeriesIds.insert(std::pair<std::string, uint32_t>(key, id));
+	m_Count.store(m_Series.size(), std::memory_order_release);
+
+	// post the ID under each of the space separated key=value pairs
+	std::size_t pos = 0;
+	while (pos < length)
+	{
+		while (pos < length && tags[pos] == ' ')
+			++pos;
+
+		std::size_t end = pos;
+		while (end < length && tags[end] != ' ')
+			++end;
+
+		const char *eq = static_cast<const char*>(memchr(tags + pos, '=', end - pos));
+		if (eq)
+		{
+			Postings &postings = m_Postings[ToLower(tags + pos, eq - (tags + pos))];
+			postings.all.Add(id);
+			postings.values[ToLower(eq + 1, (tags + end) - (eq + 1))].Add(id);
+		}
+
+		pos = end;
+	}
+
+	return id;
+}
+
+std::size_t TagIndex::GetSeriesCount(void) const
+{
+	return m_Count.load(std::memory_order_acquire);
+}
+
+bool TagIndex::HasSeries(const char *tags, std::size_t length) const
+{
+	// the writer's own additions are all it can see change
+	return m_SeriesIds.find(std::string(tags, length)) != m_SeriesIds.end();
+}
+
+bool TagIndex::FindSeries(const char *tags, std::size_t length) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(m_Lock);
+	return m_SeriesIds.find(std::string(tags, length)) != m_SeriesIds.end();
+}
+
+void TagIndex::Resolve(const Query &query, std::vector<std::string> &series) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(m_Lock);
+
+	const std::vector<Query::Filter> &filters = query.GetFilters();
+
+	std::vector<uint32_t> ids;
+	if (filters.empty())
+	{
+		for (uint32_t id = 0; id < m_Series.size(); id++)
+			ids.push_back(id);
+	}
+	else
+	{
+		// filters are a logical AND
+		Bitmap result;
+		for (std::size_t i = 0; i < filters.size(); i++)
+		{
+			Bitmap matched;
+			Resolve(filters[i], matched);
+
+			if (i == 0)
+				result.Or(matched);
+			else
+				result.And(matched);
+
+			if (result.IsEmpty())
+				return;
+		}
+
+		result.ToVector(ids);
+	}
+
+	series.reserve(ids.size());
+	for (std::vector<uint32_t>::const_iterator id = ids.begin(); id != ids.end(); ++id)
+		series.push_back(m_Series[*id]);
+
+	std::sort(series.begin(), series.end());
+}
+
+void TagIndex::Resolve(const Query::Filter &filter, Bitmap &result) const
+{
+	std::map<std::string, Postings>::const_iterator postings =
+		m_Postings.find(ToLower(filter.key.c_str(), filter.key.length()));
+	if (postings == m_Postings.end())
+		return;
+
+	// values are a logical OR
+	for (std::vector<std::string>::const_iterator pattern = filter.values.begin();
+		pattern != filter.values.end(); ++pattern)
+	{
+		if (*pattern == "*")
+		{
+			result.Or(postings->second.all);
+			break;
+		}
+		else if (pattern->find('*') == std::string::npos)
+		{
+			std::map<std::string, Bitmap>::const_iterator value =
+				postings->second.values.find(ToLower(pattern->c_str(), pattern->length()));
+			if (value != postings->second.values.end())
+				result.Or(value->second);
+		}
+		else
+		{
+			// wildcards are matched against the distinct values of the key
+			for (std::map<std::string, Bitmap>::const_iterator value = postings->second.values.begin();
+				value != postings->second.values.end(); ++value)
+			{
+				if (Query::MatchPattern(pattern->c_str(), pattern->length(),
+					value->first.c_str(), value->first.length()))
+					result.Or(value->second);
+			}
+		}
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Tag index
+ *
+ * An inverted index from tag key=value pairs to the series of one metric.
+ * Each series (distinct tag string) gets a dense ID, and every key and
+ * key=value pair keeps a compressed bitmap of the IDs that carry it, so
+ * tag filters resolve to series with bitmap unions and intersections.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "query.hpp"
+
+class TagIndex
+{
+private:
+	struct Postings
+	{
+		Bitmap all;								// every series with the key
+		std::map<std::string, Bitmap> values;	// lower case value
+	};
+
+	std::vector<std::string> m_Series;
+	std::atomic_size_t m_Count;	// of m_Series, read without the lock
+	std::unordered_map<std::string, uint32_t> m_SeriesIds;
+	std::map<std::string, Postings> m_Postings;	// lower case key
+
+	// a single writer adds series, queries only read
+	mutable std::shared_timed_mutex m_Lock;
+
+public:
+	TagIndex(void);
+	~TagIndex(void);
+
+	// returns the series ID, adding the series if it is new
+	uint32_t AddSeries(const char *tags, std::size_t length,
+		bool *added = nullptr);
+	std::size_t GetSeriesCount(void) const;
+
+	// for the writer only, like adding
+	bool HasSeries(const char *tags, std::size_t length) const;
+
+	// from any other thread
+	bool FindSeries(const char *tags, std::size_t length) const;
+
+	// resolves the tag filters of a query to the sorted tag strings of
+	// every matching series
+	void Resolve(const Query &query, std::vector<std::string> &series) const;
+
+private:
+	void Resolve(const Query::Filter &filter, Bitmap &result) const;
+};
@@ -0,0 +1,83 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Tag sets
+ *
+ */
+
+#include "tags.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+typedef std::pair<std::string_view, std::string_view> tag_t;
+
+static bool IsSpace(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+bool CanonicalizeTags(std::string_view tags, std::string &canonical,
+	std::string &error)
+{
+	std::vector<tag_t> parsed;
+
+	std::size_t pos = 0;
+	while (pos < tags.length())
+	{
+		// any run of whitespace separates tags
+		if (IsSpace(tags[pos]))
+		{
+			++pos;
+			continue;
+		}
+
+		std::size_t start = pos;
+		while (pos < tags.length() && !IsSpace(tags[pos]))
+			++pos;
+
+		std::string_view tag = tags.substr(start, pos - start);
+		std::size_t equals = tag.find('=');
+		if (equals == 0 || equals == std::string_view::npos ||
+			equals == tag.length() - 1)
+		{
+			error.assign("Invalid tag: ");
+			error.append(tag.data(), tag.length());
+			return false;
+		}
+
+		parsed.push_back(tag_t(tag.substr(0, equals), tag.substr(equals + 1)));
+	}
+
+	if (parsed.empty())
+	{
+		error.assign("At least one tag is required");
+		return false;
+	}
+
+	std::sort(parsed.begin(), parsed.end());
+
+	canonical.clear();
+	canonical.reserve(tags.length());
+	for (std::size_t t = 0; t < parsed.size(); t++)
+	{
+		if (t > 0)
+		{
+			if (parsed[t].first == parsed[t - 1].first)
+			{
+				error.assign("Duplicate tag key: ");
+				error.append(parsed[t].first.data(), parsed[t].first.length());
+				return false;
+			}
+
+			canonical.append(1, ' ');
+		}
+
+		canonical.append(parsed[t].first.data(), parsed[t].first.length());
+		canonical.append(1, '=');
+		canonical.append(parsed[t].second.data(), parsed[t].second.length());
+	}
+
+	return true;
+}
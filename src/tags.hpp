@@ -0,0 +1,20 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Tag sets
+ *
+ * Tags are stored in one canonical form: key=value pairs sorted by key
+ * and separated by single spaces. The same set of tags always produces
+ * the same string, whatever order and spacing the client sent, so the
+ * string identifies a series.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// false when a tag is malformed or a key repeats
+bool CanonicalizeTags(std::string_view tags, std::string &canonical,
+	std::string &error);
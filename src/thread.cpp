@@ -5,7 +5,7 @@
  *
  */
 
-#include "Thread.hpp"
+#include "thread.hpp"
 
 #if defined(_WIN32) || defined(WIN32)
 #define WIN32_LEAN_AND_MEAN
@@ -87,10 +87,13 @@ bool Thread::Start(void)
 	m_Handle = CreateThread(NULL, 0, ThreadEntry, m_Helper,
 		0, NULL);
 #else
-	m_Handle = MemoryManager::Alloc(sizeof(pthread_t));
+	m_Handle = new pthread_t;
 	if (pthread_create((pthread_t*)m_Handle, NULL, ThreadEntry,
 		m_Helper))
-		return false;
+	{
+		delete (pthread_t*)m_Handle;
+		m_Handle = NULL;
+	}
 #endif
 
 	if (m_Handle == NULL)
@@ -115,7 +118,7 @@ void Thread::Stop(void)
 		CloseHandle((HANDLE)m_Handle);
 #else
 		pthread_join(*((pthread_t*)m_Handle), NULL);
-		MemoryManager::Free(m_Handle);
+		delete (pthread_t*)m_Handle;
 #endif
 				
 		m_Handle = nullptr;
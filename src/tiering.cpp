@@ -0,0 +1,174 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Tiered storage
+ *
+ */
+
+#include "tiering.hpp"
+#include "utility.hpp"
+
+#include "spdlog/spdlog.h"
+
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+#if defined(_WIN32) || defined(WIN32)
+#define PATH_SEP	"\\"
+#else
+#define PATH_SEP	"/"
+#endif
+
+#define CHECK_INTERVAL	60.0f		// seconds between looking for segments
+#define COPY_BUFFER		(1 << 20)
+
+TierMover::TierMover(Datastore *datastore, uint64_t coldAfter)
+	: m_DataStore(datastore), m_ColdAfter(coldAfter)
+{
+	m_LastCheck = -CHECK_INTERVAL;	// check as soon as we start
+
+	m_Thread = new Thread(this);
+	if (m_Thread == nullptr)
+		throw std::runtime_error("Failed to create tier mover thread");
+}
+
+TierMover::~TierMover(void)
+{
+	delete m_Thread;
+}
+
+bool TierMover::StartThread(void)
+{
+	return m_Thread->Start();
+}
+
+void TierMover::StopThread(void)
+{
+	m_Thread->Stop();
+}
+
+bool TierMover::MoveSegment(const std::string &name, const segment_ptr &segment)
+{
+	const std::string &source = segment->GetPath();
+
+	std::string target(m_DataStore->GetColdDir());
+	target.append(source.substr(source.rfind(PATH_SEP)));
+	if (target == source)
+	{
+		spdlog::error("Segment {0} is already in the cold tier", source.c_str());
+		return false;
+	}
+
+	// copy under a temporary name, so a partial file is never loaded
+	std::string tmpTarget(target);
+	tmpTarget.append(".tmp");
+
+	if (!CopySegmentFile(source, tmpTarget))
+	{
+		remove(tmpTarget.c_str());
+		return false;
+	}
+
+	if (rename(tmpTarget.c_str(), target.c_str()) != 0)
+	{
+		spdlog::warn("Failed to rename segment {0}", tmpTarget.c_str());
+		remove(tmpTarget.c_str());
+		return false;
+	}
+
+	if (!SyncDirectory(m_DataStore->GetColdDir()))
+	{
+		spdlog::warn("Failed to sync {0}", m_DataStore->GetColdDir().c_str());
+		remove(target.c_str());
+		return false;
+	}
+
+	segment_ptr replacement = std::make_shared<Segment>(target);
+	if (!replacement->Open() ||
+		!m_DataStore->ReplaceSegment(name, segment, replacement))
+	{
+		// the segment is gone (or unreadable), keep the hot copy
+		replacement.reset();
+		remove(target.c_str());
+		return false;
+	}
+
+	segment->RemoveOnRelease();
+
+	spdlog::info("Moved segment {0} to {1}", source.c_str(), target.c_str());
+	return true;
+}
+
+bool TierMover::CopySegmentFile(const std::string &source, const std::string &target)
+{
+	FILE *in = fopen(source.c_str(), "rb");
+	if (in == nullptr)
+	{
+		spdlog::warn("Failed to open segment {0}", source.c_str());
+		return false;
+	}
+
+	FILE *out = fopen(target.c_str(), "wb");
+	if (out == nullptr)
+	{
+		spdlog::warn("Failed to create segment {0}", target.c_str());
+		fclose(in);
+		return false;
+	}
+
+	std::unique_ptr<char[]> buffer(new char[COPY_BUFFER]);
+
+	bool ok = true;
+	std::size_t len = 0;
+	while (ok && (len = fread(buffer.get(), 1, COPY_BUFFER, in)) > 0)
+		ok = fwrite(buffer.get(), 1, len, out) == len;
+
+	// the hot copy is removed once this one is in use
+	ok = ok && !ferror(in) && SyncFile(out);
+
+	fclose(in);
+	fclose(out);
+
+	if (!ok)
+		spdlog::warn("Failed to copy segment {0} to {1}", source.c_str(), target.c_str());
+
+	return ok;
+}
+
+void TierMover::Start(void)
+{
+	spdlog::info("Tier mover started, segments move after {0} seconds", m_ColdAfter);
+}
+
+void TierMover::Process(void)
+{
+	float curTime = m_Timer.Elapsed();
+	if (curTime - m_LastCheck < CHECK_INTERVAL)
+	{
+		Sleep(500);
+		return;
+	}
+
+	m_LastCheck = curTime;
+
+	uint64_t now = time(nullptr);
+	if (now < m_ColdAfter)
+		return;
+
+	std::vector<std::pair<std::string, segment_ptr> > segments;
+	m_DataStore->GetHotSegments(now - m_ColdAfter, segments);
+
+	for (std::vector<std::pair<std::string, segment_ptr> >::const_iterator segment = segments.begin();
+		segment != segments.end(); ++segment)
+	{
+		if (!MoveSegment(segment->first, segment->second))
+			break;	// try again on the next check
+	}
+}
+
+void TierMover::Stop(void)
+{
+	spdlog::info("Tier mover stopped");
+}
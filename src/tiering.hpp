@@ -0,0 +1,47 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Tiered storage
+ *
+ * Moves sealed segments that are older than a threshold from the data
+ * directory to a secondary (cold) directory, typically on larger and
+ * cheaper disks. Queries keep reading the old copy until they finish.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "datastore.hpp"
+#include "thread.hpp"
+#include "timer.hpp"
+
+class TierMover : public ThreadProc
+{
+private:
+	Datastore *m_DataStore;
+	uint64_t m_ColdAfter;
+
+	Timer m_Timer;
+	float m_LastCheck;
+
+	Thread *m_Thread;
+
+public:
+	TierMover(Datastore *datastore, uint64_t coldAfter);
+	~TierMover(void);
+
+	bool StartThread(void);
+	void StopThread(void);
+
+private:
+	bool MoveSegment(const std::string &name, const segment_ptr &segment);
+	static bool CopySegmentFile(const std::string &source, const std::string &target);
+
+protected:
+	void Start(void);
+	void Process(void);
+	void Stop(void);
+};
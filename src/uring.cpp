@@ -0,0 +1,382 @@
+/*
+ * Simple Time-Series Database
+ *
+ * io_uring
+ *
+ */
+
+#include "uring.hpp"
+
+#if defined(USE_URING)
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#define PROBE_GROUP		0
+#define PROBE_TIMEOUT_MS	1000
+
+static int32_t io_uring_setup(uint32_t entries, struct io_uring_params *params)
+{
+	return (int32_t)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int32_t io_uring_enter(int32_t fd, uint32_t submit, uint32_t wait,
+	uint32_t flags, void *arg, std::size_t size)
+{
+	return (int32_t)syscall(__NR_io_uring_enter, fd, submit, wait, flags,
+		arg, size);
+}
+
+static int32_t io_uring_register(int32_t fd, uint32_t opcode, void *arg,
+	uint32_t count)
+{
+	return (int32_t)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+IoUring::IoUring(void)
+	: m_Fd(-1), m_SqRing(MAP_FAILED), m_SqRingSize(0), m_CqRing(MAP_FAILED),
+	  m_CqRingSize(0), m_Sqes((struct io_uring_sqe*)MAP_FAILED), m_SqesSize(0),
+	  m_SqHead(nullptr), m_SqTail(nullptr), m_SqMask(0), m_SqEntries(0),
+	  m_SqLocalTail(0), m_CqHead(nullptr), m_CqTail(nullptr), m_CqMask(0),
+	  m_Cqes(nullptr), m_BufRing((struct io_uring_buf_ring*)MAP_FAILED),
+	  m_BufRingSize(0), m_Buffers(nullptr), m_BufCount(0), m_BufSize(0),
+	  m_BufGroup(0), m_BufTail(0)
+{
+}
+
+IoUring::~IoUring(void)
+{
+	Close();
+}
+
+bool IoUring::Open(uint32_t entries, uint32_t completions)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = completions;
+
+	m_Fd = io_uring_setup(entries, &params);
+	if (m_Fd == -1)
+		return false;
+
+	// the timeout is passed with the wait itself
+	if ((params.features & IORING_FEAT_EXT_ARG) == 0)
+	{
+		Close();
+		errno = ENOTSUP;
+		return false;
+	}
+
+	m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	m_CqRingSize = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+
+	// both rings share a mapping on any kernel recent enough for the rest
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (m_CqRingSize > m_SqRingSize)
+			m_SqRingSize = m_CqRingSize;
+		m_CqRingSize = 0;
+	}
+
+	m_SqRing = mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
+	if (m_SqRing == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	if (m_CqRingSize == 0)
+		m_CqRing = m_SqRing;
+	else
+	{
+		m_CqRing = mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_CQ_RING);
+		if (m_CqRing == MAP_FAILED)
+		{
+			Close();
+			return false;
+		}
+	}
+
+	m_SqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	m_Sqes = (struct io_uring_sqe*)mmap(nullptr, m_SqesSize,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd,
+		IORING_OFF_SQES);
+	if (m_Sqes == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	char *sq = static_cast<char*>(m_SqRing);
+	m_SqHead = (uint32_t*)(sq + params.sq_off.head);
+	m_SqTail = (uint32_t*)(sq + params.sq_off.tail);
+	m_SqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+	m_SqEntries = params.sq_entries;
+	m_SqLocalTail = *m_SqTail;
+
+	// every slot of the array always points at the entry of the same index
+	uint32_t *array = (uint32_t*)(sq + params.sq_off.array);
+	for (uint32_t e = 0; e < m_SqEntries; e++)
+		array[e] = e;
+
+	char *cq = static_cast<char*>(m_CqRing);
+	m_CqHead = (uint32_t*)(cq + params.cq_off.head);
+	m_CqTail = (uint32_t*)(cq + params.cq_off.tail);
+	m_CqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+	m_Cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	return true;
+}
+
+void IoUring::Close(void)
+{
+	// closing the ring cancels whatever is still in flight
+	if (m_Fd != -1)
+	{
+		close(m_Fd);
+		m_Fd = -1;
+	}
+
+	if (m_Sqes != MAP_FAILED)
+		munmap(m_Sqes, m_SqesSize);
+	m_Sqes = (struct io_uring_sqe*)MAP_FAILED;
+
+	if (m_CqRing != MAP_FAILED && m_CqRing != m_SqRing)
+		munmap(m_CqRing, m_CqRingSize);
+	m_CqRing = MAP_FAILED;
+
+	if (m_SqRing != MAP_FAILED)
+		munmap(m_SqRing, m_SqRingSize);
+	m_SqRing = MAP_FAILED;
+
+	if (m_BufRing != MAP_FAILED)
+		munmap(m_BufRing, m_BufRingSize);
+	m_BufRing = (struct io_uring_buf_ring*)MAP_FAILED;
+
+	delete [] m_Buffers;
+	m_Buffers = nullptr;
+}
+
+bool IoUring::ProvideBuffers(uint16_t group, uint32_t count, uint32_t size)
+{
+	// the kernel needs the ring page aligned
+	m_BufRingSize = count * sizeof(struct io_uring_buf);
+	m_BufRing = (struct io_uring_buf_ring*)mmap(nullptr, m_BufRingSize,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m_BufRing == MAP_FAILED)
+		return false;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)m_BufRing;
+	reg.ring_entries = count;
+	reg.bgid = group;
+	if (io_uring_register(m_Fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+		return false;
+
+	m_Buffers = new char[(std::size_t)count * size];
+	m_BufCount = count;
+	m_BufSize = size;
+	m_BufGroup = group;
+	m_BufTail = 0;
+
+	for (uint32_t id = 0; id < count; id++)
+		RecycleBuffer((uint16_t)id);
+
+	return true;
+}
+
+const char* IoUring::GetBuffer(uint16_t id) const
+{
+	return m_Buffers + (std::size_t)id * m_BufSize;
+}
+
+void IoUring::RecycleBuffer(uint16_t id)
+{
+	// not through bufs, which C++ places past an empty struct of the header
+	struct io_uring_buf *buf = reinterpret_cast<struct io_uring_buf*>(m_BufRing) +
+		(m_BufTail & (m_BufCount - 1));
+	buf->addr = (uint64_t)(uintptr_t)GetBuffer(id);
+	buf->len = m_BufSize;
+	buf->bid = id;
+
+	// the tail shares the first entry, past the fields just written
+	++m_BufTail;
+	__atomic_store_n(&m_BufRing->tail, m_BufTail, __ATOMIC_RELEASE);
+}
+
+bool IoUring::Accept(int32_t listener, uint64_t data)
+{
+	struct io_uring_sqe *sqe = GetSqe();
+	if (sqe == nullptr)
+		return false;
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listener;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = data;
+	return true;
+}
+
+bool IoUring::Receive(int32_t sock, uint64_t data)
+{
+	struct io_uring_sqe *sqe = GetSqe();
+	if (sqe == nullptr)
+		return false;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = m_BufGroup;
+	sqe->user_data = data;
+	return true;
+}
+
+bool IoUring::Cancel(uint64_t target, uint64_t data)
+{
+	struct io_uring_sqe *sqe = GetSqe();
+	if (sqe == nullptr)
+		return false;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = data;
+	return true;
+}
+
+bool IoUring::CancelAll(uint64_t data)
+{
+	struct io_uring_sqe *sqe = GetSqe();
+	if (sqe == nullptr)
+		return false;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+	sqe->user_data = data;
+	return true;
+}
+
+void IoUring::Submit(void)
+{
+	uint32_t pending = GetPending();
+	if (pending > 0)
+		io_uring_enter(m_Fd, pending, 0, 0, nullptr, 0);
+}
+
+bool IoUring::Wait(int32_t timeout)
+{
+	struct __kernel_timespec ts;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	if (io_uring_enter(m_Fd, GetPending(), 1,
+		IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) == -1)
+	{
+		// EBUSY is completions the ring had no room for, they come next
+		if (errno != ETIME && errno != EINTR && errno != EBUSY)
+			return false;
+	}
+
+	return true;
+}
+
+uint32_t IoUring::Reap(struct io_uring_cqe *cqes, uint32_t max)
+{
+	uint32_t head = *m_CqHead;
+	uint32_t tail = __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE);
+
+	uint32_t count = 0;
+	while (head != tail && count < max)
+	{
+		memcpy(&cqes[count++], &m_Cqes[head & m_CqMask],
+			sizeof(struct io_uring_cqe));
+		++head;
+	}
+
+	__atomic_store_n(m_CqHead, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+bool IoUring::IsSupported(void)
+{
+	IoUring ring;
+	if (!ring.Open(4, 8) || !ring.ProvideBuffers(PROBE_GROUP, 2, 16))
+		return false;
+
+	int32_t pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1)
+		return false;
+
+	// an older kernel refuses the multishot flag, or completes only once
+	bool supported = false;
+	if (ring.Receive(pair[0], 1) && send(pair[1], "x", 1, MSG_NOSIGNAL) == 1)
+	{
+		struct io_uring_cqe cqe;
+		if (ring.Wait(PROBE_TIMEOUT_MS) && ring.Reap(&cqe, 1) == 1)
+		{
+			supported = cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER) &&
+				(cqe.flags & IORING_CQE_F_MORE);
+		}
+	}
+
+	// the hang up ends the receive before its buffers are freed
+	close(pair[1]);
+	if (supported)
+	{
+		struct io_uring_cqe cqe;
+		for (uint32_t wait = 0; wait < 3; wait++)
+		{
+			if (ring.Reap(&cqe, 1) == 1 && (cqe.flags & IORING_CQE_F_MORE) == 0)
+				break;
+			ring.Wait(PROBE_TIMEOUT_MS);
+		}
+	}
+
+	close(pair[0]);
+	return supported;
+}
+
+struct io_uring_sqe* IoUring::GetSqe(void)
+{
+	// make room by handing the queue to the kernel
+	if (GetPending() >= m_SqEntries)
+	{
+		Submit();
+		if (GetPending() >= m_SqEntries)
+			return nullptr;
+	}
+
+	struct io_uring_sqe *sqe = &m_Sqes[m_SqLocalTail & m_SqMask];
+	memset(sqe, 0, sizeof(*sqe));
+
+	// the kernel only reads the queue when entered, by this same thread,
+	// so the entry can be filled in once it is already in the ring
+	++m_SqLocalTail;
+	__atomic_store_n(m_SqTail, m_SqLocalTail, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+uint32_t IoUring::GetPending(void) const
+{
+	return m_SqLocalTail - __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+}
+
+#endif
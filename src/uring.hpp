@@ -0,0 +1,101 @@
+/*
+ * Simple Time-Series Database
+ *
+ * io_uring
+ *
+ * A minimal io_uring, set up with the raw system calls so there is
+ * nothing to link against. It only has what the reactor needs: multishot
+ * accepts and receives, which keep completing until cancelled, and a
+ * ring of provided buffers the kernel picks from as data arrives, so an
+ * idle connection doesn't hold a buffer of its own.
+ *
+ */
+
+#pragma once
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT)
+#define USE_URING
+#endif
+#endif
+#endif
+
+#if defined(USE_URING)
+
+#include <cstddef>
+#include <cstdint>
+
+class IoUring
+{
+private:
+	int32_t m_Fd;
+
+	// the rings shared with the kernel
+	void *m_SqRing;
+	std::size_t m_SqRingSize;
+	void *m_CqRing;
+	std::size_t m_CqRingSize;
+	struct io_uring_sqe *m_Sqes;
+	std::size_t m_SqesSize;
+
+	uint32_t *m_SqHead;
+	uint32_t *m_SqTail;
+	uint32_t m_SqMask;
+	uint32_t m_SqEntries;
+	uint32_t m_SqLocalTail;		// queued, not yet seen by the kernel
+
+	uint32_t *m_CqHead;
+	uint32_t *m_CqTail;
+	uint32_t m_CqMask;
+	struct io_uring_cqe *m_Cqes;
+
+	// provided buffers
+	struct io_uring_buf_ring *m_BufRing;
+	std::size_t m_BufRingSize;
+	char *m_Buffers;
+	uint32_t m_BufCount;
+	uint32_t m_BufSize;
+	uint16_t m_BufGroup;
+	uint16_t m_BufTail;
+
+public:
+	IoUring(void);
+	~IoUring(void);
+
+	// false if the kernel has no io_uring, or it isn't allowed
+	bool Open(uint32_t entries, uint32_t completions);
+	void Close(void);
+
+	// count must be a power of two
+	bool ProvideBuffers(uint16_t group, uint32_t count, uint32_t size);
+	const char* GetBuffer(uint16_t id) const;
+	void RecycleBuffer(uint16_t id);
+
+	// queued until the next Wait or Submit; data comes back with each
+	// completion, and false means the queue is full
+	bool Accept(int32_t listener, uint64_t data);
+	bool Receive(int32_t sock, uint64_t data);
+	bool Cancel(uint64_t target, uint64_t data);
+	bool CancelAll(uint64_t data);
+
+	void Submit(void);
+
+	// submits what is queued and waits up to timeout milliseconds for a
+	// completion; false on an error other than the timeout
+	bool Wait(int32_t timeout);
+
+	// takes up to max completions off the ring
+	uint32_t Reap(struct io_uring_cqe *cqes, uint32_t max);
+
+	// whether the kernel has everything the reactor needs: multishot
+	// receives into provided buffers and waiting with a timeout
+	static bool IsSupported(void);
+
+private:
+	struct io_uring_sqe* GetSqe(void);
+	uint32_t GetPending(void) const;
+};
+
+#endif
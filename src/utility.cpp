@@ -7,6 +7,15 @@
 
 #include "utility.hpp"
 
+#include <cstdlib>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 uint64_t ParseTime(const std::string &str)
 {
 	char *end = nullptr;
@@ -51,3 +60,52 @@ std::size_t SplitString(const std::string &input, char delim,
 
 	return output.size();
 }
+
+bool SyncFile(FILE *fp)
+{
+	if (fflush(fp) != 0)
+		return false;
+
+#if defined(_WIN32) || defined(WIN32)
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+bool SyncDirectory(const std::string &dir)
+{
+#if defined(_WIN32) || defined(WIN32)
+	// NTFS journals the directory entries itself
+	return true;
+#else
+	int fd = open(dir.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	bool ok = fsync(fd) == 0;
+	close(fd);
+	return ok;
+#endif
+}
+
+bool GetCanonicalPath(const std::string &path, std::string &canonical)
+{
+#if defined(_WIN32) || defined(WIN32)
+	char resolved[_MAX_PATH];
+	if (_fullpath(resolved, path.c_str(), _MAX_PATH) == nullptr ||
+		_access(resolved, 0) != 0)
+		return false;
+
+	canonical.assign(resolved);
+	return true;
+#else
+	char *resolved = realpath(path.c_str(), nullptr);
+	if (resolved == nullptr)
+		return false;
+
+	canonical.assign(resolved);
+	free(resolved);
+	return true;
+#endif
+}
@@ -8,9 +8,19 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdio>
 #include <string>
 #include <vector>
 
 uint64_t ParseTime(const std::string &str);
 std::size_t SplitString(const std::string &input, char delim,
 	std::vector<std::string> &output);
+
+// flushes a file's buffered and cached data to the disk
+bool SyncFile(FILE *fp);
+
+// makes the files created, renamed or removed in a directory durable
+bool SyncDirectory(const std::string &dir);
+
+// the absolute path of an existing file or directory, links resolved
+bool GetCanonicalPath(const std::string &path, std::string &canonical);
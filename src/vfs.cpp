@@ -0,0 +1,439 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Compressing SQLite VFS
+ *
+ */
+
+#include "vfs.hpp"
+#include "codec.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <Windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "spdlog/spdlog.h"
+#include "sqlite3.h"
+
+// compressed pages start with a marker that no b-tree, overflow or
+// freelist trunk page can: a page type of 0xFF, or a next page number
+// far beyond the largest possible database
+#define PAGE_MAGIC			"\xff" "SZ\x01"
+#define PAGE_HEADER_SIZE	8	// magic, then the compressed length
+#define HOLE_BLOCK			4096	// filesystem allocation unit
+
+struct CompressedFile
+{
+	sqlite3_file base;		// must be first
+	sqlite3_file *real;		// the platform file, allocated right after
+	uint8_t *scratch;		// compressed page buffer, main databases only
+	int scratchSize;
+
+#if defined(_WIN32) || defined(WIN32)
+	HANDLE handle;
+#else
+	int fd;					// used to punch holes, closed after the real file
+#endif
+};
+
+static sqlite3_vfs *s_Parent = nullptr;
+static bool s_Compress = false;
+
+static bool IsPage(int amount, sqlite3_int64 offset)
+{
+	// page 1 holds the database header, so it is never compressed
+	return offset > 0 && amount >= 512 && amount <= 65536 &&
+		(amount & (amount - 1)) == 0 && (offset % amount) == 0;
+}
+
+static void PunchHole(CompressedFile *file, sqlite3_int64 offset,
+	sqlite3_int64 length)
+{
+#if defined(_WIN32) || defined(WIN32)
+	if (file->handle == INVALID_HANDLE_VALUE)
+		return;
+
+	FILE_ZERO_DATA_INFORMATION zero;
+	zero.FileOffset.QuadPart = offset;
+	zero.BeyondFinalZero.QuadPart = offset + length;
+
+	DWORD bytes = 0;
+	DeviceIoControl(file->handle, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero),
+		nullptr, 0, &bytes, nullptr);
+#elif defined(FALLOC_FL_PUNCH_HOLE)
+	if (file->fd < 0)
+		return;
+
+	// best effort, an unsupported filesystem just keeps the blocks
+	fallocate(file->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		offset, length);
+#else
+	(void)file;
+	(void)offset;
+	(void)length;
+#endif
+}
+
+static int vfsClose(sqlite3_file *pFile)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	int result = file->real->pMethods->xClose(file->real);
+
+	// closing a descriptor drops the process' POSIX locks on the file, so
+	// this must wait until SQLite has released its own
+#if !defined(_WIN32) && !defined(WIN32)
+	if (file->fd >= 0)
+		close(file->fd);
+#endif
+
+	sqlite3_free(file->scratch);
+	return result;
+}
+
+static int vfsRead(sqlite3_file *pFile, void *zBuf, int iAmt,
+	sqlite3_int64 iOfst)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	int result = file->real->pMethods->xRead(file->real, zBuf, iAmt, iOfst);
+	if (result != SQLITE_OK || file->scratch == nullptr || !IsPage(iAmt, iOfst))
+		return result;
+
+	uint8_t *page = (uint8_t*)zBuf;
+	if (memcmp(page, PAGE_MAGIC, 4) != 0)
+		return SQLITE_OK;	// stored uncompressed
+
+	uint32_t length = page[4] | (page[5] << 8) | (page[6] << 16) |
+		((uint32_t)page[7] << 24);
+	if (length > (uint32_t)(iAmt - PAGE_HEADER_SIZE) || iAmt > file->scratchSize)
+		return SQLITE_OK;	// not ours after all, e.g. a freelist leaf
+
+	memcpy(file->scratch, page + PAGE_HEADER_SIZE, length);
+	if (!LzDecompress(file->scratch, length, page, iAmt))
+	{
+		// restore the raw page; only pages SQLite never interprets (freelist
+		// leaves) can carry the marker without having been compressed
+		file->real->pMethods->xRead(file->real, zBuf, iAmt, iOfst);
+	}
+
+	return SQLITE_OK;
+}
+
+static int vfsWrite(sqlite3_file *pFile, const void *zBuf, int iAmt,
+	sqlite3_int64 iOfst)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	if (!s_Compress || file->scratch == nullptr || !IsPage(iAmt, iOfst) ||
+		iAmt > file->scratchSize)
+		return file->real->pMethods->xWrite(file->real, zBuf, iAmt, iOfst);
+
+	// only worth it when at least one filesystem block is freed
+	int limit = iAmt - HOLE_BLOCK;
+	std::size_t length = 0;
+	if (limit > PAGE_HEADER_SIZE)
+	{
+		length = LzCompress((const uint8_t*)zBuf, iAmt,
+			file->scratch + PAGE_HEADER_SIZE, limit - PAGE_HEADER_SIZE);
+	}
+
+	if (length == 0)
+		return file->real->pMethods->xWrite(file->real, zBuf, iAmt, iOfst);
+
+	memcpy(file->scratch, PAGE_MAGIC, 4);
+	file->scratch[4] = (uint8_t)(length & 0xff);
+	file->scratch[5] = (uint8_t)((length >> 8) & 0xff);
+	file->scratch[6] = (uint8_t)((length >> 16) & 0xff);
+	file->scratch[7] = (uint8_t)((length >> 24) & 0xff);
+
+	int used = (int)(PAGE_HEADER_SIZE + length);
+	int result = file->real->pMethods->xWrite(file->real, file->scratch,
+		used, iOfst);
+	if (result != SQLITE_OK)
+		return result;
+
+	// SQLite counts pages by the file size, so a page appended at the end
+	// must still extend the file over its whole slot
+	sqlite3_int64 size = 0;
+	result = file->real->pMethods->xFileSize(file->real, &size);
+	if (result == SQLITE_OK && size < iOfst + iAmt)
+	{
+		uint8_t zero = 0;
+		result = file->real->pMethods->xWrite(file->real, &zero, 1,
+			iOfst + iAmt - 1);
+	}
+	if (result != SQLITE_OK)
+		return result;
+
+	int allocated = ((used + HOLE_BLOCK - 1) / HOLE_BLOCK) * HOLE_BLOCK;
+	if (allocated < iAmt)
+		PunchHole(file, iOfst + allocated, iAmt - allocated);
+
+	return SQLITE_OK;
+}
+
+static int vfsTruncate(sqlite3_file *pFile, sqlite3_int64 size)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xTruncate(file->real, size);
+}
+
+static int vfsSync(sqlite3_file *pFile, int flags)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xSync(file->real, flags);
+}
+
+static int vfsFileSize(sqlite3_file *pFile, sqlite3_int64 *pSize)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xFileSize(file->real, pSize);
+}
+
+static int vfsLock(sqlite3_file *pFile, int eLock)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xLock(file->real, eLock);
+}
+
+static int vfsUnlock(sqlite3_file *pFile, int eLock)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xUnlock(file->real, eLock);
+}
+
+static int vfsCheckReservedLock(sqlite3_file *pFile, int *pResOut)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xCheckReservedLock(file->real, pResOut);
+}
+
+static int vfsFileControl(sqlite3_file *pFile, int op, void *pArg)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xFileControl(file->real, op, pArg);
+}
+
+static int vfsSectorSize(sqlite3_file *pFile)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xSectorSize(file->real);
+}
+
+static int vfsDeviceCharacteristics(sqlite3_file *pFile)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xDeviceCharacteristics(file->real);
+}
+
+static int vfsShmMap(sqlite3_file *pFile, int iPg, int pgsz, int bExtend,
+	void volatile **pp)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xShmMap(file->real, iPg, pgsz, bExtend, pp);
+}
+
+static int vfsShmLock(sqlite3_file *pFile, int offset, int n, int flags)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xShmLock(file->real, offset, n, flags);
+}
+
+static void vfsShmBarrier(sqlite3_file *pFile)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	file->real->pMethods->xShmBarrier(file->real);
+}
+
+static int vfsShmUnmap(sqlite3_file *pFile, int deleteFlag)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	return file->real->pMethods->xShmUnmap(file->real, deleteFlag);
+}
+
+// version 2: without xFetch, SQLite never memory maps the database, so
+// every page read comes through vfsRead
+static const sqlite3_io_methods s_Methods =
+{
+	2,
+	vfsClose,
+	vfsRead,
+	vfsWrite,
+	vfsTruncate,
+	vfsSync,
+	vfsFileSize,
+	vfsLock,
+	vfsUnlock,
+	vfsCheckReservedLock,
+	vfsFileControl,
+	vfsSectorSize,
+	vfsDeviceCharacteristics,
+	vfsShmMap,
+	vfsShmLock,
+	vfsShmBarrier,
+	vfsShmUnmap,
+	nullptr,
+	nullptr
+};
+
+static int vfsOpen(sqlite3_vfs *pVfs, const char *zName, sqlite3_file *pFile,
+	int flags, int *pOutFlags)
+{
+	CompressedFile *file = (CompressedFile*)pFile;
+	memset(file, 0, sizeof(CompressedFile));
+	file->real = (sqlite3_file*)(file + 1);
+#if defined(_WIN32) || defined(WIN32)
+	file->handle = INVALID_HANDLE_VALUE;
+#else
+	file->fd = -1;
+#endif
+
+	int result = s_Parent->xOpen(s_Parent, zName, file->real, flags, pOutFlags);
+	if (file->real->pMethods == nullptr)
+		return result;
+
+	file->base.pMethods = &s_Methods;
+	if (result != SQLITE_OK || (flags & SQLITE_OPEN_MAIN_DB) == 0 ||
+		zName == nullptr)
+		return result;
+
+	file->scratchSize = 65536;
+	file->scratch = (uint8_t*)sqlite3_malloc(file->scratchSize);
+	if (file->scratch == nullptr)
+		return SQLITE_OK;	// pass pages through untouched
+
+#if defined(_WIN32) || defined(WIN32)
+	if (file->real->pMethods->xFileControl(file->real,
+		SQLITE_FCNTL_WIN32_GET_HANDLE, &file->handle) == SQLITE_OK)
+	{
+		DWORD bytes = 0;
+		DeviceIoControl(file->handle, FSCTL_SET_SPARSE, nullptr, 0,
+			nullptr, 0, &bytes, nullptr);
+	}
+	else
+		file->handle = INVALID_HANDLE_VALUE;
+#else
+	if (s_Compress && (flags & SQLITE_OPEN_READONLY) == 0)
+		file->fd = open(zName, O_RDWR | O_CLOEXEC);
+#endif
+
+	return SQLITE_OK;
+}
+
+static int vfsDelete(sqlite3_vfs *pVfs, const char *zName, int syncDir)
+{
+	return s_Parent->xDelete(s_Parent, zName, syncDir);
+}
+
+static int vfsAccess(sqlite3_vfs *pVfs, const char *zName, int flags,
+	int *pResOut)
+{
+	return s_Parent->xAccess(s_Parent, zName, flags, pResOut);
+}
+
+static int vfsFullPathname(sqlite3_vfs *pVfs, const char *zName, int nOut,
+	char *zOut)
+{
+	return s_Parent->xFullPathname(s_Parent, zName, nOut, zOut);
+}
+
+static void* vfsDlOpen(sqlite3_vfs *pVfs, const char *zFilename)
+{
+	return s_Parent->xDlOpen(s_Parent, zFilename);
+}
+
+static void vfsDlError(sqlite3_vfs *pVfs, int nByte, char *zErrMsg)
+{
+	s_Parent->xDlError(s_Parent, nByte, zErrMsg);
+}
+
+static void (*vfsDlSym(sqlite3_vfs *pVfs, void *p, const char *zSym))(void)
+{
+	return s_Parent->xDlSym(s_Parent, p, zSym);
+}
+
+static void vfsDlClose(sqlite3_vfs *pVfs, void *p)
+{
+	s_Parent->xDlClose(s_Parent, p);
+}
+
+static int vfsRandomness(sqlite3_vfs *pVfs, int nByte, char *zOut)
+{
+	return s_Parent->xRandomness(s_Parent, nByte, zOut);
+}
+
+static int vfsSleep(sqlite3_vfs *pVfs, int microseconds)
+{
+	return s_Parent->xSleep(s_Parent, microseconds);
+}
+
+static int vfsCurrentTime(sqlite3_vfs *pVfs, double *pTime)
+{
+	return s_Parent->xCurrentTime(s_Parent, pTime);
+}
+
+static int vfsGetLastError(sqlite3_vfs *pVfs, int nBuf, char *zBuf)
+{
+	return s_Parent->xGetLastError(s_Parent, nBuf, zBuf);
+}
+
+static int vfsCurrentTimeInt64(sqlite3_vfs *pVfs, sqlite3_int64 *pTime)
+{
+	return s_Parent->xCurrentTimeInt64(s_Parent, pTime);
+}
+
+static sqlite3_vfs s_Vfs;
+
+bool RegisterCompressedVfs(bool compress)
+{
+	if (s_Parent != nullptr)
+	{
+		s_Compress = compress;
+		return true;
+	}
+
+	s_Parent = sqlite3_vfs_find(nullptr);
+	if (s_Parent == nullptr || s_Parent->iVersion < 2)
+	{
+		s_Parent = nullptr;
+		spdlog::error("The default SQLite VFS can't be wrapped");
+		return false;
+	}
+
+	s_Compress = compress;
+
+	memset(&s_Vfs, 0, sizeof(s_Vfs));
+	s_Vfs.iVersion = 2;
+	s_Vfs.szOsFile = sizeof(CompressedFile) + s_Parent->szOsFile;
+	s_Vfs.mxPathname = s_Parent->mxPathname;
+	s_Vfs.zName = STSDB_VFS_NAME;
+	s_Vfs.xOpen = vfsOpen;
+	s_Vfs.xDelete = vfsDelete;
+	s_Vfs.xAccess = vfsAccess;
+	s_Vfs.xFullPathname = vfsFullPathname;
+	s_Vfs.xDlOpen = vfsDlOpen;
+	s_Vfs.xDlError = vfsDlError;
+	s_Vfs.xDlSym = vfsDlSym;
+	s_Vfs.xDlClose = vfsDlClose;
+	s_Vfs.xRandomness = vfsRandomness;
+	s_Vfs.xSleep = vfsSleep;
+	s_Vfs.xCurrentTime = vfsCurrentTime;
+	s_Vfs.xGetLastError = vfsGetLastError;
+	s_Vfs.xCurrentTimeInt64 = vfsCurrentTimeInt64;
+
+	int result = sqlite3_vfs_register(&s_Vfs, 0);
+	if (result != SQLITE_OK)
+	{
+		spdlog::error("Failed to register the SQLite VFS: {0}",
+			sqlite3_errstr(result));
+		s_Parent = nullptr;
+		return false;
+	}
+
+	return true;
+}
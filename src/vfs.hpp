@@ -0,0 +1,19 @@
+/*
+ * Simple Time-Series Database
+ *
+ * Compressing SQLite VFS
+ *
+ * A shim over the platform VFS that stores each page of a metric database
+ * compressed at the start of its own slot, and punches a hole over the
+ * unused remainder, so the filesystem doesn't allocate it. Page offsets
+ * are unchanged, so SQLite itself (and the WAL) see an ordinary file.
+ *
+ */
+
+#pragma once
+
+#define STSDB_VFS_NAME	"stsdb"
+
+// registers the VFS; compressed pages are always readable through it,
+// but pages are only compressed on write when compress is set
+bool RegisterCompressedVfs(bool compress);
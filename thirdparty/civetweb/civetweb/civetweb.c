@@ -2291,6 +2291,7 @@ enum {
 	/* Once for each server */
 	LISTENING_PORTS,
 	NUM_THREADS,
+	CONNECTION_QUEUE_SIZE,
 	RUN_AS_USER,
 	CONFIG_TCP_NODELAY, /* Prepended CONFIG_ to avoid conflict with the
 	                     * socket option typedef TCP_NODELAY. */
@@ -2393,6 +2394,7 @@ static const struct mg_option config_options[] = {
     /* Once for each server */
     {"listening_ports", MG_CONFIG_TYPE_STRING_LIST, "8080"},
     {"num_threads", MG_CONFIG_TYPE_NUMBER, "50"},
+    {"connection_queue", MG_CONFIG_TYPE_NUMBER, "20"},
     {"run_as_user", MG_CONFIG_TYPE_STRING, NULL},
     {"tcp_nodelay", MG_CONFIG_TYPE_NUMBER, "0"},
     {"max_request_size", MG_CONFIG_TYPE_NUMBER, "16384"},
@@ -2609,7 +2611,8 @@ struct mg_context {
 	struct socket *client_socks;
 	void **client_wait_events;
 #else
-	struct socket queue[MGSQLEN]; /* Accepted sockets */
+	struct socket *squeue; /* Accepted sockets, "connection_queue" of them */
+	int sq_size;           /* Length of the socket queue */
 	volatile int sq_head;         /* Head of the socket queue */
 	volatile int sq_tail;         /* Tail of the socket queue */
 	pthread_cond_t sq_full;       /* Signaled when socket is produced */
@@ -3437,6 +3440,15 @@ mg_set_user_connection_data(struct mg_connection *conn, void *data)
 }
 
 
+void
+mg_set_must_close(struct mg_connection *conn)
+{
+	if (conn != NULL) {
+		conn->must_close = 1;
+	}
+}
+
+
 void *
 mg_get_user_connection_data(const struct mg_connection *conn)
 {
@@ -6522,6 +6534,12 @@ discard_unread_request_data(struct mg_connection *conn)
 		return;
 	}
 
+	/* The connection is closed after this request, so whatever the
+	 * client still sends need not be read. */
+	if (conn->must_close) {
+		return;
+	}
+
 	to_read = sizeof(buf);
 
 	if (conn->is_chunked) {
@@ -17653,7 +17671,7 @@ consume_socket(struct mg_context *ctx, struct socket *sp, int thread_index)
 static int
 consume_socket(struct mg_context *ctx, struct socket *sp, int thread_index)
 {
-#define QUEUE_SIZE(ctx) ((int)(ARRAY_SIZE(ctx->queue)))
+#define QUEUE_SIZE(ctx) (ctx->sq_size)
 
 	(void)thread_index;
 
@@ -17668,7 +17686,7 @@ consume_socket(struct mg_context *ctx, struct socket *sp, int thread_index)
 	/* If we're stopping, sq_head may be equal to sq_tail. */
 	if (ctx->sq_head > ctx->sq_tail) {
 		/* Copy socket from the queue and increment tail */
-		*sp = ctx->queue[ctx->sq_tail % QUEUE_SIZE(ctx)];
+		*sp = ctx->squeue[ctx->sq_tail % QUEUE_SIZE(ctx)];
 		ctx->sq_tail++;
 
 		DEBUG_TRACE("grabbed socket %d, going busy", sp ? sp->sock : -1);
@@ -17692,7 +17710,7 @@ consume_socket(struct mg_context *ctx, struct socket *sp, int thread_index)
 static void
 produce_socket(struct mg_context *ctx, const struct socket *sp)
 {
-#define QUEUE_SIZE(ctx) ((int)(ARRAY_SIZE(ctx->queue)))
+#define QUEUE_SIZE(ctx) (ctx->sq_size)
 	if (!ctx) {
 		return;
 	}
@@ -17706,7 +17724,7 @@ produce_socket(struct mg_context *ctx, const struct socket *sp)
 
 	if (ctx->sq_head - ctx->sq_tail < QUEUE_SIZE(ctx)) {
 		/* Copy socket to the queue and increment head */
-		ctx->queue[ctx->sq_head % QUEUE_SIZE(ctx)] = *sp;
+		ctx->squeue[ctx->sq_head % QUEUE_SIZE(ctx)] = *sp;
 		ctx->sq_head++;
 		DEBUG_TRACE("queued socket %d", sp ? sp->sock : -1);
 	}
@@ -18186,6 +18204,7 @@ free_context(struct mg_context *ctx)
 #else
 	(void)pthread_cond_destroy(&ctx->sq_empty);
 	(void)pthread_cond_destroy(&ctx->sq_full);
+	mg_free(ctx->squeue);
 #endif
 
 	/* Destroy other context global data structures mutex */
@@ -18487,6 +18506,26 @@ mg_start(const struct mg_callbacks *callbacks,
 		return NULL;
 	}
 
+#if !defined(ALTERNATIVE_QUEUE)
+	/* Connection queue length option */
+	itmp = atoi(ctx->dd.config[CONNECTION_QUEUE_SIZE]);
+	if (itmp < 1) {
+		mg_cry_internal(fc(ctx), "%s", "Invalid connection queue length");
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+	ctx->squeue =
+	    (struct socket *)mg_calloc_ctx((size_t)itmp, sizeof(struct socket), ctx);
+	if (ctx->squeue == NULL) {
+		mg_cry_internal(fc(ctx), "%s", "Out of memory");
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+	ctx->sq_size = itmp;
+#endif
+
 /* Document root */
 #if defined(NO_FILES)
 	if (ctx->dd.config[DOCUMENT_ROOT] != NULL) {
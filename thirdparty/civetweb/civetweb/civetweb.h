@@ -612,6 +612,11 @@ CIVETWEB_API void mg_set_user_connection_data(struct mg_connection *conn,
                                               void *data);
 
 
+/* Close the connection once the current request has been handled,
+   without reading any request body the handler left unread. */
+CIVETWEB_API void mg_set_must_close(struct mg_connection *conn);
+
+
 /* Get user data set for the current connection. */
 CIVETWEB_API void *
 mg_get_user_connection_data(const struct mg_connection *conn);